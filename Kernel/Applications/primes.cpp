@@ -10,6 +10,7 @@
  */
 #include <stddef.h>
 #include <Library/Bitset.hpp>
+#include <Memory/heap.hpp>
 #include <Scheduler/tasks.hpp>
 #include <Applications/primes.hpp>
 #include <Devices/Graphics/console.hpp>
@@ -19,16 +20,26 @@ namespace Apps {
 // this value can be tweaked based on memory constraints
 #define PRIME_MAX_SQRT 4000
 #define PRIME_MAX (PRIME_MAX_SQRT * PRIME_MAX_SQRT)
-static Bitset<PRIME_MAX> map(1);
+// The sieve is allocated when the task starts rather than taking 2 MiB of
+// kernel BSS for the whole uptime
+static Bitset<0>* map = NULL;
 
 static size_t prime_current;
 
 void find_primes(void)
 {
+    size_t* storage = (size_t*)malloc(Bitset<0>::StorageWords(PRIME_MAX) * sizeof(size_t));
+    if (!storage) {
+        Console::printf("\e[s\e[23;0fNot enough memory to compute primes.\e[u");
+        prime_current = PRIME_MAX_SQRT;
+        return;
+    }
+    map = new Bitset<0>(PRIME_MAX, storage, true);
+
     for (prime_current = 2; prime_current < PRIME_MAX_SQRT; prime_current++) {
-        if (!map.Test(prime_current)) continue;
+        if (!map->Test(prime_current)) continue;
         for (size_t j = prime_current * prime_current; j < PRIME_MAX; j += prime_current) {
-            map.Clear(j);
+            map->Clear(j);
         }
     }
 }
@@ -41,9 +52,12 @@ void show_primes(void)
         Console::printf("\e[s\e[23;0fComputing primes: %%%zu\e[u", pct);
     } while (prime_current < PRIME_MAX_SQRT);
 
+    if (!map) {
+        return;
+    }
     size_t count = 0;
     for (size_t i = 2; i < PRIME_MAX; i++) {
-        count += map.Test(i);
+        count += map->Test(i);
     }
     Console::printf("\e[s\e[23;0fFound %zu primes between 2 and %u.\e[u", count, PRIME_MAX);
 }
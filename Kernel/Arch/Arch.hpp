@@ -75,6 +75,9 @@ void init();
 // Architecture common CPU controls
 void interruptsDisable();
 void interruptsEnable();
+uintptr_t interruptsSave();                 // Disable interrupts and return the previous state
+void interruptsRestore(uintptr_t state);    // Re-enable interrupts if they were enabled in `state`
+bool interruptsWereEnabled(uintptr_t state);
 // TODO: Add interruptsRegisterCallback(uint32_t id, func* cb)
 
 // Critical region lambda function
@@ -86,6 +89,15 @@ void criticalRegion(Function critWork)
     interruptsEnable();
 }
 
+// Lazy FPU / SIMD state switching
+void fpuInit();                     // Enable the FPU and SSE on the executing processor
+void fpuSwitch(struct task* prev);  // Save the FPU state of a task that is switched away from
+
+// Multiprocessor support
+void smpInit();     // Start all application processors (requires paging and the scheduler)
+size_t count();     // Number of processors online
+void haltOthers();  // Stop every other processor for good (when panicking)
+
 // CPU Identification
 const char* vendor();
 const char* model();
@@ -47,4 +47,62 @@ void pagingEnable();
  */
 void pagingDisable();
 
+/**
+ * @brief Allow large (ARCH_LARGE_PAGE_SIZE) pages to be mapped by directory
+ * entries, if the processor supports them.
+ *
+ * @return true Large pages can be used
+ * @return false Large pages are not supported
+ */
+bool pagingEnableLargePages();
+
+/**
+ * @brief Keep translations of global pages in the TLB when the page
+ * directory is switched, if the processor supports it.
+ *
+ * @return true Global pages are enabled
+ * @return false Global pages are not supported
+ */
+bool pagingEnableGlobalPages();
+
+/**
+ * @brief Program the page attribute table of the executing processor so that
+ * pages with the page attribute table bit set (and no other cache bits) are
+ * write-combining. Must be called on every processor.
+ *
+ * @return true Write-combining pages can be mapped
+ * @return false The processor has no page attribute table
+ */
+bool pagingEnableWriteCombining();
+
+/**
+ * @brief Address whose access caused the most recent page fault on the
+ * executing processor.
+ *
+ */
+uintptr_t pagingFaultAddress();
+
+/**
+ * @brief Flush every translation from the TLB of the executing processor,
+ * including those of global pages.
+ *
+ */
+void pagingFlushTLB();
+
+/**
+ * @brief Flush every translation from the TLBs of the other online
+ * processors and wait until all of them have. Page table entries cleared
+ * before the call can't be used by any processor once it returns.
+ *
+ */
+void pagingShootdownTLB();
+
+/**
+ * @brief Flush the executing processor's TLB if a shootdown is waiting on
+ * it. Busy-wait loops call this, so that a processor spinning with
+ * interrupts disabled still answers (and a shootdown can't deadlock).
+ *
+ */
+void pagingShootdownService();
+
 } // !namespace Arch::Memory
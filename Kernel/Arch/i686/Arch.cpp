@@ -12,6 +12,7 @@
 #include <Arch/i686/Arch.hpp>
 #include <Arch/i686/regs.hpp>
 #include <Arch/i686/gdt.hpp>
+#include <Arch/i686/smp.hpp>
 #include <Arch/i686/idt.hpp>
 #include <Arch/i686/isr.hpp>
 #include <Arch/i686/ports.hpp>
@@ -28,6 +29,14 @@
 #include <Devices/Graphics/console.hpp>
 #include <Devices/Serial/rs232.hpp>
 
+#define PAGING_CPUID_PSE (1 << 3)   // CPUID.01h:EDX, 4 MiB pages
+#define PAGING_CPUID_PGE (1 << 13)  // CPUID.01h:EDX, global pages
+#define PAGING_CPUID_PAT (1 << 16)  // CPUID.01h:EDX, page attribute table
+#define PAGING_MSR_PAT 0x277
+// Power-on default attribute table (WB, WT, UC-, UC repeated), except entry 4
+// (selected by the page attribute table bit alone) which is write-combining
+#define PAGING_PAT_VALUE 0x0007040100070406ULL
+
 const char exceptionStrings[33][32] = {
     "Divide-By-Zero", "Debugging", "Non-Maskable Interrupt", "Breakpoint",
     "Overflow", "Bound Range Exceeded", "Invalid Opcode", "Device Not Available",
@@ -103,6 +112,54 @@ void pagingDisable() {
     Registers::writeCR0(cr0);
 }
 
+bool pagingEnableLargePages() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(edx & PAGING_CPUID_PSE)) {
+        return false;
+    }
+    struct Registers::CR4 cr4 = Registers::readCR4();
+    cr4.pageSizeExtension = 1;
+    Registers::writeCR4(cr4);
+    return true;
+}
+
+bool pagingEnableGlobalPages() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(edx & PAGING_CPUID_PGE)) {
+        return false;
+    }
+    struct Registers::CR4 cr4 = Registers::readCR4();
+    cr4.pageGlobalEnable = 1;
+    Registers::writeCR4(cr4);
+    return true;
+}
+
+bool pagingEnableWriteCombining() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(edx & PAGING_CPUID_PAT)) {
+        return false;
+    }
+    Registers::writeMSR(PAGING_MSR_PAT, PAGING_PAT_VALUE);
+    return true;
+}
+
+uintptr_t pagingFaultAddress() {
+    return Registers::readCR2().pageFaultAddr;
+}
+
+void pagingFlushTLB() {
+    struct Registers::CR4 cr4 = Registers::readCR4();
+    if (!cr4.pageGlobalEnable) {
+        Registers::writeCR3(Registers::readCR3());
+        return;
+    }
+    // Reloading CR3 keeps global pages, but toggling CR4.PGE drops everything
+    cr4.pageGlobalEnable = 0;
+    Registers::writeCR4(cr4);
+    cr4.pageGlobalEnable = 1;
+    Registers::writeCR4(cr4);
+}
+
 } // !namespace Arch::Memory
 
 namespace Arch::CPU {
@@ -110,9 +167,10 @@ namespace Arch::CPU {
 void init()
 {
     criticalRegion([]() {
-        GDT::init();        // Initialize the Global Descriptor Table
-        Interrupts::init(); // Initialize Interrupt Service Requests
-        timer_init(1000);   // Programmable Interrupt Timer (1ms)
+        SMP::initProcessor(0); // Initialize the BSP's per-processor data, GDT and TSS
+        Interrupts::init();    // Initialize Interrupt Service Requests
+        fpuInit();             // Enable the FPU and SSE
+        timer_init(1000);      // Programmable Interrupt Timer (1ms)
     });
 }
 
@@ -124,6 +182,23 @@ void interruptsEnable() {
     asm volatile("sti");
 }
 
+uintptr_t interruptsSave() {
+    uintptr_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+void interruptsRestore(uintptr_t state) {
+    if (interruptsWereEnabled(state)) {
+        asm volatile("sti" ::: "memory");
+    }
+}
+
+bool interruptsWereEnabled(uintptr_t state) {
+    // Interrupt enable flag (EFLAGS.IF)
+    return state & (1 << 9);
+}
+
 const char* vendor()
 {
     static int vendor[4];
@@ -13,6 +13,15 @@
 #include <Arch/i686/ports.hpp>
 #include <Arch/i686/isr.hpp>
 
+#define ARCH_MAX_CPUS           8   // Maximum number of processors brought online
+#define ARCH_CPU_LOCAL_SELF     0   // Offset of Arch::CPU::Local::self
+#define ARCH_CPU_LOCAL_TASK     4   // Offset of Arch::CPU::Local::task (used by tasks.s)
+#define ARCH_CPU_LOCAL_ID       8   // Offset of Arch::CPU::Local::id
+#define ARCH_FPU_STATE_SIZE     512 // Size of an FXSAVE area
+#define ARCH_FPU_STATE_ALIGN    16  // Required alignment of an FXSAVE area
+
+struct task;
+
 namespace Arch {
 
 struct stackframe {
@@ -21,3 +30,62 @@ struct stackframe {
 };
 
 } // !namespace Arch
+
+namespace Arch::CPU {
+
+// Defined in Arch/i686/smp.hpp. Every processor's %gs segment is based at its own Local.
+struct Local;
+
+/**
+ * @brief Returns the per-processor data block of the executing processor.
+ *
+ */
+[[gnu::always_inline]] inline struct Local* local()
+{
+    struct Local* self;
+    asm volatile("mov %%gs:%c1, %0" : "=r"(self) : "i"(ARCH_CPU_LOCAL_SELF));
+    return self;
+}
+
+/**
+ * @brief Returns the logical index (0 being the bootstrap processor)
+ * of the executing processor.
+ *
+ */
+[[gnu::always_inline]] inline size_t id()
+{
+    size_t cpu;
+    asm volatile("mov %%gs:%c1, %0" : "=r"(cpu) : "i"(ARCH_CPU_LOCAL_ID));
+    return cpu;
+}
+
+/**
+ * @brief Returns the task currently running on the executing processor.
+ *
+ */
+[[gnu::always_inline]] inline struct task* currentTask()
+{
+    struct task* task;
+    asm volatile("mov %%gs:%c1, %0" : "=r"(task) : "i"(ARCH_CPU_LOCAL_TASK));
+    return task;
+}
+
+/**
+ * @brief Sets the task currently running on the executing processor.
+ *
+ */
+[[gnu::always_inline]] inline void setCurrentTask(struct task* task)
+{
+    asm volatile("mov %0, %%gs:%c1" :: "r"(task), "i"(ARCH_CPU_LOCAL_TASK) : "memory");
+}
+
+/**
+ * @brief Spin-wait hint for busy loops.
+ *
+ */
+[[gnu::always_inline]] inline void relax()
+{
+    asm volatile("pause" ::: "memory");
+}
+
+} // !namespace Arch::CPU
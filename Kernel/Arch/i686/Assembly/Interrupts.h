@@ -66,6 +66,9 @@ void interrupt12();
 void interrupt13();
 void interrupt14();
 void interrupt15();
+void interrupt16();
+void interrupt17();
+void interruptSpurious();
 
 /**
  * @brief CPU exception handler. Must be available for each exception
@@ -11,9 +11,7 @@ exception_stub:
     push eax            ; save the data segment descriptor
     mov ax, 0x10        ; kernel data segment descriptor
     mov ds, ax
-    mov es, ax
-    mov fs, ax
-    mov gs, ax
+    mov es, ax          ; gs holds the per-processor data segment and is never changed
     push esp            ; Push struct registers *r
     ; 2. Clear the direction flag (eflags) & call C handler
     cld                 ; C code following the sysV ABI requires DF to be clear on function entry
@@ -24,8 +22,6 @@ exception_stub:
     pop eax
     mov ds, ax
     mov es, ax
-    mov fs, ax
-    mov gs, ax
     popad
     add esp, 8          ; Cleans up the pushed error code and pushed ISR number
     iret                ; pops 5 things at once: CS, EIP, EFLAGS, SS, and ESP
@@ -40,8 +36,6 @@ interrupt_stub:
     mov ax, 0x10
     mov ds, ax
     mov es, ax
-    mov fs, ax
-    mov gs, ax
     push esp
     cld
     call interruptHandler ; Different than the ISR code
@@ -49,8 +43,6 @@ interrupt_stub:
     pop ebx          ; Different than the ISR code
     mov ds, bx
     mov es, bx
-    mov fs, bx
-    mov gs, bx
     popad
     add esp, 8
     iret
@@ -153,3 +145,10 @@ m_interrupt 12, 44      ; PS2 Mouse
 m_interrupt 13, 45      ; Numeric Coprocessor
 m_interrupt 14, 46      ; IDE0 (HDD)
 m_interrupt 15, 47      ; IDE1 (HDD)
+m_interrupt 16, 48      ; LAPIC timer
+m_interrupt 17, 49      ; TLB shootdown IPI
+
+; Spurious interrupts from the LAPIC must not be acknowledged
+global interruptSpurious
+interruptSpurious:
+    iret
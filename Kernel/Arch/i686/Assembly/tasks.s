@@ -7,12 +7,12 @@ struc task
 endstruc
 
 %define TASK_RUNNING 0
-%define TASK_READY   1
+
+; Offset of the current task in the per-processor data block (see Arch/i686/Arch.hpp)
+%define ARCH_CPU_LOCAL_TASK 4
 
 bits    32
 section .text
-extern  current_task:data, tasks_ready_tail:data
-extern  _tasks_enqueue_ready:function
 global  tasks_switch_to:function
 tasks_switch_to:
     ;Save previous task's state
@@ -21,23 +21,18 @@ tasks_switch_to:
     ;  EIP is already saved on the stack by the caller's "CALL" instruction
     ;  The task isn't able to change CR3 so it doesn't need to be saved
     ;  Segment registers are constants (while running kernel code) so they don't need to be saved
+    ;  The scheduler has already put the previous task back on a ready queue (if needed)
     push ebx
     push esi
     push edi
     push ebp
 
-    mov edi,[current_task]        ;edi = address of the previous task's "thread control block"
+    mov edi,[gs:ARCH_CPU_LOCAL_TASK] ;edi = address of the previous task's "thread control block"
     mov [edi+task.stack],esp      ;Save ESP for previous task's kernel stack in the thread's TCB
-    cmp dword [edi+task.state],TASK_RUNNING
-    jne .state_updated
-    mov dword [edi+task.state],TASK_READY ;Set the task's state to ready (from running)
-    push edi ; push the task to be enqueued
-    call _tasks_enqueue_ready ; call the enqueue function
-    add esp,4 ; fix up the stack
- .state_updated:
+
     ;Load next task's state
     mov esi,[esp+(4+1)*4]         ;esi = address of the next task's "thread control block" (parameter passed on stack)
-    mov [current_task],esi        ;Current task's TCB is the next task TCB
+    mov [gs:ARCH_CPU_LOCAL_TASK],esi ;Current task's TCB is the next task TCB
 
     mov esp,[esi+task.stack]      ;Load ESP for next task's kernel stack from the thread's TCB
 
@@ -0,0 +1,89 @@
+; @file trampoline.s
+; @brief Application processor (AP) startup trampoline. The bootstrap
+; processor copies this code below 1 MiB and wakes the APs with a
+; STARTUP IPI pointing at it. Each AP starts here in real mode, switches
+; to protected mode, enables paging with the kernel page directory,
+; claims an index (and with it a stack) and jumps into the kernel.
+;
+; The code is copied to SMP_TRAMPOLINE_ADDR (see smp.cpp), so every
+; absolute address is computed relative to that location instead of
+; the address this file is linked at.
+;
+section .text
+align 4
+
+%define TRAMPOLINE_ADDR 0x8000
+%define REL(label) (TRAMPOLINE_ADDR + (label) - smpTrampolineStart)
+
+global smpTrampolineStart
+global smpTrampolineEnd
+global smpTrampolineData
+
+bits 16
+smpTrampolineStart:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    lgdt [REL(trampolineGDTR)]
+    mov eax, cr0
+    or eax, 1                       ; Enable protected mode
+    mov cr0, eax
+    jmp dword 0x08:REL(trampolineProtected)
+
+bits 32
+trampolineProtected:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    ; Use the same control register setup as the bootstrap processor
+    mov eax, [REL(smpTrampolineData.cr4)]
+    mov cr4, eax
+    mov eax, [REL(smpTrampolineData.cr3)]
+    mov cr3, eax
+    mov eax, [REL(smpTrampolineData.cr0)]
+    mov cr0, eax                    ; Paging is now enabled (the trampoline is identity mapped)
+    ; Claim an AP index
+    mov eax, 1
+    lock xadd [REL(smpTrampolineData.count)], eax
+    cmp eax, [REL(smpTrampolineData.maxCount)]
+    jae .park                       ; More processors than we have room for
+    ; esp = stacks + (index + 1) * stackSize
+    mov ecx, eax
+    inc ecx
+    imul ecx, [REL(smpTrampolineData.stackSize)]
+    add ecx, [REL(smpTrampolineData.stacks)]
+    mov esp, ecx
+    push eax                        ; AP index argument
+    push 0                          ; Null return address for stack traces
+    mov ebx, [REL(smpTrampolineData.entry)]
+    jmp ebx
+.park:
+    cli
+    hlt
+    jmp .park
+
+align 8
+trampolineGDT:
+    dq 0                            ; Null segment
+    dq 0x00CF9A000000FFFF           ; Flat 32-bit code segment
+    dq 0x00CF92000000FFFF           ; Flat 32-bit data segment
+trampolineGDTR:
+    dw trampolineGDTR - trampolineGDT - 1
+    dd REL(trampolineGDT)
+
+; Filled in by the bootstrap processor (must match struct TrampolineData)
+align 4
+smpTrampolineData:
+.cr0:       dd 0
+.cr3:       dd 0
+.cr4:       dd 0
+.entry:     dd 0
+.stacks:    dd 0
+.stackSize: dd 0
+.maxCount:  dd 0
+.count:     dd 0
+smpTrampolineEnd:
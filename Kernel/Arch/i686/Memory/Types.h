@@ -15,6 +15,7 @@
 #define ARCH_PAGE_DIR_ENTRIES       1024
 #define ARCH_PAGE_TABLE_ENTRIES     1024
 #define ARCH_PAGE_SIZE              4096
+#define ARCH_LARGE_PAGE_SIZE        0x00400000  // Page mapped by a single directory entry (needs CR4.PSE)
 #define ARCH_TABLE_SIZE             ARCH_PAGE_SIZE
 #define ARCH_DIRECTORY_SIZE         ARCH_PAGE_SIZE
 #define ARCH_PAGE_ALIGN             0xFFFFF000
@@ -104,8 +105,9 @@ struct DirectoryEntry
     uint32_t accessed           : 1;  // Has the page been accessed?
     uint32_t ignoredA           : 1;  // Ignored
     uint32_t size               : 1;  // Is the page 4 Mb (enabled) or 4 Kb (disabled)?
-    uint32_t ignoredB           : 4;  // Ignored
-    uint32_t tableAddr          : 20; // Physical address of the table
+    uint32_t global             : 1;  // Keep in the TLB across directory switches (4 Mb pages only)
+    uint32_t ignoredB           : 3;  // Ignored
+    uint32_t tableAddr          : 20; // Physical address of the table (or of the 4 Mb page)
 };
 
 /**
@@ -0,0 +1,119 @@
+/**
+ * @file fpu.cpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief Lazy FPU / SSE context switching. Every task switch sets CR0.TS, so
+ * the first FPU or SSE instruction a task executes afterwards raises a device
+ * not available exception, which loads the task's state. State is only saved
+ * for tasks that used the FPU during their time slice.
+ * @version 0.1
+ * @date 2022-03-17
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ */
+#include <Arch/Arch.hpp>
+#include <Arch/i686/isr.hpp>
+#include <Arch/i686/regs.hpp>
+#include <Arch/i686/smp.hpp>
+#include <Scheduler/tasks.hpp>
+#include <Logger.hpp>
+#include <cpuid.h>
+
+#define FPU_CPUID_FXSR      (1 << 24)   // CPUID.01h:EDX
+#define FPU_CPUID_SSE       (1 << 25)   // CPUID.01h:EDX
+#define FPU_MXCSR_DEFAULT   0x1F80      // All SIMD floating point exceptions masked
+
+namespace Arch::CPU {
+
+static bool fpuLazy = false;
+// Captured right after initialization and loaded for tasks that haven't used the FPU yet
+[[gnu::aligned(ARCH_FPU_STATE_ALIGN)]] static uint8_t fpuInitialState[ARCH_FPU_STATE_SIZE];
+
+static void* fpuArea(struct task* task)
+{
+    uintptr_t area = (uintptr_t)task->fpu_state;
+    return (void*)((area + ARCH_FPU_STATE_ALIGN - 1) & ~(uintptr_t)(ARCH_FPU_STATE_ALIGN - 1));
+}
+
+[[gnu::always_inline]] static inline void fxsave(void* area)
+{
+    asm volatile("fxsave (%0)" :: "r"(area) : "memory");
+}
+
+[[gnu::always_inline]] static inline void fxrstor(void* area)
+{
+    asm volatile("fxrstor (%0)" :: "r"(area) : "memory");
+}
+
+static void fpuDeviceUnavailable(struct registers* regs)
+{
+    (void)regs;
+    struct Local* cpu = local();
+    struct task* current = cpu->task;
+    asm volatile("clts");
+    if (cpu->fpuOwner == current && current->fpu_cpu == cpu->id) {
+        // Nobody else used the FPU on this processor since this task did
+        return;
+    }
+
+    // The previous owner's state was saved when it was switched away from
+    fxrstor(current->fpu_used ? fpuArea(current) : fpuInitialState);
+    current->fpu_used = true;
+    current->fpu_cpu = cpu->id;
+    cpu->fpuOwner = current;
+}
+
+void fpuInit()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(edx & FPU_CPUID_FXSR)) {
+        LOG_WARNING(__func__, "No FXSAVE support. FPU state is not preserved across task switches.");
+        return;
+    }
+
+    struct Registers::CR0 cr0 = Registers::readCR0();
+    cr0.emulation = 0;
+    cr0.monitorCoProcessor = 1;
+    cr0.numericError = 1;
+    cr0.taskSwitched = 0;
+    Registers::writeCR0(cr0);
+
+    struct Registers::CR4 cr4 = Registers::readCR4();
+    cr4.osfxsr = 1;
+    cr4.osxmmexcpt = (edx & FPU_CPUID_SSE) ? 1 : 0;
+    Registers::writeCR4(cr4);
+
+    asm volatile("fninit");
+    if (edx & FPU_CPUID_SSE) {
+        uint32_t mxcsr = FPU_MXCSR_DEFAULT;
+        asm volatile("ldmxcsr %0" :: "m"(mxcsr));
+    }
+
+    if (id() == 0) {
+        fxsave(fpuInitialState);
+        Interrupts::registerHandler(Interrupts::EXCEPTION_DEVICE_UNAVAIL, fpuDeviceUnavailable);
+        fpuLazy = true;
+    }
+}
+
+void fpuSwitch(struct task* prev)
+{
+    if (!fpuLazy) {
+        return;
+    }
+
+    struct Local* cpu = local();
+    struct Registers::CR0 cr0 = Registers::readCR0();
+    if (!cr0.taskSwitched) {
+        // The task used the FPU during this time slice
+        fxsave(fpuArea(prev));
+        prev->fpu_used = true;
+        prev->fpu_cpu = cpu->id;
+        cpu->fpuOwner = prev;
+    }
+
+    cr0.taskSwitched = 1;
+    Registers::writeCR0(cr0);
+}
+
+} // !namespace Arch::CPU
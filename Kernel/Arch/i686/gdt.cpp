@@ -9,18 +9,15 @@
  *
  */
 #include <Arch/i686/gdt.hpp>
+#include <Arch/i686/smp.hpp>
 #include <Arch/i686/Assembly/Flush.h>
 #include <Library/string.hpp>
 
-#define ARCH_GDT_MAX_ENTRIES 5
-
 namespace GDT {
 
-struct Entry gdt[ARCH_GDT_MAX_ENTRIES];
-struct Registers::GDTR gdtr;
-
-void init()
+void init(struct Arch::CPU::Local* local)
 {
+    struct Entry* gdt = local->gdt;
     uint8_t gdtIndex = 0;
     const union Base nullSegmentBase = { .value = 0 };
     const union Limit nullSegmentLimit = { .value = 0 };
@@ -122,11 +119,59 @@ void init()
         .base_high = userDataBase.section.high,
     };
 
+    const union Base tssBase = { .value = (uint32_t)&local->tss };
+    const union Limit tssLimit = { .value = sizeof(local->tss) - 1 };
+    gdt[gdtIndex++] = {
+        .limit_low = tssLimit.section.low,
+        .base_low = tssBase.section.low,
+        .accessed = 1,
+        .rw = 0,
+        .dc = 0,
+        .executable = 1,
+        .system = 0,
+        .privilege = 0,
+        .present = 1,
+        .limit_high = tssLimit.section.high,
+        .reserved = 0,
+        .longMode = 0,
+        .size = 0,
+        .granulatity = 0,
+        .base_high = tssBase.section.high,
+    };
+
+    const union Base localBase = { .value = (uint32_t)local };
+    const union Limit localLimit = { .value = sizeof(*local) - 1 };
+    gdt[gdtIndex++] = {
+        .limit_low = localLimit.section.low,
+        .base_low = localBase.section.low,
+        .accessed = 0,
+        .rw = 1,
+        .dc = 0,
+        .executable = 0,
+        .system = 1,
+        .privilege = 0,
+        .present = 1,
+        .limit_high = localLimit.section.high,
+        .reserved = 0,
+        .longMode = 0,
+        .size = 1,
+        .granulatity = 0,
+        .base_high = localBase.section.high,
+    };
+
+    // The kernel stack used on privilege level changes is set by the scheduler
+    memset(&local->tss, 0, sizeof(local->tss));
+    local->tss.ss0 = GDT_SELECTOR_KERNEL_DATA;
+    local->tss.iomap_base = sizeof(local->tss);
+
     // Update GDT register and flush
-    gdtr.size = sizeof(gdt) - 1;
-    gdtr.base = (uint32_t)&gdt;
+    local->gdtr.size = sizeof(local->gdt) - 1;
+    local->gdtr.base = (uint32_t)gdt;
 
-    gdt_flush((uint32_t)&gdtr);
+    gdt_flush((uint32_t)&local->gdtr);
+    tss_flush();
+    // Interrupt stubs never touch %gs, so this stays loaded from here on
+    asm volatile("mov %0, %%gs" :: "r"(GDT_SELECTOR_LOCAL) : "memory");
 }
 
 } // !namespace GDT
@@ -13,6 +13,13 @@
 #include <stdint.h>
 #include <Arch/i686/Arch.hpp>
 
+#define ARCH_GDT_MAX_ENTRIES 7
+
+#define GDT_SELECTOR_KERNEL_CODE    0x08
+#define GDT_SELECTOR_KERNEL_DATA    0x10
+#define GDT_SELECTOR_TSS            0x28
+#define GDT_SELECTOR_LOCAL          0x30    // Per-processor data segment (loaded into %gs)
+
 namespace GDT {
 
 union Limit {
@@ -64,9 +71,12 @@ struct [[gnu::packed]] Entry {
 static_assert(sizeof(struct Entry) == 8);
 
 /**
- * @brief Setup and install the GDT onto the system.
+ * @brief Setup and install the GDT onto the executing processor. Each
+ * processor has its own table, task state segment and a data segment
+ * based at its per-processor data block, which is loaded into %gs.
  *
+ * @param local Per-processor data block holding the table
  */
-void init();
+void init(struct Arch::CPU::Local* local);
 
 } // !namespace GDT
@@ -11,6 +11,7 @@
 #include <Arch/Arch.hpp>
 #include <Arch/i686/idt.hpp>
 #include <Arch/i686/isr.hpp>
+#include <Arch/i686/lapic.hpp>
 #include <Arch/i686/Assembly/Interrupts.h>
 #include <Panic.hpp>
 
@@ -28,6 +29,13 @@ extern "C" {
  */
 void exceptionHandler(struct registers* regs)
 {
+    // Some exceptions (e.g. device not available) are part of normal operation
+    if (interruptHandlers[regs->int_num]) {
+        InterruptHandler_t handler = interruptHandlers[regs->int_num];
+        handler(regs);
+        return;
+    }
+
     panic(regs);
 }
 
@@ -39,14 +47,19 @@ void exceptionHandler(struct registers* regs)
 void interruptHandler(struct registers* regs)
 {
     // After every interrupt we need to send an EOI to the PICs or it won't send another
-    if (regs->int_num >= 0x28) {
-        // Respond to secondard PIC
-        writeByte(0xA0, 0x20);
+    if (regs->int_num >= LAPIC_VECTOR_TIMER) {
+        // Local interrupts are acknowledged to the executing processor's LAPIC
+        LAPIC::eoi();
+    } else {
+        if (regs->int_num >= 0x28) {
+            // Respond to secondard PIC
+            writeByte(0xA0, 0x20);
+        }
+
+        // Respond to primary PIC
+        writeByte(0x20, 0x20);
     }
 
-    // Respond to primary PIC
-    writeByte(0x20, 0x20);
-
     if (interruptHandlers[regs->int_num]) {
         InterruptHandler_t handler = interruptHandlers[regs->int_num];
         handler(regs);
@@ -64,7 +77,8 @@ void (*exceptionHandlerStubs[ARCH_EXCEPTION_NUM])(void) = {
 
 void (*interruptHandlerStubs[ARCH_INTERRUPT_NUM])(void) = {
     interrupt0, interrupt1, interrupt2,  interrupt3,  interrupt4,  interrupt5,  interrupt6,  interrupt7,
-    interrupt8, interrupt9, interrupt10, interrupt11, interrupt12, interrupt13, interrupt14, interrupt15
+    interrupt8, interrupt9, interrupt10, interrupt11, interrupt12, interrupt13, interrupt14, interrupt15,
+    interrupt16, interrupt17
 };
 
 void init()
@@ -90,6 +104,7 @@ void init()
     for (int interrupt = 0; interrupt < ARCH_INTERRUPT_NUM; interrupt++) {
         IDT::setGate(32 + interrupt, (uint32_t)interruptHandlerStubs[interrupt]);
     }
+    IDT::setGate(LAPIC_VECTOR_SPURIOUS, (uint32_t)interruptSpurious);
 
     // Load the IDT now that we've registered all of our IDT, IRQ, and ISR addresses
     IDT::init();
@@ -13,7 +13,7 @@
 #include <stdint.h>
 
 #define ARCH_EXCEPTION_NUM 32           // Hardware exception count
-#define ARCH_INTERRUPT_NUM 16           // Hardware interrupt count
+#define ARCH_INTERRUPT_NUM 18           // Hardware interrupt count (PIC, LAPIC timer and TLB shootdown)
 #define ARCH_INTERRUPT_HANDLER_MAX 256  // Max number of registered interrupt handlers
 
 namespace Interrupts {
@@ -73,6 +73,8 @@ enum Interrupt {
     INTERRUPT_13    = 0x2D,
     INTERRUPT_14    = 0x2E,
     INTERRUPT_15    = 0x2F,
+    INTERRUPT_16    = 0x30, // LAPIC timer (not routed through the PIC)
+    INTERRUPT_17    = 0x31, // TLB shootdown IPI (not routed through the PIC)
 };
 
 /* Interrupt Service Routines */
@@ -0,0 +1,179 @@
+/**
+ * @file lapic.cpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief Local Advanced Programmable Interrupt Controller (LAPIC) driver.
+ * @version 0.1
+ * @date 2022-03-12
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ */
+#include <Arch/i686/lapic.hpp>
+#include <Arch/i686/isr.hpp>
+#include <Arch/i686/regs.hpp>
+#include <Arch/i686/timer.hpp>
+#include <Arch/Memory.hpp>
+#include <Memory/paging.hpp>
+#include <Logger.hpp>
+#include <cpuid.h>
+
+#define LAPIC_CPUID_FEATURE         (1 << 9)    // CPUID.01h:EDX
+#define LAPIC_MSR_BASE              0x1B
+#define LAPIC_MSR_BASE_ENABLE       (1 << 11)
+
+#define LAPIC_REG_ID                0x020
+#define LAPIC_REG_TPR               0x080
+#define LAPIC_REG_EOI               0x0B0
+#define LAPIC_REG_SVR               0x0F0
+#define LAPIC_REG_ICR_LOW           0x300
+#define LAPIC_REG_ICR_HIGH          0x310
+#define LAPIC_REG_LVT_TIMER         0x320
+#define LAPIC_REG_TIMER_INITIAL     0x380
+#define LAPIC_REG_TIMER_CURRENT     0x390
+#define LAPIC_REG_TIMER_DIVIDE      0x3E0
+
+#define LAPIC_SVR_ENABLE            (1 << 8)
+#define LAPIC_ICR_PENDING           (1 << 12)
+#define LAPIC_ICR_ASSERT            (1 << 14)
+#define LAPIC_ICR_ALL_BUT_SELF      (3 << 18)
+#define LAPIC_ICR_FIXED             (0 << 8)
+#define LAPIC_ICR_NMI               (4 << 8)
+#define LAPIC_ICR_INIT              (5 << 8)
+#define LAPIC_ICR_STARTUP           (6 << 8)
+#define LAPIC_LVT_MASKED            (1 << 16)
+#define LAPIC_LVT_PERIODIC          (1 << 17)
+#define LAPIC_TIMER_DIVIDE_16       0x3
+
+#define LAPIC_CALIBRATION_MS        10
+
+namespace LAPIC {
+
+static volatile uint32_t* lapicBase = NULL;
+static uint32_t timerTicksPerMs = 0;
+static uint32_t timerNsMult = 0;    // Timer ticks per nanosecond (0.32 fixed-point)
+
+static void timerCallback(struct registers* regs);
+
+[[gnu::always_inline]] static inline uint32_t read(uint32_t reg)
+{
+    return lapicBase[reg / sizeof(uint32_t)];
+}
+
+[[gnu::always_inline]] static inline void write(uint32_t reg, uint32_t value)
+{
+    lapicBase[reg / sizeof(uint32_t)] = value;
+}
+
+bool isSupported()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+
+    return edx & LAPIC_CPUID_FEATURE;
+}
+
+void init()
+{
+    if (lapicBase == NULL) {
+        // All processors share the same physical base, so the first caller (the BSP) maps it
+        uintptr_t base = (uintptr_t)Registers::readMSR(LAPIC_MSR_BASE) & ~(ARCH_PAGE_SIZE - 1);
+        Memory::mapKernelRangeVirtual(Memory::Section(base, ARCH_PAGE_SIZE));
+        lapicBase = (volatile uint32_t*)base;
+        Interrupts::registerHandler(LAPIC_VECTOR_TIMER, timerCallback);
+        LOG_DEBUG(__func__, "LAPIC registers at 0x%08lX", (uint32_t)base);
+    }
+
+    Registers::writeMSR(LAPIC_MSR_BASE, Registers::readMSR(LAPIC_MSR_BASE) | LAPIC_MSR_BASE_ENABLE);
+    write(LAPIC_REG_TPR, 0);
+    write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | LAPIC_VECTOR_SPURIOUS);
+}
+
+uint32_t id()
+{
+    return read(LAPIC_REG_ID) >> 24;
+}
+
+void eoi()
+{
+    write(LAPIC_REG_EOI, 0);
+}
+
+static void sendIPI(uint32_t command)
+{
+    write(LAPIC_REG_ICR_HIGH, 0);
+    write(LAPIC_REG_ICR_LOW, command);
+    while (read(LAPIC_REG_ICR_LOW) & LAPIC_ICR_PENDING) { }
+}
+
+void broadcastInit()
+{
+    sendIPI(LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_ASSERT | LAPIC_ICR_INIT);
+}
+
+void broadcastStartup(uint8_t page)
+{
+    sendIPI(LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_ASSERT | LAPIC_ICR_STARTUP | page);
+}
+
+void broadcastFixed(uint8_t vector)
+{
+    sendIPI(LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_ASSERT | LAPIC_ICR_FIXED | vector);
+}
+
+void broadcastNMI()
+{
+    sendIPI(LAPIC_ICR_ALL_BUT_SELF | LAPIC_ICR_ASSERT | LAPIC_ICR_NMI);
+}
+
+void timerCalibrate()
+{
+    write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_MASKED | LAPIC_VECTOR_TIMER);
+
+    // Start counting on a PIT tick edge so that the whole window is measured
+    uint32_t tick = timer_tick;
+    while (timer_tick == tick) { }
+    write(LAPIC_REG_TIMER_INITIAL, UINT32_MAX);
+    sleep(LAPIC_CALIBRATION_MS);
+    uint32_t elapsed = UINT32_MAX - read(LAPIC_REG_TIMER_CURRENT);
+    write(LAPIC_REG_TIMER_INITIAL, 0);
+
+    timerTicksPerMs = elapsed / LAPIC_CALIBRATION_MS;
+    // Precomputed so that one-shots don't need a 64-bit divide
+    timerNsMult = (uint32_t)(((uint64_t)timerTicksPerMs << 32) / (1000 * 1000));
+    LOG_DEBUG(__func__, "LAPIC timer runs at %lu ticks/ms", timerTicksPerMs);
+}
+
+void timerStart()
+{
+    write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    write(LAPIC_REG_LVT_TIMER, LAPIC_LVT_PERIODIC | LAPIC_VECTOR_TIMER);
+    write(LAPIC_REG_TIMER_INITIAL, timerTicksPerMs);
+}
+
+void timerOneShot(uint64_t ns)
+{
+    if (ns > UINT32_MAX) {
+        ns = UINT32_MAX;
+    }
+    uint64_t count = ((uint64_t)(uint32_t)ns * timerNsMult) >> 32;
+    if (count == 0) {
+        count = 1;
+    } else if (count > UINT32_MAX) {
+        count = UINT32_MAX;
+    }
+
+    write(LAPIC_REG_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    write(LAPIC_REG_LVT_TIMER, LAPIC_VECTOR_TIMER);
+    write(LAPIC_REG_TIMER_INITIAL, (uint32_t)count);
+}
+
+static void timerCallback(struct registers* regs)
+{
+    (void)regs;
+    timer_run_callbacks();
+}
+
+} // !namespace LAPIC
@@ -0,0 +1,102 @@
+/**
+ * @file lapic.hpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief Local Advanced Programmable Interrupt Controller (LAPIC) driver.
+ * Every processor has its own LAPIC which is used to send inter-processor
+ * interrupts and to drive the processor's scheduler timer.
+ * @version 0.1
+ * @date 2022-03-12
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#define LAPIC_VECTOR_TIMER      0x30    // Interrupt vector of the LAPIC timer
+#define LAPIC_VECTOR_SHOOTDOWN  0x31    // Interrupt vector of TLB shootdown IPIs
+#define LAPIC_VECTOR_SPURIOUS   0xFF    // Interrupt vector of spurious LAPIC interrupts
+
+namespace LAPIC {
+
+/**
+ * @brief Checks whether the processor has a LAPIC.
+ *
+ */
+bool isSupported();
+
+/**
+ * @brief Map (if necessary) and software enable the executing
+ * processor's LAPIC.
+ *
+ */
+void init();
+
+/**
+ * @brief Returns the executing processor's LAPIC ID.
+ *
+ */
+uint32_t id();
+
+/**
+ * @brief Signal the end of an interrupt delivered by the LAPIC.
+ *
+ */
+void eoi();
+
+/**
+ * @brief Send an INIT inter-processor interrupt to every
+ * processor except the executing one.
+ *
+ */
+void broadcastInit();
+
+/**
+ * @brief Send a STARTUP inter-processor interrupt to every
+ * processor except the executing one.
+ *
+ * @param page Physical page index (below 1 MiB) to start executing at
+ */
+void broadcastStartup(uint8_t page);
+
+/**
+ * @brief Send a fixed inter-processor interrupt to every
+ * processor except the executing one.
+ *
+ * @param vector Interrupt vector raised on the other processors
+ */
+void broadcastFixed(uint8_t vector);
+
+/**
+ * @brief Send a non-maskable interrupt to every processor
+ * except the executing one.
+ *
+ */
+void broadcastNMI();
+
+/**
+ * @brief Measure the LAPIC timer rate against the PIT. Must be called
+ * on the bootstrap processor with interrupts enabled.
+ *
+ */
+void timerCalibrate();
+
+/**
+ * @brief Start the executing processor's LAPIC timer in periodic
+ * mode, firing every millisecond. Each tick runs the callbacks
+ * registered with timer_register_callback.
+ *
+ */
+void timerStart();
+
+/**
+ * @brief Stop the executing processor's periodic LAPIC timer and fire
+ * it once after the given delay instead. The delay is capped at about
+ * 4.29 seconds (UINT32_MAX nanoseconds).
+ *
+ * @param ns Delay (in nanoseconds)
+ */
+void timerOneShot(uint64_t ns);
+
+} // !namespace LAPIC
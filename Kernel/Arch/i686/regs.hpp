@@ -59,6 +59,23 @@ struct CR3
    uint32_t pageDir             : 20;   // Page directory physical address
 } __attribute__((packed));
 
+struct CR4
+{
+    uint32_t virtual8086         : 1;    // Virtual 8086 mode extensions
+    uint32_t protectedVirtualInt : 1;    // Protected mode virtual interrupts
+    uint32_t timeStampDisable    : 1;    // Restrict RDTSC to ring 0?
+    uint32_t debugExtensions     : 1;    // Debugging extensions
+    uint32_t pageSizeExtension   : 1;    // Allow 4 MiB pages?
+    uint32_t physAddrExtension   : 1;    // Physical address extension
+    uint32_t machineCheck        : 1;    // Machine check exceptions
+    uint32_t pageGlobalEnable    : 1;    // Allow global pages?
+    uint32_t perfCounterEnable   : 1;    // Allow RDPMC from any ring?
+    uint32_t osfxsr              : 1;    // OS supports FXSAVE / FXRSTOR
+    uint32_t osxmmexcpt          : 1;    // OS supports unmasked SIMD exceptions
+    uint32_t umip                : 1;    // User mode instruction prevention
+    uint32_t reserved            : 20;   // Reserved
+} __attribute__((packed));
+
 // A pointer to the array of interrupt handlers. Assembly instruction 'lidt' will read it
 struct IDTR {
     uint16_t size   : 16;
@@ -76,6 +93,7 @@ struct GDTR {
 static_assert(sizeof(struct CR0) == 4);
 static_assert(sizeof(struct CR2) == 4);
 static_assert(sizeof(struct CR3) == 4);
+static_assert(sizeof(struct CR4) == 4);
 static_assert(sizeof(struct IDTR) == 6);
 static_assert(sizeof(struct GDTR) == 6);
 #endif
@@ -113,6 +131,30 @@ static inline void writeCR3(struct CR3 x)
     asm volatile("mov %0, %%cr3":: "r"(x));
 }
 
+static inline struct CR4 readCR4(void)
+{
+    struct CR4 x;
+    asm volatile("mov %%cr4, %0": "=r"(x));
+    return x;
+}
+
+static inline void writeCR4(struct CR4 x)
+{
+    asm volatile("mov %0, %%cr4":: "r"(x));
+}
+
+static inline uint64_t readMSR(uint32_t msr)
+{
+    uint32_t low, high;
+    asm volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void writeMSR(uint32_t msr, uint64_t value)
+{
+    asm volatile("wrmsr" :: "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
 #ifdef __cplusplus
 } // !namespace Registers
 #endif
@@ -0,0 +1,240 @@
+/**
+ * @file smp.cpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief Symmetric multiprocessing (SMP) support.
+ * @version 0.1
+ * @date 2022-03-12
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ */
+#include <Arch/i686/smp.hpp>
+#include <Arch/i686/gdt.hpp>
+#include <Arch/i686/idt.hpp>
+#include <Arch/i686/isr.hpp>
+#include <Arch/i686/lapic.hpp>
+#include <Arch/i686/timer.hpp>
+#include <Arch/Arch.hpp>
+#include <Arch/Memory.hpp>
+#include <Memory/paging.hpp>
+#include <Scheduler/tasks.hpp>
+#include <Library/string.hpp>
+#include <Logger.hpp>
+#include <Panic.hpp>
+
+#define SMP_TRAMPOLINE_ADDR     0x8000                  // Must match TRAMPOLINE_ADDR in trampoline.s
+#define SMP_AP_STACK_SIZE       (4 * ARCH_PAGE_SIZE)    // Boot (and idle) stack of each AP
+#define SMP_INIT_DELAY_MS       10                      // Delay between INIT and the first SIPI
+#define SMP_STARTUP_DELAY_MS    1                       // Delay between the two SIPIs
+#define SMP_STARTUP_WAIT_MS     100                     // Time given to the APs to claim an index
+
+/**
+ * @brief Trampoline parameters (must match smpTrampolineData in trampoline.s)
+ *
+ */
+struct [[gnu::packed]] TrampolineData {
+    uint32_t cr0;
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t entry;
+    uint32_t stacks;
+    uint32_t stackSize;
+    uint32_t maxCount;
+    uint32_t count;
+};
+
+extern "C" {
+extern uint8_t smpTrampolineStart[];
+extern uint8_t smpTrampolineEnd[];
+extern uint8_t smpTrampolineData[];
+[[noreturn]] void smpApEntry(size_t index);
+}
+
+namespace SMP {
+
+static struct Arch::CPU::Local locals[ARCH_MAX_CPUS];
+[[gnu::aligned(16)]] static uint8_t apStacks[ARCH_MAX_CPUS - 1][SMP_AP_STACK_SIZE];
+static size_t cpusOnline = 1;
+static bool online[ARCH_MAX_CPUS] = { true };
+// Every shootdown gets the next generation, and each processor records the
+// last generation it flushed for, so concurrent shootdowns need no lock
+static size_t shootdownGeneration = 0;
+static size_t shootdownFlushed[ARCH_MAX_CPUS];
+// Index + 1 of the processor that stopped the others, or 0
+static size_t haltingCpu = 0;
+
+struct Arch::CPU::Local* local(size_t id)
+{
+    return &locals[id];
+}
+
+void initProcessor(size_t id)
+{
+    struct Arch::CPU::Local* cpu = &locals[id];
+    cpu->self = cpu;
+    cpu->task = NULL;
+    cpu->id = id;
+    cpu->fpuOwner = NULL;
+    GDT::init(cpu);
+}
+
+static void shootdownCallback(struct registers* regs)
+{
+    (void)regs;
+    Arch::Memory::pagingShootdownService();
+}
+
+static void nmiCallback(struct registers* regs)
+{
+    // Another processor is panicking and wants this one out of the way
+    if (__atomic_load_n(&haltingCpu, __ATOMIC_ACQUIRE)) {
+        Arch::haltAndCatchFire();
+    }
+    panic(regs);
+}
+
+} // !namespace SMP
+
+extern "C" void smpApEntry(size_t index)
+{
+    size_t id = index + 1;
+    SMP::initProcessor(id);
+    IDT::init();
+    Arch::CPU::fpuInit();
+    Arch::Memory::pagingEnableWriteCombining();
+    LAPIC::init();
+    SMP::local(id)->lapicId = LAPIC::id();
+    tasks_init_secondary();
+    // Nothing freed before now can be in this processor's TLB afterwards
+    size_t generation = __atomic_load_n(&SMP::shootdownGeneration, __ATOMIC_ACQUIRE);
+    Arch::Memory::pagingFlushTLB();
+    __atomic_store_n(&SMP::shootdownFlushed[id], generation, __ATOMIC_RELEASE);
+    __atomic_store_n(&SMP::online[id], true, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&SMP::cpusOnline, 1, __ATOMIC_RELEASE);
+    LOG_INFO(__func__, "CPU %zu online (LAPIC ID %lu)", id, SMP::local(id)->lapicId);
+    LAPIC::timerStart();
+    // This boot context is now the processor's idle task
+    tasks_idle();
+}
+
+namespace Arch::CPU {
+
+void smpInit()
+{
+    if (!LAPIC::isSupported()) {
+        LOG_WARNING(__func__, "No LAPIC present. Running on the bootstrap processor only.");
+        return;
+    }
+
+    LAPIC::init();
+    SMP::local(0)->lapicId = LAPIC::id();
+    LAPIC::timerCalibrate();
+    Interrupts::registerHandler(LAPIC_VECTOR_SHOOTDOWN, SMP::shootdownCallback);
+    Interrupts::registerHandler(Interrupts::EXCEPTION_NON_MASK_INT, SMP::nmiCallback);
+
+    // The trampoline lives in the identity mapped first MiB
+    size_t trampolineSize = (size_t)(smpTrampolineEnd - smpTrampolineStart);
+    memcpy((void*)SMP_TRAMPOLINE_ADDR, smpTrampolineStart, trampolineSize);
+    auto data = (struct TrampolineData*)(SMP_TRAMPOLINE_ADDR + (smpTrampolineData - smpTrampolineStart));
+    *data = {
+        .cr0 = __builtin_bit_cast(uint32_t, Registers::readCR0()),
+        .cr3 = (uint32_t)::Memory::getPageDirPhysAddr(),
+        .cr4 = __builtin_bit_cast(uint32_t, Registers::readCR4()),
+        .entry = (uint32_t)smpApEntry,
+        .stacks = (uint32_t)SMP::apStacks,
+        .stackSize = SMP_AP_STACK_SIZE,
+        .maxCount = ARCH_MAX_CPUS - 1,
+        .count = 0,
+    };
+
+    // There is no ACPI (MADT) support to enumerate the processors with,
+    // so wake every other processor at once and count who shows up.
+    LAPIC::broadcastInit();
+    sleep(SMP_INIT_DELAY_MS);
+    LAPIC::broadcastStartup(SMP_TRAMPOLINE_ADDR / ARCH_PAGE_SIZE);
+    sleep(SMP_STARTUP_DELAY_MS);
+    LAPIC::broadcastStartup(SMP_TRAMPOLINE_ADDR / ARCH_PAGE_SIZE);
+    sleep(SMP_STARTUP_WAIT_MS);
+
+    size_t started = __atomic_load_n(&data->count, __ATOMIC_ACQUIRE);
+    if (started > ARCH_MAX_CPUS - 1) {
+        LOG_WARNING(__func__, "Ignoring %zu processors (maximum is %d)", started - (ARCH_MAX_CPUS - 1), ARCH_MAX_CPUS);
+        started = ARCH_MAX_CPUS - 1;
+    }
+    while (__atomic_load_n(&SMP::cpusOnline, __ATOMIC_ACQUIRE) != started + 1) {
+        relax();
+    }
+
+    LOG_INFO(__func__, "%zu processor(s) online", count());
+}
+
+size_t count()
+{
+    return __atomic_load_n(&SMP::cpusOnline, __ATOMIC_ACQUIRE);
+}
+
+void haltOthers()
+{
+    interruptsDisable();
+    size_t expected = 0;
+    if (!__atomic_compare_exchange_n(&SMP::haltingCpu, &expected, id() + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        // A nested panic on this processor carries on, while one on
+        // another processor lost the race and stops right here
+        if (expected != id() + 1) {
+            haltAndCatchFire();
+        }
+        return;
+    }
+    // An NMI gets through even to processors spinning with interrupts disabled
+    if (count() > 1) {
+        LAPIC::broadcastNMI();
+    }
+}
+
+} // !namespace Arch::CPU
+
+namespace Arch::Memory {
+
+void pagingShootdownTLB()
+{
+    if (CPU::count() == 1) {
+        return;
+    }
+
+    uintptr_t flags = CPU::interruptsSave();
+    size_t self = CPU::id();
+    // The page table updates must be visible before the new generation is
+    size_t generation = __atomic_add_fetch(&SMP::shootdownGeneration, 1, __ATOMIC_SEQ_CST);
+    LAPIC::broadcastFixed(LAPIC_VECTOR_SHOOTDOWN);
+    CPU::interruptsRestore(flags);
+    // The caller flushed its own processor already
+    for (size_t id = 0; id < ARCH_MAX_CPUS; id++) {
+        if (id == self || !__atomic_load_n(&SMP::online[id], __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        // Generations wrap around, so compare the distance
+        while ((intptr_t)(__atomic_load_n(&SMP::shootdownFlushed[id], __ATOMIC_ACQUIRE) - generation) < 0) {
+            // Another shootdown may be waiting on this processor meanwhile
+            pagingShootdownService();
+            CPU::relax();
+        }
+    }
+}
+
+void pagingShootdownService()
+{
+    // Nothing to do (and no per-processor data yet) before the first shootdown
+    size_t generation = __atomic_load_n(&SMP::shootdownGeneration, __ATOMIC_ACQUIRE);
+    if (!generation || __atomic_load_n(&SMP::shootdownFlushed[CPU::id()], __ATOMIC_RELAXED) == generation) {
+        return;
+    }
+
+    // Keep the shootdown interrupt from recording an older generation afterwards
+    uintptr_t flags = CPU::interruptsSave();
+    generation = __atomic_load_n(&SMP::shootdownGeneration, __ATOMIC_ACQUIRE);
+    pagingFlushTLB();
+    __atomic_store_n(&SMP::shootdownFlushed[CPU::id()], generation, __ATOMIC_RELEASE);
+    CPU::interruptsRestore(flags);
+}
+
+} // !namespace Arch::Memory
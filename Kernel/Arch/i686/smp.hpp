@@ -0,0 +1,62 @@
+/**
+ * @file smp.hpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief Symmetric multiprocessing (SMP) support. Application processors
+ * are started with the INIT-SIPI-SIPI sequence and each processor gets
+ * its own per-processor data block, GDT and TSS.
+ * @version 0.1
+ * @date 2022-03-12
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ */
+#pragma once
+#include <Arch/i686/Arch.hpp>
+#include <Arch/i686/gdt.hpp>
+#include <Arch/i686/tss.hpp>
+#include <Arch/i686/regs.hpp>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Arch::CPU {
+
+/**
+ * @brief Per-processor data block. The %gs segment of every processor
+ * is based at its own block, so the fields used by the accessors in
+ * Arch/i686/Arch.hpp (and by tasks.s) must stay at fixed offsets.
+ *
+ */
+struct Local {
+    struct Local* self;                         // Must be first
+    struct task* task;                          // Task running on this processor
+    size_t id;                                  // Logical processor index (0 is the BSP)
+    uint32_t lapicId;                           // LAPIC ID
+    struct task* fpuOwner;                      // Task that last loaded the FPU registers
+    struct GDT::Entry gdt[ARCH_GDT_MAX_ENTRIES];
+    struct Registers::GDTR gdtr;
+    struct TSS::Entry tss;
+};
+static_assert(offsetof(struct Local, self) == ARCH_CPU_LOCAL_SELF);
+static_assert(offsetof(struct Local, task) == ARCH_CPU_LOCAL_TASK);
+static_assert(offsetof(struct Local, id) == ARCH_CPU_LOCAL_ID);
+
+} // !namespace Arch::CPU
+
+namespace SMP {
+
+/**
+ * @brief Returns the per-processor data block of the given processor.
+ *
+ * @param id Logical processor index
+ */
+struct Arch::CPU::Local* local(size_t id);
+
+/**
+ * @brief Set up the per-processor data block and descriptor tables
+ * of the executing processor.
+ *
+ * @param id Logical processor index
+ */
+void initProcessor(size_t id);
+
+} // !namespace SMP
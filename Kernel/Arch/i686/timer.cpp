@@ -10,10 +10,24 @@
  */
 #include <Arch/i686/timer.hpp>
 #include <Arch/i686/isr.hpp>
+#include <Arch/i686/lapic.hpp>
+#include <Library/time.hpp>
+
+#define TIMER_MODE_PERIODIC 0x36    // Channel 0, low/high byte, square wave generator
+#define TIMER_MODE_ONESHOT  0x30    // Channel 0, low/high byte, interrupt on terminal count
+#define TIMER_READ_BACK     0xC2    // Latch the count and status of channel 0
+#define TIMER_STATUS_OUT    (1 << 7)
 
 static void timer_callback(struct registers *regs);
+static void _program(uint8_t mode, uint32_t count);
 volatile uint32_t timer_tick;
 
+static uint32_t _divisor;           // counter reload value of the periodic tick
+static bool _oneshot;               // is the PIT in one-shot mode?
+static uint32_t _oneshot_count;     // start value of the armed one-shot (0 once it fired)
+static bool _oneshot_stale;         // a one-shot fired but its interrupt is still pending
+static uint32_t _partial;           // PIT input clock ticks since the last whole period
+
 typedef void (*voidfunc_t)();
 
 #define MAX_CALLBACKS 8
@@ -32,30 +46,90 @@ void timer_init(uint32_t freq) {
     /* Install the function we just wrote */
     Interrupts::registerHandler(Interrupts::INTERRUPT_0, timer_callback);
     /* Get the PIT value: hardware clock at 1193180 Hz */
-    uint32_t divisor = 1193180 / freq;
-    uint8_t low  = (uint8_t)(divisor & 0xFF);
-    uint8_t high = (uint8_t)((divisor >> 8) & 0xFF);
+    _divisor = TIMER_FREQUENCY / freq;
+    _program(TIMER_MODE_PERIODIC, _divisor);
+}
+
+static void _program(uint8_t mode, uint32_t count) {
+    uint8_t low  = (uint8_t)(count & 0xFF);
+    uint8_t high = (uint8_t)((count >> 8) & 0xFF);
     /* Send the command */
-    writeByte(TIMER_COMMAND_PORT, 0x36);
+    writeByte(TIMER_COMMAND_PORT, mode);
     writeByte(TIMER_DATA_PORT, low);
     writeByte(TIMER_DATA_PORT, high);
 }
 
+/* Ticks per nanosecond as a 0.32 fixed-point fraction, so that converting a
+   one-shot delay needs no 64-bit divide */
+#define TIMER_NS_MULT ((uint32_t)(((uint64_t)TIMER_FREQUENCY << 32) / 1000000000ULL))
+
+/* Count PIT input clock ticks towards whole timer periods. Only 32-bit
+   arithmetic, since this runs on every timer interrupt. */
+static void _advance(uint32_t count) {
+    uint32_t ticks = 0;
+    _partial += count;
+    while (_partial >= _divisor) {
+        _partial -= _divisor;
+        ticks++;
+    }
+    timer_tick = timer_tick + ticks;
+}
+
+/* Account for the part of an armed one-shot that has already run */
+static void _oneshot_cancel() {
+    if (!_oneshot || _oneshot_count == 0) {
+        return;
+    }
+    writeByte(TIMER_COMMAND_PORT, TIMER_READ_BACK);
+    uint8_t status = readByte(TIMER_DATA_PORT);
+    uint32_t count = readByte(TIMER_DATA_PORT);
+    count |= (uint32_t)readByte(TIMER_DATA_PORT) << 8;
+    if (status & TIMER_STATUS_OUT) {
+        /* It fired while interrupts were disabled */
+        _advance(_oneshot_count);
+        _oneshot_stale = true;
+    } else if (count <= _oneshot_count) {
+        _advance(_oneshot_count - count);
+    }
+    _oneshot_count = 0;
+}
+
 static void timer_callback(struct registers *regs) {
     (void)regs;
-    timer_tick = timer_tick + 1;
+    if (_oneshot_stale) {
+        /* Already accounted for when the one-shot was replaced */
+        _oneshot_stale = false;
+    } else if (_oneshot) {
+        _advance(_oneshot_count);
+        _oneshot_count = 0;
+    } else {
+        _advance(_divisor);
+    }
+    timer_run_callbacks();
+}
+
+void timer_run_callbacks() {
     for (size_t i = 0; i < _callback_count; i++) {
         _callbacks[i]();
     }
 }
 
+uint64_t timer_period_ns() {
+    return _divisor * 1000000000ULL / TIMER_FREQUENCY;
+}
+
 void sleep(uint32_t ms) {
-    uint32_t start = timer_tick;
-    uint32_t final = start + ms;
+    uint64_t start = Time::monotonicNs();
+    if (start == 0) {
+        // The clock isn't calibrated yet, so count ticks instead
+        uint32_t final = timer_tick + ms;
+        while (timer_tick < final);
+        return;
+    }
     // Waste CPU cycles like a slob
-    while (timer_tick < final);
-    // Return now that we've waited long enough
-    return;
+    while (Time::monotonicNs() - start < ms * 1000000ULL) {
+        Arch::CPU::relax();
+    }
 }
 
 void timer_register_callback(void (*func)()) {
@@ -64,3 +138,35 @@ void timer_register_callback(void (*func)()) {
         _callback_count++;
     }
 }
+
+void timer_oneshot(uint64_t ns) {
+    /* Only the bootstrap processor receives PIT interrupts */
+    if (Arch::CPU::id() != 0) {
+        LAPIC::timerOneShot(ns);
+        return;
+    }
+    if (ns > TIMER_ONESHOT_MAX_NS) {
+        ns = TIMER_ONESHOT_MAX_NS;
+    }
+    uint32_t count = (uint32_t)(((uint64_t)(uint32_t)ns * TIMER_NS_MULT) >> 32);
+    if (count == 0) {
+        count = 1;
+    }
+    _oneshot_cancel();
+    _oneshot = true;
+    _oneshot_count = count;
+    _program(TIMER_MODE_ONESHOT, count);
+}
+
+void timer_periodic() {
+    if (Arch::CPU::id() != 0) {
+        LAPIC::timerStart();
+        return;
+    }
+    if (!_oneshot) {
+        return;
+    }
+    _oneshot_cancel();
+    _oneshot = false;
+    _program(TIMER_MODE_PERIODIC, _divisor);
+}
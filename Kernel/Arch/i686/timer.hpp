@@ -14,6 +14,8 @@
 
 #define TIMER_COMMAND_PORT 0x43
 #define TIMER_DATA_PORT 0x40
+#define TIMER_FREQUENCY 1193180                     // PIT input clock (Hz)
+#define TIMER_ONESHOT_MAX_NS (50 * 1000 * 1000ULL)  // Must fit in the 16 bit PIT counter
 
 extern volatile uint32_t timer_tick;
 
@@ -23,6 +25,11 @@ extern volatile uint32_t timer_tick;
  * @param freq Timer frequency
  */
 void timer_init(uint32_t freq);
+/**
+ * @brief Length of a periodic PIT tick (in nanoseconds).
+ *
+ */
+uint64_t timer_period_ns();
 /**
  * @brief Sleeps for a certain length of time.
  *
@@ -30,4 +37,30 @@ void timer_init(uint32_t freq);
  */
 void sleep(uint32_t ms);
 
+/**
+ * @brief Registers a function to be called on every timer tick. The PIT
+ * only interrupts the bootstrap processor, so application processors
+ * run these callbacks from their LAPIC timer instead.
+ *
+ * @param func Callback function
+ */
 void timer_register_callback(void (*func)());
+/**
+ * @brief Runs all registered timer callbacks on the executing processor.
+ *
+ */
+void timer_run_callbacks();
+/**
+ * @brief Stops the executing processor's periodic tick and requests a
+ * single tick after the given delay instead. The delay is capped at
+ * TIMER_ONESHOT_MAX_NS. Must be called with interrupts disabled.
+ *
+ * @param ns Delay until the next tick (in nanoseconds)
+ */
+void timer_oneshot(uint64_t ns);
+/**
+ * @brief Returns the executing processor to its periodic tick. Must be
+ * called with interrupts disabled.
+ *
+ */
+void timer_periodic();
@@ -9,10 +9,10 @@
  *
  */
 #pragma once
-#include <Arch/i686/Arch.i686.hpp>
-#include <Arch/i686/Assembly/Flush.h>
 #include <stdint.h>
 
+namespace TSS {
+
 /**
  * @brief The Task State Segment (TSS) is a special data structure for x86 processors
  * which holds information about a task. The TSS is primarily suited for hardware
@@ -20,10 +20,12 @@
  * one or two TSS's are also generally used, as they allow for entering
  * Ring 0 code after an interrupt. (OSDev Wiki)
  *
+ * Every processor has its own TSS (see Arch::CPU::Local).
+ *
  * Thanks to OSDev Wiki for this section of code.
  *
  */
-struct [[gnu::packed]] tss_entry {
+struct [[gnu::packed]] Entry {
     uint32_t    prev;    // The previous TSS - if we used hardware task switching this would form a linked list.
     uint32_t    esp0;    // The stack pointer to load when we change to kernel mode.
     uint32_t    ss0;     // The stack segment to load when we change to kernel mode.
@@ -51,4 +53,7 @@ struct [[gnu::packed]] tss_entry {
     uint32_t    ldt;
     uint16_t    trap;
     uint16_t    iomap_base;
-} tss_entry_t;
+};
+static_assert(sizeof(struct Entry) == 104);
+
+} // !namespace TSS
@@ -17,8 +17,9 @@ namespace Boot {
 void parseCommandLine(char* cmdline)
 {
     for (struct argument* arg = _ARGUMENTS_START; arg < _ARGUMENTS_END; arg++) {
-        if (strstr(cmdline, arg->arg)) {
-            arg->callback(arg->arg);
+        const char* match = strstr(cmdline, arg->arg);
+        if (match) {
+            arg->callback(match + strlen(arg->arg));
         }
     }
 }
@@ -18,7 +18,9 @@
 
 namespace Boot {
 
-typedef void (*cmdline_cb_t)(const char* arg);
+// Called with the rest of the command line following the argument (e.g. the
+// value of "--log-level="). The value ends at the next space.
+typedef void (*cmdline_cb_t)(const char* value);
 struct argument {
     char arg[MAX_ARGUMENT_LEN];
     cmdline_cb_t callback;
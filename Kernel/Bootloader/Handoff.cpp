@@ -40,14 +40,16 @@ Handoff::Handoff()
     , m_magic(0)
 {
     // Initialize nothing.
+    m_cmdline[0] = '\0';
 }
 
 Handoff::Handoff(void* handoff, uint32_t magic)
     : m_handle(handoff)
     , m_magic(magic)
 {
+    m_cmdline[0] = '\0';
     // Parse the handle based on the magic
-    Logger::Info(__func__, "Bootloader info at 0x%p", handoff);
+    LOG_INFO(__func__, "Bootloader info at 0x%p", handoff);
     if (magic == STIVALE2_MAGIC) {
         m_bootType = Stivale2;
         parseStivale2(this, handoff);
@@ -65,7 +67,7 @@ Handoff::Handoff(void* handoff, uint32_t magic)
 
 void Handoff::parseStivale2(Handoff* that, void* handoff)
 {
-    Logger::Info(__func__, "Booted via Stivale2");
+    LOG_INFO(__func__, "Booted via Stivale2");
     // Walk the list of tags in the header
     struct stivale2_struct* fixed = (struct stivale2_struct*)handoff;
     struct stivale2_tag* tag = (struct stivale2_tag*)(fixed->tags);
@@ -73,7 +75,7 @@ void Handoff::parseStivale2(Handoff* that, void* handoff)
         switch (tag->identifier) {
             case STIVALE2_STRUCT_TAG_MEMMAP_ID: {
                 auto memmap = (struct stivale2_struct_tag_memmap*)tag;
-                Logger::Debug(__func__, "Found %Lu Stivale2 memmap entries.", memmap->entries);
+                LOG_DEBUG(__func__, "Found %Lu Stivale2 memmap entries.", memmap->entries);
                 if (memmap->entries > that->m_memoryMap.Count()) {
                     panic("Not enough space to add all memory map entries!");
                 }
@@ -118,20 +120,20 @@ void Handoff::parseStivale2(Handoff* that, void* handoff)
                             break;
                     }
 
-                    Logger::Debug(__func__, "[%zu] 0x%0Lx-0x%0Lx 0x%0Lx [%s]", i, entry.base, end, entry.length, that->m_memoryMap[i].typeString());
+                    LOG_DEBUG(__func__, "[%zu] 0x%0Lx-0x%0Lx 0x%0Lx [%s]", i, entry.base, end, entry.length, that->m_memoryMap[i].typeString());
                 }
                 break;
             }
             case STIVALE2_STRUCT_TAG_CMDLINE_ID: {
                 auto cmdline = (struct stivale2_struct_tag_cmdline*)tag;
-                that->m_cmdline = (char*)(cmdline->cmdline);
-                Logger::Debug(__func__, "Stivale2 cmdline: '%s'", that->m_cmdline);
+                strncpy(that->m_cmdline, (const char*)cmdline->cmdline, sizeof(that->m_cmdline) - 1);
+                LOG_DEBUG(__func__, "Stivale2 cmdline: '%s'", that->m_cmdline);
                 parseCommandLine(that->m_cmdline);
                 break;
             }
             case STIVALE2_STRUCT_TAG_FRAMEBUFFER_ID: {
                 auto framebuffer = (struct stivale2_struct_tag_framebuffer*)tag;
-                Logger::Debug(
+                LOG_DEBUG(
                     __func__,
                     "Stivale2 framebuffer:\n"
                     "\tAddress: 0x%0Lx\n"
@@ -170,7 +172,7 @@ void Handoff::parseStivale2(Handoff* that, void* handoff)
                 break;
             }
             default: {
-                Logger::Debug(__func__, "Unknown Stivale2 tag: 0x%016LX", tag->identifier);
+                LOG_DEBUG(__func__, "Unknown Stivale2 tag: 0x%016LX", tag->identifier);
                 break;
             }
         }
@@ -178,7 +180,7 @@ void Handoff::parseStivale2(Handoff* that, void* handoff)
         tag = (struct stivale2_tag*)tag->next;
     }
 
-    Logger::Debug(__func__, "Done parsing Stivale2 tags");
+    LOG_DEBUG(__func__, "Done parsing Stivale2 tags");
 }
 
 } // !namespace Handoff
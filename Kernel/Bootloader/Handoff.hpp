@@ -13,6 +13,8 @@
 #include <Memory/MemoryMap.hpp>
 #include <stdint.h>
 
+#define HANDOFF_CMDLINE_MAX 256
+
 namespace Boot {
 
 enum HandoffBootloaderType {
@@ -85,6 +87,10 @@ private:
 //  * PXE IP address (once we have a nice IP struct)
 //  * Update Stivale2 to latest version & add missing
 //  * Kernel modules (linked list of some sort?)
+//
+// Everything is copied out of the bootloader structures while parsing, since
+// their memory is given back to the frame allocator once the kernel is up
+// (see Memory::Physical::Manager::reclaim). Handle() is only valid until then.
 class Handoff {
 public:
     // Constructors
@@ -101,7 +107,7 @@ private:
     static void parseStivale2(Handoff* that, void* handoff);
 
     void* m_handle;
-    char* m_cmdline;
+    char m_cmdline[HANDOFF_CMDLINE_MAX];
     uint32_t m_magic;
     Graphics::Framebuffer m_framebuffer;
     HandoffBootloaderType m_bootType;
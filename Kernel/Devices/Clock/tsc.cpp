@@ -0,0 +1,65 @@
+/**
+ * @file tsc.cpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief Time Stamp Counter (TSC) clocksource
+ * @version 0.1
+ * @date 2022-03-18
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ */
+#include <Arch/Arch.hpp>
+#include <Arch/i686/timer.hpp>
+#include <Devices/Clock/tsc.hpp>
+#include <Logger.hpp>
+#include <x86gprintrin.h>   // needed for __rdtsc
+
+#define TSC_CALIBRATION_TICKS   50  // PIT periods to measure the TSC over
+#define TSC_MAX_SHIFT           32
+
+namespace TSC {
+
+// ns = (cycles * mult) >> shift
+// Both are only written once (before any other processor is started)
+static uint32_t mult = 0;
+static uint32_t shift = 0;
+static uint64_t hz = 0;
+
+void init()
+{
+    // Start on a tick edge so that whole periods are measured
+    uint32_t tick = timer_tick;
+    while (timer_tick == tick) { }
+    tick = timer_tick;
+    uint64_t start = __rdtsc();
+    while (timer_tick - tick < TSC_CALIBRATION_TICKS) { }
+    uint64_t cycles = __rdtsc() - start;
+    uint64_t ns = TSC_CALIBRATION_TICKS * timer_period_ns();
+
+    // Use the most precise multiplier that still fits in 32 bits
+    uint32_t s = TSC_MAX_SHIFT;
+    while (s > 0 && (ns << s) / cycles > UINT32_MAX) {
+        s--;
+    }
+    shift = s;
+    mult = (uint32_t)((ns << s) / cycles);
+    hz = cycles * 1000000000ULL / ns;
+    LOG_DEBUG(__func__, "TSC runs at %Lu kHz (mult %lu, shift %lu)", hz / 1000, mult, shift);
+}
+
+uint64_t nanoseconds()
+{
+    uint64_t cycles = __rdtsc();
+    // 64 x 32 bit multiply split into two 32 x 32 bit multiplies
+    // so that neither the product nor the conversion needs libgcc
+    uint64_t low = (uint64_t)(uint32_t)cycles * mult;
+    uint64_t high = (uint64_t)(uint32_t)(cycles >> 32) * mult;
+    return (high << (32 - shift)) + (low >> shift);
+}
+
+uint64_t frequency()
+{
+    return hz;
+}
+
+} // !namespace TSC
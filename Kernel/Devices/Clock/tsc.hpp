@@ -0,0 +1,39 @@
+/**
+ * @file tsc.hpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief Time Stamp Counter (TSC) clocksource. The TSC is calibrated
+ * against the PIT once and converted to nanoseconds with a fixed-point
+ * multiply and shift, so reading the clock never divides.
+ * @version 0.1
+ * @date 2022-03-18
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ */
+#pragma once
+#include <stdint.h>
+
+namespace TSC {
+
+/**
+ * @brief Measure the TSC frequency against the PIT. Must be called on
+ * the bootstrap processor with interrupts enabled and the PIT ticking
+ * periodically.
+ *
+ */
+void init();
+
+/**
+ * @brief Nanoseconds since the processor was reset. Returns zero until
+ * the TSC has been calibrated. Safe to call from interrupt handlers.
+ *
+ */
+uint64_t nanoseconds();
+
+/**
+ * @brief Calibrated TSC frequency (in Hz).
+ *
+ */
+uint64_t frequency();
+
+} // !namespace TSC
@@ -13,7 +13,9 @@
 #include <Devices/Graphics/framebuffer.hpp>
 #include <Devices/Graphics/graphics.hpp>
 #include <Library/stdio.hpp>
+#include <Library/string.hpp>
 #include <Locking/Mutex.hpp>
+#include <Memory/heap.hpp>
 #include <Logger.hpp>
 #include <stddef.h>
 
@@ -24,6 +26,8 @@ namespace Console {
 #define CLEAR_VALS() ansiValuesIdx = 0
 #define ESC ('\033')
 #define TAB_WIDTH 4u
+#define DEFAULT_COLS 80u
+#define DEFAULT_ROWS 25u
 
 enum vgaColor : uint32_t {
     VGA_Black = 0x000000,
@@ -65,8 +69,8 @@ enum ansiColor : uint16_t {
 };
 
 // Coorinate trackers
-static uint8_t cursorX = 0;
-static uint8_t cursorY = 0;
+static uint32_t cursorX = 0;
+static uint32_t cursorY = 0;
 static uint32_t colorBack = VGA_Black;
 static uint32_t colorFore = VGA_White;
 static uint32_t resetBack = VGA_Black;
@@ -93,6 +97,22 @@ static uint32_t ansiVGATable[16] = {
     VGA_LightCyan, VGA_White
 };
 
+// Character cell grid. Rows are a ring buffer starting at gridTop, so
+// scrolling only recycles the oldest row instead of moving every cell.
+struct Cell {
+    char c;
+    bool dirty;     // changed since the last flush
+    uint32_t fore;
+    uint32_t back;
+};
+
+static struct Cell* cells = NULL;
+static bool* rowDirty = NULL;
+static uint32_t gridCols = DEFAULT_COLS;
+static uint32_t gridRows = DEFAULT_ROWS;
+static uint32_t gridTop = 0;
+static uint32_t pendingScroll = 0;  // rows scrolled since the last flush
+
 static Mutex ttyLock;
 
 static void Lock()
@@ -105,6 +125,74 @@ static void Unlock()
     ttyLock.unlock();
 }
 
+static struct Cell* cellAt(uint32_t x, uint32_t y)
+{
+    return &cells[((gridTop + y) % gridRows) * gridCols + x];
+}
+
+static void putCell(char c, uint32_t x, uint32_t y)
+{
+    if (!cells || x >= gridCols || y >= gridRows)
+        return;
+    struct Cell* cell = cellAt(x, y);
+    if (cell->c == c && cell->fore == colorFore && cell->back == colorBack)
+        return;
+    cell->c = c;
+    cell->fore = colorFore;
+    cell->back = colorBack;
+    cell->dirty = true;
+    rowDirty[(gridTop + y) % gridRows] = true;
+}
+
+// Blank a row and redraw all of it. Its pixels no longer match the old
+// cells (a scroll leaves the previous bottom row behind, ESC[2J paints the
+// screen black), so comparing against them would skip cells.
+static void clearRow(uint32_t y)
+{
+    if (!cells || y >= gridRows)
+        return;
+    for (uint32_t x = 0; x < gridCols; x++)
+        *cellAt(x, y) = { ' ', true, colorFore, colorBack };
+    rowDirty[(gridTop + y) % gridRows] = true;
+}
+
+static void scrollUp()
+{
+    if (!cells)
+        return;
+    // The oldest row becomes the new bottom row
+    gridTop = (gridTop + 1) % gridRows;
+    clearRow(gridRows - 1);
+    pendingScroll++;
+}
+
+// Draws everything that changed since the last flush into the backbuffer.
+// Must be called with the tty lock held.
+static void flush()
+{
+    if (!cells)
+        return;
+    // Rows that are still on screen move with a single copy. If every
+    // row was recycled they are all dirty anyway.
+    if (pendingScroll && pendingScroll < gridRows)
+        Graphics::scroll(0, gridRows * FONT_HEIGHT, pendingScroll * FONT_HEIGHT);
+    pendingScroll = 0;
+
+    for (uint32_t y = 0; y < gridRows; y++) {
+        uint32_t row = (gridTop + y) % gridRows;
+        if (!rowDirty[row])
+            continue;
+        for (uint32_t x = 0; x < gridCols; x++) {
+            struct Cell* cell = &cells[row * gridCols + x];
+            if (!cell->dirty)
+                continue;
+            Graphics::Font::Draw(cell->c, x, y, cell->fore, cell->back);
+            cell->dirty = false;
+        }
+        rowDirty[row] = false;
+    }
+}
+
 static int putchar(unsigned c, void** ptr)
 {
     (void)ptr;
@@ -168,19 +256,22 @@ static int putchar(unsigned c, void** ptr)
             if (ansiValuesIdx > 2) {
                 goto error;
             }
-            cursorX = (uint8_t)POP_VAL();
-            cursorY = (uint8_t)POP_VAL();
+            cursorX = POP_VAL();
+            cursorY = POP_VAL();
+            if (cursorX >= gridCols)
+                cursorX = gridCols - 1;
+            if (cursorY >= gridRows)
+                cursorY = gridRows - 1;
             goto normal;
         } else if (c == 'J') { // Clear screen attribute
             // The proper code is ESC[2J
             if (ansiVal != 2) {
                 goto error;
             }
-            // Clear by resetting the double buffer and swapping.
-            // TODO: Find a better way to do this?
-            Logger::Debug(__func__, "Clearing screen");
+            LOG_DEBUG(__func__, "Clearing screen");
             Graphics::resetDoubleBuffer();
-            Graphics::swap();
+            for (uint32_t y = 0; y < gridRows; y++)
+                clearRow(y);
         } else if (c >= '0' && c <= '9') { // just another digit of a value
             ansiVal = (uint16_t)(ansiVal * 10 + (uint16_t)(c - '0'));
         } else
@@ -212,23 +303,19 @@ static int putchar(unsigned c, void** ptr)
         break;
     // Anything else (visible characters)
     default:
-        Graphics::Font::Draw(c, cursorX++, cursorY, colorFore, colorBack);
+        putCell((char)c, cursorX++, cursorY);
     }
 
     // Move to the next line
-    // TODO: Get width of "screen" (replace 80 with width) (#275)
-    if (cursorX >= 80) {
-        Logger::Debug(__func__, "Move to the next line");
+    if (cursorX >= gridCols) {
         cursorX = 0;
         cursorY++;
     }
-    // Clear the screen
-    // TODO: Get height of "screen" (replace 25 with height) (#275)
-    if (cursorY >= 25) {
-        Logger::Debug(__func__, "Shift up the screen");
-        //TODO: Shift text up and reset the bottom line
+    // Shift up the screen
+    if (cursorY >= gridRows) {
+        scrollUp();
         cursorX = 0;
-        cursorY = 25 - 1;
+        cursorY = gridRows - 1;
     }
     goto end;
 error:
@@ -250,6 +337,10 @@ int vprintf(const char* fmt, va_list args)
     int retval;
     Lock();
     retval = printf_helper(fmt, args, putchar, NULL);
+    flush();
+    // Swap out the buffer in draw. The damage list is shared with flush on
+    // other processors, so this must happen under the tty lock too.
+    Graphics::swap();
     Unlock();
     return retval;
 }
@@ -258,6 +349,7 @@ void write(const char c)
 {
     Lock();
     putchar(c, NULL);
+    flush();
     Unlock();
 }
 
@@ -267,6 +359,7 @@ void write(const char* str)
     Lock();
     while (str[i])
         putchar(str[i++], NULL);
+    flush();
     Unlock();
 }
 
@@ -278,12 +371,48 @@ int printf(const char* fmt, ...)
     va_start(args, fmt);
     ret_val = vprintf(fmt, args);
     va_end(args);
-    // Swap out the buffer in draw
-    Graphics::swap();
 
     return ret_val;
 }
 
+void init()
+{
+    uint32_t cols = Graphics::width() / FONT_WIDTH;
+    uint32_t rows = Graphics::height() / FONT_HEIGHT;
+    if (!cols || !rows)
+        return;
+
+    Lock();
+    cells = (struct Cell*)calloc(cols * rows, sizeof(struct Cell));
+    rowDirty = (bool*)calloc(rows, sizeof(bool));
+    if (!cells || !rowDirty) {
+        LOG_WARNING(__func__, "Unable to allocate %ux%u console", cols, rows);
+        free(cells);
+        free(rowDirty);
+        cells = NULL;
+        rowDirty = NULL;
+        Unlock();
+        return;
+    }
+    gridCols = cols;
+    gridRows = rows;
+    gridTop = 0;
+    pendingScroll = 0;
+    if (cursorX >= gridCols)
+        cursorX = 0;
+    if (cursorY >= gridRows)
+        cursorY = gridRows - 1;
+    // The console owns the whole screen from now on. The screen starts out
+    // black, so blank cells only need drawing on another background.
+    bool draw = (colorBack != VGA_Black);
+    for (uint32_t i = 0; i < cols * rows; i++) {
+        cells[i] = { ' ', draw, colorFore, colorBack };
+    }
+    for (uint32_t y = 0; y < rows; y++)
+        rowDirty[y] = draw;
+    Unlock();
+}
+
 void reset(uint32_t fore, uint32_t back)
 {
     cursorX = cursorY = 0;
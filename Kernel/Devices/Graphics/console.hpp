@@ -18,6 +18,8 @@
 
 namespace Console {
 
+void init();
+
 void write(const char c);
 
 void write(const char* str);
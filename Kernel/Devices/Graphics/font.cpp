@@ -12,12 +12,29 @@
  */
 #include <Devices/Graphics/font.hpp>
 #include <Devices/Graphics/graphics.hpp>
+#include <stddef.h>
 #include <stdint.h>
 
 namespace Graphics {
 namespace Font {
 
 #define FONT_COUNT 128
+#define FONT_MAX_PIXEL_WIDTH 4      // Bytes per pixel supported by the glyph cache
+#define FONT_CACHE_SETS 16          // Must be a power of two
+#define FONT_CACHE_WAYS 4           // Glyphs per set (least recently used is evicted)
+
+// A glyph cell rendered in the framebuffer's pixel format for one color pair
+struct CachedGlyph {
+    bool valid;
+    uint8_t glyph;
+    uint32_t fore;
+    uint32_t back;
+    uint32_t lastUsed;
+    uint8_t rows[FONT_HEIGHT][FONT_WIDTH * FONT_MAX_PIXEL_WIDTH];
+};
+
+static struct CachedGlyph cache[FONT_CACHE_SETS][FONT_CACHE_WAYS];
+static uint32_t cacheClock = 0;
 
 // *Huge* shout out to SkiftOS for providing this font. We tried to
 // use bdf2c to get a custom font, but because of licensing issues we
@@ -159,6 +176,7 @@ void Draw(char c, uint32_t x, uint32_t y, uint32_t fore)
     // Convert screen coordinates to pixel coordinates
     x *= FONT_WIDTH;
     y *= FONT_HEIGHT;
+    damage(x, y, FONT_WIDTH, FONT_HEIGHT);
     // Draw the font glyph
     uint8_t fp = (uint8_t)c;
     for (int fy = 0; fy <= FONT_HEIGHT; fy++) {
@@ -171,16 +189,67 @@ void Draw(char c, uint32_t x, uint32_t y, uint32_t fore)
     }
 }
 
+static void render(struct CachedGlyph* entry, uint8_t width)
+{
+    uint8_t fore[FONT_MAX_PIXEL_WIDTH];
+    uint8_t back[FONT_MAX_PIXEL_WIDTH];
+    encode(entry->fore, fore);
+    encode(entry->back, back);
+    for (int fy = 0; fy < FONT_HEIGHT; fy++) {
+        uint8_t* out = entry->rows[fy];
+        for (int fx = 0; fx < FONT_WIDTH; fx++) {
+            const uint8_t* color = (fontData[entry->glyph][fy] & (1 << fx)) ? fore : back;
+            for (uint8_t i = 0; i < width; i++) {
+                *out++ = color[i];
+            }
+        }
+    }
+}
+
+static const struct CachedGlyph* lookup(uint8_t glyph, uint32_t fore, uint32_t back, uint8_t width)
+{
+    struct CachedGlyph* set = cache[(glyph ^ fore ^ (back * 31)) & (FONT_CACHE_SETS - 1)];
+    struct CachedGlyph* victim = &set[0];
+    cacheClock++;
+    for (size_t way = 0; way < FONT_CACHE_WAYS; way++) {
+        struct CachedGlyph* entry = &set[way];
+        if (entry->valid && entry->glyph == glyph && entry->fore == fore && entry->back == back) {
+            entry->lastUsed = cacheClock;
+            return entry;
+        }
+        if (!entry->valid || (victim->valid && entry->lastUsed < victim->lastUsed)) {
+            victim = entry;
+        }
+    }
+
+    victim->valid = true;
+    victim->glyph = glyph;
+    victim->fore = fore;
+    victim->back = back;
+    victim->lastUsed = cacheClock;
+    render(victim, width);
+    return victim;
+}
+
 void Draw(char c, uint32_t x, uint32_t y, uint32_t fore, uint32_t back)
 {
     // Convert screen coordinates to pixel coordinates
     x *= FONT_WIDTH;
     y *= FONT_HEIGHT;
+    // Cached cells only need a row copy each
+    uint8_t width = pixelWidth();
+    if (width >= 3 && width <= FONT_MAX_PIXEL_WIDTH) {
+        const struct CachedGlyph* entry = lookup((uint8_t)c % FONT_COUNT, fore, back, width);
+        blit(x, y, FONT_WIDTH, FONT_HEIGHT, entry->rows[0], sizeof(entry->rows[0]));
+        return;
+    }
+    // The whole cell is redrawn
+    damage(x, y, FONT_WIDTH, FONT_HEIGHT);
     // Draw the font glyph
-    uint8_t fp = (uint8_t)c;
-    for (int fy = 0; fy < 9; fy++) {
-        for (int fx = 0; fx < 9; fx++) {
-            if (fx != FONT_WIDTH && fy != FONT_HEIGHT && (fontData[fp][fy] & (1 << fx))) {
+    uint8_t fp = (uint8_t)c % FONT_COUNT;
+    for (int fy = 0; fy < FONT_HEIGHT; fy++) {
+        for (int fx = 0; fx < FONT_WIDTH; fx++) {
+            if (fontData[fp][fy] & (1 << fx)) {
                 // Current position is part of the font glyph.
                 pixel(x + fx, y + fy, fore);
             } else {
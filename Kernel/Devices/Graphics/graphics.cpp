@@ -23,11 +23,48 @@
 #include <Library/string.hpp>
 #include <Logger.hpp>
 
+#define GRAPHICS_MAX_DAMAGE 16
+
 namespace Graphics {
 
+// Changed area of the backbuffer (right and bottom edges are exclusive)
+struct Rect {
+    uint32_t left;
+    uint32_t top;
+    uint32_t right;
+    uint32_t bottom;
+};
+
 static Framebuffer* info = NULL;
 static void* backbuffer = NULL;
 static bool initialized = false;
+static struct Rect damaged[GRAPHICS_MAX_DAMAGE];
+static size_t damagedCount = 0;
+
+static uint64_t area(const struct Rect& r)
+{
+    return (uint64_t)(r.right - r.left) * (r.bottom - r.top);
+}
+
+static struct Rect unite(const struct Rect& a, const struct Rect& b)
+{
+    return {
+        .left = a.left < b.left ? a.left : b.left,
+        .top = a.top < b.top ? a.top : b.top,
+        .right = a.right > b.right ? a.right : b.right,
+        .bottom = a.bottom > b.bottom ? a.bottom : b.bottom,
+    };
+}
+
+static bool touches(const struct Rect& a, const struct Rect& b)
+{
+    return a.left <= b.right && b.left <= a.right && a.top <= b.bottom && b.top <= a.bottom;
+}
+
+static bool contains(const struct Rect& a, const struct Rect& b)
+{
+    return a.left <= b.left && b.right <= a.right && a.top <= b.top && b.bottom <= a.bottom;
+}
 
 void init(Framebuffer* fb)
 {
@@ -38,33 +75,123 @@ void init(Framebuffer* fb)
     if (!info->getAddress())
         return;
     // Map in the framebuffer
-    Logger::Debug(__func__, "==== MAP FRAMEBUFFER ====");
+    LOG_DEBUG(__func__, "==== MAP FRAMEBUFFER ====");
     Memory::mapKernelRangeVirtual(Memory::Section(
         (uintptr_t)info->getAddress(),
         (info->getPitch() * info->getHeight())
-    ));
-    // Alloc the backbuffer
-    backbuffer = malloc(info->getPitch() * info->getHeight());
-    memcpy(backbuffer, info->getAddress(), info->getPitch() * info->getHeight());
+    ), true, Memory::Virtual::WRITE_COMBINING);
+    // Alloc the backbuffer. Its pages are only backed once drawn to, so start
+    // from a blank screen instead of copying the framebuffer.
+    backbuffer = Memory::newPageLazy(info->getPitch() * info->getHeight());
+    if (!backbuffer)
+        return;
+    memset(info->getAddress(), 0, info->getPitch() * info->getHeight());
 
     initialized = true;
 }
 
+uint8_t pixelWidth()
+{
+    if (!initialized)
+        return 0;
+    return info->getPixelWidth();
+}
+
+uint32_t width()
+{
+    if (!initialized)
+        return 0;
+    return info->getWidth();
+}
+
+uint32_t height()
+{
+    if (!initialized)
+        return 0;
+    return info->getHeight();
+}
+
+void encode(uint32_t color, uint8_t* out)
+{
+    if (!initialized)
+        return;
+    out[0] = (color >> info->getBlueMaskShift()) & 0xff;  // B
+    out[1] = (color >> info->getGreenMaskShift()) & 0xff; // G
+    out[2] = (color >> info->getRedMaskShift()) & 0xff;   // R
+    // Additional pixel information
+    if (info->getPixelWidth() == 4)
+        out[3] = 0x00;
+}
+
+void blit(uint32_t x, uint32_t y, uint32_t w, uint32_t h, const uint8_t* pixels, size_t stride)
+{
+    if (!initialized || x >= info->getWidth() || y >= info->getHeight())
+        return;
+    if (w > info->getWidth() - x)
+        w = info->getWidth() - x;
+    if (h > info->getHeight() - y)
+        h = info->getHeight() - y;
+    damage(x, y, w, h);
+    uint8_t* row = (uint8_t*)backbuffer + (y * info->getPitch()) + (x * info->getPixelWidth());
+    for (uint32_t i = 0; i < h; i++) {
+        memcpy(row, pixels, w * info->getPixelWidth());
+        row += info->getPitch();
+        pixels += stride;
+    }
+}
+
+void damage(uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+    if (!initialized || x >= info->getWidth() || y >= info->getHeight())
+        return;
+    struct Rect rect = {
+        .left = x,
+        .top = y,
+        .right = (w > info->getWidth() - x) ? info->getWidth() : x + w,
+        .bottom = (h > info->getHeight() - y) ? info->getHeight() : y + h,
+    };
+    // Fast path for pixels inside an area that was just marked
+    if (damagedCount && contains(damaged[damagedCount - 1], rect))
+        return;
+
+    // Grow a rectangle that overlaps or is adjacent (e.g. the previous glyph)
+    for (size_t i = damagedCount; i-- > 0;) {
+        if (touches(damaged[i], rect)) {
+            rect = unite(damaged[i], rect);
+            // The grown rectangle may now touch others, so take it out and keep merging
+            damaged[i] = damaged[--damagedCount];
+            i = damagedCount;
+        }
+    }
+
+    if (damagedCount == GRAPHICS_MAX_DAMAGE) {
+        // Out of slots, so merge into the rectangle that grows the least
+        size_t best = 0;
+        uint64_t bestGrowth = UINT64_MAX;
+        for (size_t i = 0; i < damagedCount; i++) {
+            uint64_t growth = area(unite(damaged[i], rect)) - area(damaged[i]);
+            if (growth < bestGrowth) {
+                best = i;
+                bestGrowth = growth;
+            }
+        }
+        damaged[best] = unite(damaged[best], rect);
+        return;
+    }
+
+    damaged[damagedCount++] = rect;
+}
+
 void pixel(uint32_t x, uint32_t y, uint32_t color)
 {
     // Ensure framebuffer information exists
     if (!initialized)
         return;
-    if ((x <= info->getWidth()) && (y <= info->getHeight())) {
+    if ((x < info->getWidth()) && (y < info->getHeight())) {
+        damage(x, y, 1, 1);
         // Special thanks to the SkiftOS contributors.
         uint8_t* pixel = (uint8_t*)backbuffer + (y * info->getPitch()) + (x * info->getPixelWidth());
-        // Pixel information
-        pixel[0] = (color >> info->getBlueMaskShift()) & 0xff;  // B
-        pixel[1] = (color >> info->getGreenMaskShift()) & 0xff; // G
-        pixel[2] = (color >> info->getRedMaskShift()) & 0xff;   // R
-        // Additional pixel information
-        if (info->getPixelWidth() == 4)
-            pixel[3] = 0x00;
+        encode(color, pixel);
     }
 }
 
@@ -73,6 +200,8 @@ void putrect(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color)
     // Ensure framebuffer information exists
     if (!initialized)
         return;
+    // The loops below include both edges
+    damage(x, y, w + 1, h + 1);
     for (uint32_t curr_x = x; curr_x <= x + w; curr_x++) {
         for (uint32_t curr_y = y; curr_y <= y + h; curr_y++) {
             // Extremely slow but good for debugging
@@ -83,18 +212,47 @@ void putrect(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color)
     swap();
 }
 
+void scroll(uint32_t y, uint32_t h, uint32_t dy)
+{
+    if (!initialized || y >= info->getHeight())
+        return;
+    if (h > info->getHeight() - y)
+        h = info->getHeight() - y;
+    // Full width rows are contiguous, so the whole band moves at once
+    if (dy < h) {
+        uint8_t* band = (uint8_t*)backbuffer + (y * info->getPitch());
+        memmove(band, band + (dy * info->getPitch()), (h - dy) * info->getPitch());
+    }
+    damage(0, y, info->getWidth(), h);
+}
+
 void resetDoubleBuffer()
 {
     if (!initialized)
         return;
     memset(backbuffer, 0, (info->getPitch() * info->getHeight()));
+    damage(0, 0, info->getWidth(), info->getHeight());
 }
 
 void swap()
 {
     if (!initialized)
         return;
-    memcpy(info->getAddress(), backbuffer, (info->getPitch() * info->getHeight()));
+    for (size_t i = 0; i < damagedCount; i++) {
+        const struct Rect& rect = damaged[i];
+        size_t offset = (rect.top * info->getPitch()) + (rect.left * info->getPixelWidth());
+        size_t span = (rect.right - rect.left) * info->getPixelWidth();
+        if (span == info->getPitch()) {
+            // Full width rows are contiguous
+            memcpy((uint8_t*)info->getAddress() + offset, (uint8_t*)backbuffer + offset, span * (rect.bottom - rect.top));
+            continue;
+        }
+        for (uint32_t row = rect.top; row < rect.bottom; row++) {
+            memcpy((uint8_t*)info->getAddress() + offset, (uint8_t*)backbuffer + offset, span);
+            offset += info->getPitch();
+        }
+    }
+    damagedCount = 0;
 }
 
 } // !namespace graphics
@@ -12,6 +12,7 @@
  *          https://wiki.osdev.org/Double_Buffering
  */
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
 #include <Devices/Graphics/framebuffer.hpp>
 
@@ -44,6 +45,72 @@ void pixel(uint32_t x, uint32_t y, uint32_t color);
  */
 void putrect(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color);
 
+/**
+ * @brief Number of bytes per pixel in the framebuffer (0 if there
+ * is no framebuffer).
+ *
+ */
+uint8_t pixelWidth();
+
+/**
+ * @brief Width of the screen in pixels (0 if there is no framebuffer).
+ *
+ */
+uint32_t width();
+
+/**
+ * @brief Height of the screen in pixels (0 if there is no framebuffer).
+ *
+ */
+uint32_t height();
+
+/**
+ * @brief Converts a hex color into the framebuffer's pixel format.
+ *
+ * @param color Hex color
+ * @param out Receives pixelWidth() bytes
+ */
+void encode(uint32_t color, uint8_t* out);
+
+/**
+ * @brief Copies rows of pixels that are already in the framebuffer's
+ * format (see encode) into the backbuffer. Parts that fall outside the
+ * screen are skipped.
+ *
+ * @param x X-axis coordinate
+ * @param y Y-axis coordinate
+ * @param w Width
+ * @param h Height
+ * @param pixels First pixel of the first row
+ * @param stride Distance between rows of pixels (in bytes)
+ */
+void blit(uint32_t x, uint32_t y, uint32_t w, uint32_t h, const uint8_t* pixels, size_t stride);
+
+/**
+ * @brief Marks a rectangle of the backbuffer as changed so that the
+ * next swap copies it to video memory. Drawing functions do this
+ * themselves, so this is only needed when writing to the backbuffer
+ * some other way. Marking a large area up front (e.g. a glyph cell)
+ * before drawing its pixels keeps the per-pixel bookkeeping cheap.
+ *
+ * @param x X-axis coordinate
+ * @param y Y-axis coordinate
+ * @param w Width
+ * @param h Height
+ */
+void damage(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+
+/**
+ * @brief Moves a band of full width rows of the backbuffer up. The rows
+ * that are uncovered at the bottom of the band keep their old contents
+ * and are expected to be redrawn by the caller.
+ *
+ * @param y First row of the band
+ * @param h Height of the band
+ * @param dy Number of rows to move the contents up by
+ */
+void scroll(uint32_t y, uint32_t h, uint32_t dy);
+
 /**
  * @brief Fill the backbuffer with '0'.
  *
@@ -51,8 +118,8 @@ void putrect(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color);
 void resetDoubleBuffer();
 
 /**
- * @brief Swap the data on backbuffer to memory video buffer
- * and show in the screen.
+ * @brief Copy the parts of the backbuffer that changed since the
+ * last swap to video memory.
  *
  */
 void swap();
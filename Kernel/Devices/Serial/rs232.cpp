@@ -7,17 +7,20 @@
  *
  * @copyright Copyright the Xyris Contributors (c) 2020
  *
- * TODO: Make this module robust enough for fast transmission of binary data
- * currently it adequately supports slow, character transmission.
+ * Output is queued in a ring buffer and moved into the UART's FIFO a burst
+ * at a time by the transmit empty interrupt, so writers never wait on the
+ * line unless they ask to.
  *
  */
 
 #include <Arch/Arch.hpp>
+#include <Arch/Memory.hpp>
 #include <Devices/Serial/rs232.hpp>
 #include <Library/RingBuffer.hpp>
 #include <Library/stdio.hpp>
 #include <Library/string.hpp>
 #include <Locking/RAII.hpp>
+#include <Locking/Spinlock.hpp>
 #include <Logger.hpp>
 #include <Memory/heap.hpp>
 #include <stdarg.h>
@@ -30,56 +33,119 @@
 #define RS_232_DATA_REG 0x0
 #define RS_232_INTERRUPT_ENABLE_REG 0x1
 #define RS_232_INTERRUPT_IDENTIFICATION_REG 0x2
+#define RS_232_FIFO_CONTROL_REG 0x2
 #define RS_232_LINE_CONTROL_REG 0x3
 #define RS_232_MODEM_CONTROL_REG 0x4
 #define RS_232_LINE_STATUS_REG 0x5
 #define RS_232_MODEM_STATUS_REG 0x6
 #define RS_232_SCRATCH_REG 0x7
 
+#define RS_232_IER_RECEIVED 0x01        // Received data available
+#define RS_232_IER_TRANSMIT_EMPTY 0x02  // Transmitter holding register empty
+#define RS_232_IIR_NONE_PENDING 0x01
+#define RS_232_IIR_ID_MASK 0x0E
+#define RS_232_IIR_MODEM_STATUS 0x00
+#define RS_232_IIR_TRANSMIT_EMPTY 0x02
+#define RS_232_IIR_RECEIVED 0x04
+#define RS_232_IIR_LINE_STATUS 0x06
+#define RS_232_IIR_TIMEOUT 0x0C
+#define RS_232_IIR_FIFO_ENABLED 0xC0
+#define RS_232_LSR_DATA_READY 0x01
+#define RS_232_LSR_TRANSMIT_EMPTY 0x20
+#define RS_232_LCR_DLAB 0x80
+#define RS_232_LCR_8N1 0x03
+#define RS_232_FCR_ENABLE_CLEAR_14 0xC7 // Enable & clear FIFOs, 14 byte receive trigger
+#define RS_232_MCR_DTR_RTS_OUT2 0x0B    // OUT2 routes the UART interrupt to the PIC
+
+#define RS_232_FIFO_SIZE 16
+#define RS_232_TX_BUFFER_SIZE 4096
+#define RS_232_PRINTF_BATCH 64
+
 namespace RS232 {
 
 static uint16_t rs_232_port_base;
 static RingBuffer<char, 1024> ring;
 static Mutex mutex_rs232("rs232");
 
+// Transmit state. Shared with the interrupt handler, so it is only
+// touched with interrupts disabled and the spinlock held.
+static RingBuffer<char, RS_232_TX_BUFFER_SIZE> txRing;
+static Spinlock txLock("rs232 tx");
+static size_t txBurst = 1;          // bytes the transmitter accepts once it's empty
+static bool txActive = false;       // transmit empty interrupt is enabled
+static size_t txDropped = 0;
+static Backpressure txPolicy = Backpressure::Drop;
+static bool initialized = false;
+static bool txDirect = false;       // panicking without the lock: bypass the ring
+
 static int received();
 static int is_transmit_empty();
-static char read_byte();
 static void callback(struct registers* regs);
 
 static int received()
 {
-    return readByte(rs_232_port_base + RS_232_LINE_STATUS_REG) & 1;
+    return readByte(rs_232_port_base + RS_232_LINE_STATUS_REG) & RS_232_LSR_DATA_READY;
 }
 
 static int is_transmit_empty()
 {
-    return readByte(rs_232_port_base + RS_232_LINE_STATUS_REG) & 0x20;
+    return readByte(rs_232_port_base + RS_232_LINE_STATUS_REG) & RS_232_LSR_TRANSMIT_EMPTY;
+}
+
+// Move the next burst from the ring into the transmitter.
+// Must be called with the transmit lock held.
+static void transmit()
+{
+    if (!is_transmit_empty())
+        return;
+    for (size_t idx = 0; idx < txBurst && !txRing.IsEmpty(); idx++) {
+        writeByte(rs_232_port_base + RS_232_DATA_REG, txRing.Dequeue());
+    }
+}
+
+// Poll the transmitter and hand it the bytes one at a time, without
+// touching the ring or the lock.
+static void transmitDirect(const char* buf, size_t count)
+{
+    for (size_t idx = 0; idx < count; idx++) {
+        while (!is_transmit_empty())
+            Arch::CPU::relax();
+        writeByte(rs_232_port_base + RS_232_DATA_REG, buf[idx]);
+    }
 }
 
-static char read_byte()
+// Must be called with the transmit lock held.
+static void setTransmitInterrupt(bool enabled)
 {
-    lockedRegion([]() {
-        while (received() == 0)
-            ;
-    },
-        mutex_rs232);
-    return readByte(rs_232_port_base + RS_232_DATA_REG);
+    txActive = enabled;
+    writeByte(
+        rs_232_port_base + RS_232_INTERRUPT_ENABLE_REG,
+        RS_232_IER_RECEIVED | (enabled ? RS_232_IER_TRANSMIT_EMPTY : 0));
 }
 
+struct printfBatch {
+    char buf[RS_232_PRINTF_BATCH];
+    size_t len;
+};
+
 static int vprintf_helper(unsigned c, void** ptr)
 {
-    // Unfortunately very hacky...
-    (void)ptr;
-    char buf = (char)c;
-    write(&buf, 1);
+    struct printfBatch* batch = (struct printfBatch*)*ptr;
+    batch->buf[batch->len++] = (char)c;
+    if (batch->len == sizeof(batch->buf)) {
+        write(batch->buf, batch->len);
+        batch->len = 0;
+    }
     return 0;
 }
 
 int vprintf(const char* fmt, va_list args)
 {
-    int retval;
-    retval = printf_helper(fmt, args, vprintf_helper, NULL);
+    // Characters are handed to the ring in batches instead of one by one
+    struct printfBatch batch;
+    batch.len = 0;
+    int retval = printf_helper(fmt, args, vprintf_helper, &batch);
+    write(batch.buf, batch.len);
     return retval;
 }
 
@@ -97,20 +163,55 @@ int printf(const char* format, ...)
 static void callback(struct registers* regs)
 {
     (void)regs;
-    // Grab the input character
-    char in = read_byte();
-    // Change carriage returns to newlines
-    if (in == '\r') {
-        in = '\n';
+    for (;;) {
+        uint8_t iir = readByte(rs_232_port_base + RS_232_INTERRUPT_IDENTIFICATION_REG);
+        if (iir & RS_232_IIR_NONE_PENDING)
+            break;
+
+        switch (iir & RS_232_IIR_ID_MASK) {
+        case RS_232_IIR_TRANSMIT_EMPTY: {
+            RAIISpinlock lock(txLock);
+            transmit();
+            if (txRing.IsEmpty())
+                setTransmitInterrupt(false);
+            break;
+        }
+        case RS_232_IIR_RECEIVED:
+        case RS_232_IIR_TIMEOUT:
+            while (received()) {
+                // Grab the input character
+                char in = readByte(rs_232_port_base + RS_232_DATA_REG);
+                // Change carriage returns to newlines
+                if (in == '\r') {
+                    in = '\n';
+                }
+                write(&in, 1);
+                // Add the character to the circular buffer
+                ring.Enqueue(in);
+            }
+            break;
+        case RS_232_IIR_LINE_STATUS:
+            readByte(rs_232_port_base + RS_232_LINE_STATUS_REG);
+            break;
+        case RS_232_IIR_MODEM_STATUS:
+            readByte(rs_232_port_base + RS_232_MODEM_STATUS_REG);
+            break;
+        }
     }
-    printf("%c", in);
-    // Add the character to the circular buffer
-    ring.Enqueue(in);
 }
 
 // FIXME: Use separate ring buffers for COM1 & COM2
-void init(uint16_t com_id)
+void init(uint16_t com_id, uint32_t baud)
 {
+    if (baud == 0 || baud > RS_232_MAX_BAUD) {
+        baud = RS_232_MAX_BAUD;
+    }
+    // Round the divisor up so that uneven speeds are rounded down
+    uint32_t divisor = (RS_232_MAX_BAUD + baud - 1) / baud;
+    if (divisor > UINT16_MAX) {
+        divisor = UINT16_MAX;
+    }
+
     // Register the IRQ callback
     rs_232_port_base = com_id;
     uint8_t IRQ = 0x20 + (com_id == RS_232_COM1 ? RS_232_COM1_IRQ : RS_232_COM2_IRQ);
@@ -118,15 +219,18 @@ void init(uint16_t com_id)
     // Write the port data to activate the device
     // disable interrupts
     writeByte(rs_232_port_base + RS_232_INTERRUPT_ENABLE_REG, 0x00);
-    writeByte(rs_232_port_base + RS_232_LINE_CONTROL_REG, 0x80);
-    writeByte(rs_232_port_base + RS_232_DATA_REG, 0x03);
-    writeByte(rs_232_port_base + RS_232_INTERRUPT_ENABLE_REG, 0x00);
-    writeByte(rs_232_port_base + RS_232_LINE_CONTROL_REG, 0x03);
-    writeByte(rs_232_port_base + RS_232_INTERRUPT_IDENTIFICATION_REG, 0xC7);
-    writeByte(rs_232_port_base + RS_232_MODEM_CONTROL_REG, 0x0B);
-    writeByte(rs_232_port_base + RS_232_LINE_CONTROL_REG, 0x00);
-    // re-enable interrupts
-    writeByte(rs_232_port_base + RS_232_INTERRUPT_ENABLE_REG, 0x01);
+    writeByte(rs_232_port_base + RS_232_LINE_CONTROL_REG, RS_232_LCR_DLAB);
+    writeByte(rs_232_port_base + RS_232_DATA_REG, divisor & 0xFF);
+    writeByte(rs_232_port_base + RS_232_INTERRUPT_ENABLE_REG, divisor >> 8);
+    writeByte(rs_232_port_base + RS_232_LINE_CONTROL_REG, RS_232_LCR_8N1);
+    writeByte(rs_232_port_base + RS_232_FIFO_CONTROL_REG, RS_232_FCR_ENABLE_CLEAR_14);
+    writeByte(rs_232_port_base + RS_232_MODEM_CONTROL_REG, RS_232_MCR_DTR_RTS_OUT2);
+    // Older UARTs (8250, 16450) don't have a FIFO and take a single byte at a time
+    uint8_t iir = readByte(rs_232_port_base + RS_232_INTERRUPT_IDENTIFICATION_REG);
+    txBurst = ((iir & RS_232_IIR_FIFO_ENABLED) == RS_232_IIR_FIFO_ENABLED) ? RS_232_FIFO_SIZE : 1;
+    // re-enable interrupts (transmit interrupts are only enabled while there is data queued)
+    writeByte(rs_232_port_base + RS_232_INTERRUPT_ENABLE_REG, RS_232_IER_RECEIVED);
+    initialized = true;
 
     Logger::addWriter(vprintf);
     Logger::Print(
@@ -155,16 +259,76 @@ size_t read(char* buf, size_t count)
 
 size_t write(const char* buf, size_t count)
 {
-    // Wait for previous transfer to complete
-    while (is_transmit_empty() == 0);
+    if (!initialized || count == 0)
+        return 0;
+    if (txDirect) {
+        transmitDirect(buf, count);
+        return count;
+    }
+
     size_t bytes = 0;
+    uintptr_t flags = Arch::CPU::interruptsSave();
+    txLock.lock();
     for (size_t idx = 0; idx < count; idx++) {
-        writeByte(rs_232_port_base + RS_232_DATA_REG, buf[idx]);
+        while (txRing.IsFull()) {
+            if (txPolicy == Backpressure::Drop) {
+                txDropped += count - idx;
+                goto queued;
+            }
+            // Poll the transmitter until there is room again
+            transmit();
+            Arch::Memory::pagingShootdownService();
+            Arch::CPU::relax();
+        }
+        txRing.Enqueue(buf[idx]);
         bytes++;
     }
+queued:
+    // Start the transmitter. It keeps itself going from the interrupt
+    // handler until the ring is empty.
+    if (!txActive && !txRing.IsEmpty()) {
+        transmit();
+        setTransmitInterrupt(true);
+    }
+    txLock.unlock();
+    Arch::CPU::interruptsRestore(flags);
     return bytes;
 }
 
+void setBackpressure(Backpressure policy)
+{
+    txPolicy = policy;
+}
+
+size_t dropped()
+{
+    return txDropped;
+}
+
+void flush(bool force)
+{
+    if (!initialized || txDirect)
+        return;
+
+    uintptr_t flags = Arch::CPU::interruptsSave();
+    if (!force) {
+        txLock.lock();
+    } else if (!txLock.tryLock()) {
+        // The holder is this processor or one stopped by the panic, so the
+        // lock will never be released. Whatever is queued may be half
+        // written; leave it and send everything straight to the UART.
+        txDirect = true;
+        Arch::CPU::interruptsRestore(flags);
+        return;
+    }
+    while (!txRing.IsEmpty()) {
+        transmit();
+        Arch::CPU::relax();
+    }
+    txLock.unlock();
+    Arch::CPU::interruptsRestore(flags);
+}
+
 int close()
 {
     return 0;
@@ -20,13 +20,28 @@
 #define RS_232_COM3 0x3E8
 #define RS_232_COM4 0x2E8
 
+#define RS_232_MAX_BAUD 115200
+#define RS_232_DEFAULT_BAUD RS_232_MAX_BAUD
+
 namespace RS232 {
 
+/**
+ * @brief What a write does when the transmit buffer is full.
+ *
+ */
+enum class Backpressure {
+    Drop,   // Discard what doesn't fit and return immediately (default)
+    Wait,   // Busy-wait on the transmitter until everything is queued
+};
+
 /**
  * @brief Activates the RS232 serial driver
  *
+ * @param com_id Port base address
+ * @param baud Line speed. Values that don't divide 115200 evenly are
+ * rounded down to the next speed that does.
  */
-void init(uint16_t com_id);
+void init(uint16_t com_id, uint32_t baud = RS_232_DEFAULT_BAUD);
 
 /**
  * @brief Reads bytes from the serial buffer
@@ -38,14 +53,39 @@ void init(uint16_t com_id);
 size_t read(char* buf, size_t count);
 
 /**
- * @brief Write bytes to the serial device
+ * @brief Queue bytes for transmission. Bytes are sent from the transmit
+ * interrupt, so this only waits if the buffer is full and the backpressure
+ * policy is Backpressure::Wait. Safe to call from interrupt handlers.
  *
  * @param buf Buffer containing bytes to write
  * @param count Number of bytes to write
- * @return size_t Returns number of bytes written
+ * @return size_t Returns number of bytes queued
  */
 size_t write(const char* buf, size_t count);
 
+/**
+ * @brief Set what happens to writes when the transmit buffer is full.
+ *
+ * @param policy Backpressure policy
+ */
+void setBackpressure(Backpressure policy);
+
+/**
+ * @brief Number of bytes discarded because the transmit buffer was full.
+ *
+ */
+size_t dropped();
+
+/**
+ * @brief Busy-wait until every queued byte has been handed to the
+ * transmitter. Useful when interrupts won't be serviced anymore (e.g.
+ * while panicking).
+ *
+ * @param force Don't wait for the transmit lock (used on panic). If it is
+ * held, queued bytes are abandoned and later writes poll the UART directly.
+ */
+void flush(bool force = false);
+
 /**
  * @brief Prints a formatted string to serial output
  *
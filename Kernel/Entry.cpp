@@ -19,6 +19,7 @@
 // Architecture specific code
 #include <Arch/Arch.hpp>
 // Memory management & paging
+#include <Memory/heap.hpp>
 #include <Memory/paging.hpp>
 #include <Memory/Physical.hpp>
 // Generic devices
@@ -89,12 +90,23 @@ void kernelEntry(void* info, uint32_t magic)
 {
     Arch::CPU::init();
     Arch::CPU::criticalRegion(devInit);
+    Time::monotonicInit();
 
     Boot::Handoff handoff(info, magic);
     Memory::Physical::Manager::initialize(handoff.MemoryMap());
     Memory::init();
     Graphics::init(handoff.FramebufferInfo());
+    Console::init();
+    // Nothing reads the bootloader structures past this point
+    Memory::Physical::Manager::reclaim();
     tasks_init();
+    Arch::CPU::smpInit();
+    struct task logger;
+    tasks_new(Logger::drainTask, &logger, TASK_READY, "logger");
+#ifdef HEAP_PROFILE
+    struct task heapProfile;
+    tasks_new(Memory::Heap::profileTask, &heapProfile, TASK_READY, "heap-profile");
+#endif
 
     printSplash();
     Time::TimeDescriptor time;
@@ -104,7 +116,7 @@ void kernelEntry(void* info, uint32_t magic)
         time.getYear(),
         time.getHour(),
         time.getMinutes());
-    Logger::Info(__func__, "%s\n%s\n", Arch::CPU::vendor(), Arch::CPU::model());
+    LOG_INFO(__func__, "%s\n%s\n", Arch::CPU::vendor(), Arch::CPU::model());
 
     struct task compute, status, spinner;
     tasks_new(Apps::find_primes, &compute, TASK_READY, "prime_compute");
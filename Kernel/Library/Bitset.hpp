@@ -2,8 +2,10 @@
  * @file Bitset.hpp
  * @author Micah Switzer (mswitzer@cedarville.edu)
  * @author Keeton Feasvel (keetonfeavel@cedarville.edu)
- * @brief A basic bitmap implementation
- * @version 0.3
+ * @brief A basic bitmap implementation. Searches work a word at a time and
+ * can optionally be backed by a two-level summary bitmap so that finding a
+ * bit in a mostly full (or mostly empty) set only touches a few words.
+ * @version 0.4
  * @date 2020-07-08
  *
  * @copyright Copyright the Xyris Contributors (c) 2020
@@ -11,43 +13,107 @@
  */
 #pragma once
 
-#include <Arch/Arch.hpp>
-#include <Library/string.hpp>
 #include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
 
-template<size_t t_num_bits>
+/**
+ * @brief Fixed size bitset.
+ *
+ * @tparam t_num_bits Number of bits, or 0 for a bitset sized at runtime that
+ * keeps its bits in storage provided by the owner
+ * @tparam t_summary If true, keep two summary levels per polarity. Each bit of
+ * the first level tells whether a word of the bitset contains a bit of that
+ * polarity, and each bit of the second level tells whether a word of the first
+ * level is non-zero. Searches then skip 32 (or 64) words per summary bit read.
+ * Updates cost a little more, so leave it off for sets that are never searched.
+ */
+template<size_t t_num_bits, bool t_summary = false>
 class Bitset {
 public:
-    Bitset() = default;
+    static_assert(t_num_bits != 0 || !t_summary, "Runtime sized bitsets have no summary");
+
+    Bitset()
+        : Bitset(false)
+    {
+    }
 
     Bitset(bool defaultValue)
         : m_numBits(t_num_bits)
-        , m_count(0)
+        , m_count(defaultValue ? t_num_bits : 0)
+        , m_external(nullptr)
+    {
+        static_assert(t_num_bits != 0, "Runtime sized bitsets need storage");
+        for (size_t i = 0; i < Words(); i++) {
+            Data()[i] = (defaultValue ? ValidMask(i) : 0);
+        }
+        if constexpr (t_summary) {
+            for (size_t level = 0; level < 2; level++) {
+                for (size_t i = 0; i < SummaryWords(); i++) {
+                    m_summary[level][0][i] = 0;
+                }
+                for (size_t i = 0; i < TopWords(); i++) {
+                    m_summary[level][1][i] = 0;
+                }
+            }
+            for (size_t i = 0; i < Words(); i++) {
+                UpdateSummary(i);
+            }
+        }
+    }
+
+    /**
+     * @brief Construct a bitset sized at runtime (t_num_bits must be 0).
+     *
+     * @param numBits Number of bits
+     * @param storage StorageWords(numBits) words that outlive the bitset
+     * @param defaultValue Initial value of every bit
+     */
+    Bitset(size_t numBits, size_t* storage, bool defaultValue = false)
+        : m_numBits(numBits)
+        , m_count(defaultValue ? numBits : 0)
+        , m_external(storage)
     {
-        for (size_t i = 0; i < sizeof(m_bitset) / sizeof(*m_bitset); i++) {
-            m_bitset[i] = (defaultValue ? SIZE_MAX : 0);
+        static_assert(t_num_bits == 0, "Only runtime sized bitsets take storage");
+        for (size_t i = 0; i < Words(); i++) {
+            Data()[i] = (defaultValue ? ValidMask(i) : 0);
         }
     }
 
+    /**
+     * @brief Size of the storage for a runtime sized bitset of `numBits`
+     * bits, in words.
+     *
+     */
+    static constexpr size_t StorageWords(size_t numBits) { return (numBits + TypeSize() - 1) / TypeSize(); }
+
     [[gnu::always_inline]] size_t Size() { return m_numBits; }
     [[gnu::always_inline]] size_t Count() { return m_count; }
 
     [[gnu::always_inline]] void Set(size_t pos)
     {
+        size_t bit = (size_t)1 << Offset(pos);
+        if (Data()[Index(pos)] & bit) {
+            return;
+        }
         m_count++;
-        m_bitset[Index(pos)] |= 1UL << Offset(pos);
+        Data()[Index(pos)] |= bit;
+        UpdateSummary(Index(pos));
     }
 
     [[gnu::always_inline]] void Clear(size_t pos)
     {
+        size_t bit = (size_t)1 << Offset(pos);
+        if (!(Data()[Index(pos)] & bit)) {
+            return;
+        }
         m_count--;
-        m_bitset[Index(pos)] &= ~(1UL << Offset(pos));
+        Data()[Index(pos)] &= ~bit;
+        UpdateSummary(Index(pos));
     }
 
     [[gnu::always_inline]] void Flip(size_t pos) { Test(pos) ? Clear(pos) : Set(pos); }
-    [[gnu::always_inline]] bool Test(size_t pos) { return m_bitset[Index(pos)] >> Offset(pos) & 1; }
+    [[gnu::always_inline]] bool Test(size_t pos) { return Data()[Index(pos)] >> Offset(pos) & 1; }
     [[gnu::always_inline]] bool Any() { return m_count > 0; }
     [[gnu::always_inline]] bool None() { return m_count == 0; }
     [[gnu::always_inline]] bool All() { return m_count == m_numBits; }
@@ -62,6 +128,24 @@ public:
      */
     [[gnu::always_inline]] bool operator[](size_t pos) { return Test(pos); }
 
+    /**
+     * @brief Set `count` bits starting at `pos`. Whole words are filled
+     * at once.
+     *
+     * @param pos Position of the first bit
+     * @param count Number of bits to set
+     */
+    void SetRange(size_t pos, size_t count) { FillRange(pos, count, true); }
+
+    /**
+     * @brief Clear `count` bits starting at `pos`. Whole words are filled
+     * at once.
+     *
+     * @param pos Position of the first bit
+     * @param count Number of bits to clear
+     */
+    void ClearRange(size_t pos, size_t count) { FillRange(pos, count, false); }
+
     /**
      * @brief Finds and returns the position of the first clear bit.
      *
@@ -69,15 +153,34 @@ public:
      * @return size_t Position of the first bit with desired polarity.
      * If all bits are polarized, SIZE_MAX is returned.
      */
-    [[gnu::always_inline]] size_t FindFirstBit(bool isSet)
+    [[gnu::always_inline]] size_t FindFirstBit(bool isSet) { return FindNextBit(0, isSet); }
+
+    /**
+     * @brief Finds and returns the position of the first bit at or after
+     * `pos` with the desired polarity.
+     *
+     * @param pos Position to start searching from
+     * @param isSet If true, find the next bit that is set.
+     * @return size_t Position of the next bit with desired polarity.
+     * If there is none, SIZE_MAX is returned.
+     */
+    size_t FindNextBit(size_t pos, bool isSet)
     {
-        for (size_t i = 0; i < t_num_bits; i++) {
-            if (Test(i) == isSet) {
-                return i;
+        if (pos >= Bits()) {
+            return Bitset::npos;
+        }
+
+        size_t idx = Index(pos);
+        size_t word = Load(idx, isSet) & (SIZE_MAX << Offset(pos));
+        if (!word) {
+            idx = FindNextWord(idx + 1, isSet);
+            if (idx == Bitset::npos) {
+                return Bitset::npos;
             }
+            word = Load(idx, isSet);
         }
 
-        return Bitset::npos;
+        return idx * TypeSize() + (size_t)__builtin_ctzl(word);
     }
 
     /**
@@ -88,20 +191,23 @@ public:
      * @return size_t Position of the first bit with desired range and polarity.
      * If all bits are polarized, SIZE_MAX is returned.
      */
-    [[gnu::always_inline]] size_t FindFirstRange(size_t count, bool isSet)
+    size_t FindFirstRange(size_t count, bool isSet)
     {
-        size_t checkLow, checkHigh, check, idx, offset;
-        size_t mask = ((size_t)1 << count) - (size_t)1;
-        for (size_t i = 0UL; i < t_num_bits - count; i++) {
-            idx = Index(i);
-            offset = Offset(i);
-            checkLow = m_bitset[idx] >> offset;
-            checkHigh = offset ? m_bitset[idx + 1] << (TypeSize() - offset) : 0;
-            check = checkLow | checkHigh;
-
-            if ((check & mask) == isSet) {
-                return i;
+        if (count == 0 || count > Bits()) {
+            return Bitset::npos;
+        }
+
+        size_t start = FindNextBit(0, isSet);
+        while (start != Bitset::npos && Bits() - start >= count) {
+            // hop to the end of this run
+            size_t end = FindNextBit(start, !isSet);
+            if (end == Bitset::npos) {
+                end = Bits();
             }
+            if (end - start >= count) {
+                return start;
+            }
+            start = FindNextBit(end, isSet);
         }
 
         return Bitset::npos;
@@ -112,14 +218,20 @@ public:
      * When provided as a return value, it indicates no matches.
      *
      */
-    static const size_t npos = SIZE_MAX;
+    static constexpr size_t npos = SIZE_MAX;
 
 private:
+    static constexpr size_t TypeSize() { return sizeof(size_t) * CHAR_BIT; }
+    static constexpr size_t SummaryWords() { return (StorageWords(t_num_bits) + TypeSize() - 1) / TypeSize(); }
+    static constexpr size_t TopWords() { return (SummaryWords() + TypeSize() - 1) / TypeSize(); }
+
     size_t m_numBits;
     size_t m_count;
-    size_t m_bitset[t_num_bits / (CHAR_BIT * sizeof(size_t))];
-
-    [[gnu::always_inline]] size_t TypeSize() { return sizeof(size_t) * CHAR_BIT; }
+    size_t* m_external;     // Bits of a runtime sized bitset
+    size_t m_bitset[t_num_bits ? StorageWords(t_num_bits) : 1];
+    // [polarity][level] where level 0 has a bit per bitset word
+    // and level 1 has a bit per level 0 word
+    size_t m_summary[2][2][t_summary ? SummaryWords() : 1];
 
     /**
      * @brief Index into the array of size_t's (size_t containing bit @ position)
@@ -127,7 +239,7 @@ private:
      * @param position Position (index) of desired bit
      * @return size_t Index of size_t in m_bitset containing bit at position
      */
-    [[gnu::always_inline]] size_t Index(size_t position) { return position / TypeSize(); }
+    [[gnu::always_inline]] static size_t Index(size_t position) { return position / TypeSize(); }
 
     /**
      * @brief Number of bits to offset in size_t to get desired bit at position
@@ -135,5 +247,161 @@ private:
      * @param position Position (index) of desired bit
      * @return size_t Offset into size_t for desired bit
      */
-    [[gnu::always_inline]] size_t Offset(size_t position) { return position % TypeSize(); }
+    [[gnu::always_inline]] static size_t Offset(size_t position) { return position % TypeSize(); }
+
+    /**
+     * @brief Number of bits. Fixed size bitsets use the constant so that
+     * the compiler can fold it.
+     *
+     */
+    [[gnu::always_inline]] size_t Bits() const
+    {
+        if constexpr (t_num_bits != 0) {
+            return t_num_bits;
+        } else {
+            return m_numBits;
+        }
+    }
+
+    [[gnu::always_inline]] size_t Words() const { return StorageWords(Bits()); }
+
+    [[gnu::always_inline]] size_t* Data()
+    {
+        if constexpr (t_num_bits != 0) {
+            return m_bitset;
+        } else {
+            return m_external;
+        }
+    }
+
+    /**
+     * @brief Mask of the bits in word `idx` that are part of the set.
+     * Only the last word can be partially used.
+     *
+     */
+    [[gnu::always_inline]] size_t ValidMask(size_t idx) const
+    {
+        if (idx == Words() - 1 && Offset(Bits())) {
+            return ((size_t)1 << Offset(Bits())) - 1;
+        }
+        return SIZE_MAX;
+    }
+
+    /**
+     * @brief Load word `idx` so that bits of the desired polarity read as ones.
+     *
+     */
+    [[gnu::always_inline]] size_t Load(size_t idx, bool isSet)
+    {
+        return isSet ? Data()[idx] : ~Data()[idx] & ValidMask(idx);
+    }
+
+    /**
+     * @brief Index of the first word at or after `idx` that has a bit of the
+     * desired polarity, or npos.
+     *
+     */
+    size_t FindNextWord(size_t idx, bool isSet)
+    {
+        if (idx >= Words()) {
+            return Bitset::npos;
+        }
+
+        if constexpr (!t_summary) {
+            for (; idx < Words(); idx++) {
+                if (Load(idx, isSet)) {
+                    return idx;
+                }
+            }
+            return Bitset::npos;
+        } else {
+            size_t* summary = m_summary[isSet][0];
+            size_t* top = m_summary[isSet][1];
+            size_t sidx = Index(idx);
+            size_t word = summary[sidx] & (SIZE_MAX << Offset(idx));
+            if (!word) {
+                // the top level is small enough to scan linearly
+                size_t tidx = Index(sidx + 1);
+                size_t tword = tidx < TopWords() ? top[tidx] & (SIZE_MAX << Offset(sidx + 1)) : 0;
+                while (!tword) {
+                    if (++tidx >= TopWords()) {
+                        return Bitset::npos;
+                    }
+                    tword = top[tidx];
+                }
+                sidx = tidx * TypeSize() + (size_t)__builtin_ctzl(tword);
+                word = summary[sidx];
+            }
+            return sidx * TypeSize() + (size_t)__builtin_ctzl(word);
+        }
+    }
+
+    /**
+     * @brief Refresh the summary bits covering word `idx` after it changed.
+     *
+     */
+    [[gnu::always_inline]] void UpdateSummary(size_t idx)
+    {
+        if constexpr (t_summary) {
+            for (size_t polarity = 0; polarity < 2; polarity++) {
+                size_t* summary = m_summary[polarity][0];
+                size_t* top = m_summary[polarity][1];
+                size_t bit = (size_t)1 << Offset(idx);
+                if (Load(idx, polarity == 1)) {
+                    summary[Index(idx)] |= bit;
+                } else {
+                    summary[Index(idx)] &= ~bit;
+                }
+
+                size_t sidx = Index(idx);
+                size_t tbit = (size_t)1 << Offset(sidx);
+                if (summary[sidx]) {
+                    top[Index(sidx)] |= tbit;
+                } else {
+                    top[Index(sidx)] &= ~tbit;
+                }
+            }
+        } else {
+            (void)idx;
+        }
+    }
+
+    /**
+     * @brief Apply `mask` to word `idx` with the desired polarity and keep
+     * the count and summary in sync.
+     *
+     */
+    [[gnu::always_inline]] void FillWord(size_t idx, size_t mask, bool value)
+    {
+        size_t old = Data()[idx];
+        Data()[idx] = value ? old | mask : old & ~mask;
+        if (Data()[idx] == old) {
+            return;
+        }
+        m_count += (size_t)__builtin_popcountl(Data()[idx]);
+        m_count -= (size_t)__builtin_popcountl(old);
+        UpdateSummary(idx);
+    }
+
+    void FillRange(size_t pos, size_t count, bool value)
+    {
+        if (pos >= Bits()) {
+            return;
+        }
+        if (count > Bits() - pos) {
+            count = Bits() - pos;
+        }
+
+        while (count > 0) {
+            size_t offset = Offset(pos);
+            size_t bits = TypeSize() - offset;
+            if (bits > count) {
+                bits = count;
+            }
+            size_t mask = bits == TypeSize() ? SIZE_MAX : (((size_t)1 << bits) - 1) << offset;
+            FillWord(Index(pos), mask, value);
+            pos += bits;
+            count -= bits;
+        }
+    }
 };
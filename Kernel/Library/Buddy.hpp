@@ -0,0 +1,333 @@
+/**
+ * @file Buddy.hpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief Binary buddy allocator. Hands out naturally aligned, contiguous
+ * runs of blocks (e.g. physical page frames). Free blocks are tracked with
+ * one bitmap per order, so no memory inside the managed blocks is needed.
+ * The bitmaps are either part of the allocator (fixed block count) or
+ * provided by the owner once the block count is known at runtime.
+ * @version 0.1
+ * @date 2022-03-14
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ */
+#pragma once
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Binary buddy allocator.
+ *
+ * @tparam t_num_blocks Number of blocks, or 0 for a block count chosen at
+ * runtime (see Init)
+ * @tparam t_max_order Largest block is 2^t_max_order blocks
+ */
+template<size_t t_num_blocks, size_t t_max_order = 10>
+class Buddy {
+public:
+    static_assert(t_num_blocks % ((size_t)1 << t_max_order) == 0, "Block count must be a multiple of the largest block");
+
+    /**
+     * @brief Construct an allocator with every block reserved. Allocators
+     * with a runtime block count manage no blocks until Init is called.
+     *
+     */
+    Buddy()
+        : m_numBlocks(0)
+        , m_freeBlocks(0)
+        , m_bitmap(nullptr)
+    {
+        if constexpr (t_num_blocks != 0) {
+            Init(t_num_blocks, m_storage);
+        }
+    }
+
+    /**
+     * @brief Size of the bitmaps for `numBlocks` blocks, in words.
+     *
+     */
+    static constexpr size_t StorageWords(size_t numBlocks)
+    {
+        size_t words = 0;
+        for (size_t order = 0; order <= t_max_order; order++) {
+            words += ((numBlocks >> order) + TypeSize() - 1) / TypeSize();
+        }
+        return words;
+    }
+
+    /**
+     * @brief Manage `numBlocks` blocks (all reserved) with bitmaps kept in
+     * `storage`. Must be called once, before anything else, by allocators
+     * with a runtime block count.
+     *
+     * @param numBlocks Number of blocks (a multiple of 2^t_max_order)
+     * @param storage StorageWords(numBlocks) words that outlive the allocator
+     */
+    void Init(size_t numBlocks, size_t* storage)
+    {
+        m_numBlocks = numBlocks;
+        m_freeBlocks = 0;
+        m_bitmap = storage;
+        size_t offset = 0;
+        for (size_t order = 0; order <= t_max_order; order++) {
+            m_offset[order] = offset;
+            offset += ((numBlocks >> order) + TypeSize() - 1) / TypeSize();
+            m_count[order] = 0;
+            m_hint[order] = 0;
+        }
+        for (size_t i = 0; i < offset; i++) {
+            m_bitmap[i] = 0;
+        }
+    }
+
+    /**
+     * @brief Number of blocks managed.
+     *
+     */
+    [[gnu::always_inline]] size_t Size() { return m_numBlocks; }
+
+    /**
+     * @brief Number of free blocks.
+     *
+     */
+    [[gnu::always_inline]] size_t FreeCount() { return m_freeBlocks; }
+
+    /**
+     * @brief Smallest order whose blocks can hold `count` blocks.
+     *
+     */
+    [[gnu::always_inline]] static size_t OrderFor(size_t count)
+    {
+        size_t order = 0;
+        while (((size_t)1 << order) < count) {
+            order++;
+        }
+        return order;
+    }
+
+    /**
+     * @brief Allocate `count` contiguous blocks. The run starts on a boundary
+     * aligned to the smallest power of two holding `count` blocks. Blocks past
+     * `count` in that power of two are returned to the allocator.
+     *
+     * @param count Number of contiguous blocks
+     * @return size_t Index of the first block, or npos if no run is available
+     */
+    size_t Alloc(size_t count)
+    {
+        if (count == 0) {
+            return npos;
+        }
+
+        size_t order = OrderFor(count);
+        if (order > t_max_order) {
+            return npos;
+        }
+
+        size_t found = order;
+        while (found <= t_max_order && m_count[found] == 0) {
+            found++;
+        }
+        if (found > t_max_order) {
+            return npos;
+        }
+
+        size_t block = FindFree(found);
+        ClearFree(found, block);
+        // split the block until it is the requested order
+        while (found > order) {
+            found--;
+            SetFree(found, block + ((size_t)1 << found));
+        }
+        m_freeBlocks -= (size_t)1 << order;
+
+        // give back the unused tail
+        Free(block + count, ((size_t)1 << order) - count);
+        return block;
+    }
+
+    /**
+     * @brief Release `count` contiguous blocks starting at `block`. The range
+     * does not need to be aligned or come from a single allocation.
+     *
+     * @param block Index of the first block
+     * @param count Number of contiguous blocks
+     */
+    void Free(size_t block, size_t count)
+    {
+        while (count > 0) {
+            size_t order = LargestAligned(block, count);
+            FreeBlock(block, order);
+            block += (size_t)1 << order;
+            count -= (size_t)1 << order;
+        }
+    }
+
+    /**
+     * @brief Remove `count` contiguous blocks starting at `block` from the
+     * free pool. Aligned blocks that are free as a whole are taken at once,
+     * so reserving a large range costs about as much as freeing it.
+     *
+     * @param block Index of the first block
+     * @param count Number of contiguous blocks
+     * @return size_t Number of blocks that were free and are now reserved
+     */
+    size_t ReserveRange(size_t block, size_t count)
+    {
+        size_t reserved = 0;
+        while (count > 0) {
+            size_t order = LargestAligned(block, count);
+            reserved += ReserveBlock(block, order, t_max_order);
+            block += (size_t)1 << order;
+            count -= (size_t)1 << order;
+        }
+        return reserved;
+    }
+
+    /**
+     * @brief Remove a specific block from the free pool (if it is free).
+     *
+     * @param block Index of the block
+     * @return true The block was free and is now reserved
+     * @return false The block was not free
+     */
+    bool Reserve(size_t block)
+    {
+        return ReserveBlock(block, 0, t_max_order) != 0;
+    }
+
+    /**
+     * @brief Check whether a block is free.
+     *
+     * @param block Index of the block
+     */
+    bool IsFree(size_t block)
+    {
+        for (size_t order = 0; order <= t_max_order; order++) {
+            if (TestFree(order, block & ~(((size_t)1 << order) - 1))) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * @brief When provided as a return value, it indicates no matches.
+     *
+     */
+    static constexpr size_t npos = SIZE_MAX;
+
+private:
+    static constexpr size_t TypeSize() { return sizeof(size_t) * CHAR_BIT; }
+
+    size_t m_numBlocks;
+    size_t m_freeBlocks;
+    size_t* m_bitmap;                   // m_storage, or storage given to Init
+    size_t m_offset[t_max_order + 1];   // first bitmap word of every order
+    size_t m_count[t_max_order + 1];    // free blocks per order
+    size_t m_hint[t_max_order + 1];     // no free blocks below this word (per order)
+    size_t m_storage[t_num_blocks ? StorageWords(t_num_blocks) : 1];
+
+    [[gnu::always_inline]] bool TestFree(size_t order, size_t block)
+    {
+        size_t bit = block >> order;
+        return m_bitmap[m_offset[order] + bit / TypeSize()] >> (bit % TypeSize()) & 1;
+    }
+
+    [[gnu::always_inline]] void SetFree(size_t order, size_t block)
+    {
+        size_t bit = block >> order;
+        size_t word = bit / TypeSize();
+        m_bitmap[m_offset[order] + word] |= (size_t)1 << (bit % TypeSize());
+        m_count[order]++;
+        if (word < m_hint[order]) {
+            m_hint[order] = word;
+        }
+    }
+
+    [[gnu::always_inline]] void ClearFree(size_t order, size_t block)
+    {
+        size_t bit = block >> order;
+        m_bitmap[m_offset[order] + bit / TypeSize()] &= ~((size_t)1 << (bit % TypeSize()));
+        m_count[order]--;
+    }
+
+    // must only be called when m_count[order] != 0
+    size_t FindFree(size_t order)
+    {
+        size_t* words = &m_bitmap[m_offset[order]];
+        size_t word = m_hint[order];
+        while (words[word] == 0) {
+            word++;
+        }
+        m_hint[order] = word;
+        return ((word * TypeSize()) + (size_t)__builtin_ctzl(words[word])) << order;
+    }
+
+    // Order of the largest aligned block at `block` that fits in `count` blocks
+    [[gnu::always_inline]] static size_t LargestAligned(size_t block, size_t count)
+    {
+        size_t order = 0;
+        while (order < t_max_order
+            && (block & (((size_t)1 << (order + 1)) - 1)) == 0
+            && ((size_t)1 << (order + 1)) <= count) {
+            order++;
+        }
+        return order;
+    }
+
+    // Reserve whatever is free in the aligned block of 2^order blocks. Free
+    // blocks containing it are looked for up to `top` (the caller already
+    // knows that none above `top` is free).
+    size_t ReserveBlock(size_t block, size_t order, size_t top)
+    {
+        for (size_t found = order; found <= top; found++) {
+            size_t head = block & ~(((size_t)1 << found) - 1);
+            if (!TestFree(found, head)) {
+                continue;
+            }
+
+            ClearFree(found, head);
+            // give back the halves that don't contain the block
+            while (found > order) {
+                found--;
+                size_t half = (size_t)1 << found;
+                if (block & half) {
+                    SetFree(found, head);
+                    head += half;
+                } else {
+                    SetFree(found, head + half);
+                }
+            }
+            m_freeBlocks -= (size_t)1 << order;
+            return (size_t)1 << order;
+        }
+        if (order == 0) {
+            return 0;
+        }
+
+        // Only parts of the block are free (if any)
+        size_t half = (size_t)1 << (order - 1);
+        return ReserveBlock(block, order - 1, order - 1) + ReserveBlock(block + half, order - 1, order - 1);
+    }
+
+    void FreeBlock(size_t block, size_t order)
+    {
+        m_freeBlocks += (size_t)1 << order;
+        // merge with the buddy for as long as it is free too
+        while (order < t_max_order) {
+            size_t buddy = block ^ ((size_t)1 << order);
+            if (!TestFree(order, buddy)) {
+                break;
+            }
+            ClearFree(order, buddy);
+            block &= ~((size_t)1 << order);
+            order++;
+        }
+        SetFree(order, block);
+    }
+};
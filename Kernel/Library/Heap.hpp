@@ -0,0 +1,168 @@
+/**
+ * @file Heap.hpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief Intrusive min-heap (pairing heap). The links live inside the
+ * elements themselves, so the heap never allocates and never fills up,
+ * and it can be used where allocating memory is not allowed (e.g. while
+ * holding the scheduler lock).
+ * @version 0.2
+ * @date 2022-03-16
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Links embedded in every element that can be in a MinHeap.
+ * An element can only be in one heap (per link) at a time.
+ *
+ * @tparam T Element type
+ */
+template<typename T>
+struct HeapLink {
+    T* child;   // First child
+    T* next;    // Next sibling
+    T* prev;    // Previous sibling, or the parent of a first child
+};
+
+/**
+ * @brief Intrusive min-heap. Push is O(1) and Pop is amortized O(log n).
+ *
+ * @tparam T Element type
+ * @tparam t_link Member of T holding the element's HeapLink
+ * @tparam Compare Type whose call operator returns true if the first
+ * argument must come out of the heap before the second
+ */
+template<typename T, HeapLink<T> T::*t_link, typename Compare>
+class MinHeap {
+public:
+    MinHeap()
+        : m_root(nullptr)
+        , m_size(0)
+    {
+    }
+
+    /**
+     * @brief Number of elements in the heap.
+     *
+     */
+    [[gnu::always_inline]] size_t Size() { return m_size; }
+
+    [[gnu::always_inline]] bool Empty() { return m_root == nullptr; }
+
+    /**
+     * @brief Smallest element. The heap must not be empty.
+     *
+     */
+    [[gnu::always_inline]] T* Top() { return m_root; }
+
+    /**
+     * @brief Insert an element.
+     *
+     * @param node Element to insert (not in the heap already)
+     */
+    void Push(T* node)
+    {
+        Link(node) = { nullptr, nullptr, nullptr };
+        m_root = m_root ? Meld(m_root, node) : node;
+        m_size++;
+    }
+
+    /**
+     * @brief Remove and return the smallest element. The heap must
+     * not be empty.
+     *
+     */
+    T* Pop()
+    {
+        T* top = m_root;
+        m_root = MergePairs(Link(top).child);
+        Link(top).child = nullptr;
+        m_size--;
+        return top;
+    }
+
+    /**
+     * @brief Call `fn` with every element, in no particular order.
+     * The heap must not change meanwhile.
+     *
+     */
+    template<typename Function>
+    void ForEach(Function fn)
+    {
+        T* node = m_root;
+        while (node) {
+            fn(node);
+            if (Link(node).child) {
+                node = Link(node).child;
+                continue;
+            }
+            // Climb until there is a sibling left to visit
+            while (node && !Link(node).next) {
+                while (Link(node).prev && Link(Link(node).prev).next == node) {
+                    node = Link(node).prev;
+                }
+                node = Link(node).prev;
+            }
+            if (node) {
+                node = Link(node).next;
+            }
+        }
+    }
+
+private:
+    [[gnu::always_inline]] static HeapLink<T>& Link(T* node) { return node->*t_link; }
+
+    // Both must be detached roots. The larger one becomes the first child of the other.
+    static T* Meld(T* a, T* b)
+    {
+        if (Compare{}(b, a)) {
+            T* tmp = a;
+            a = b;
+            b = tmp;
+        }
+        Link(b).prev = a;
+        Link(b).next = Link(a).child;
+        if (Link(a).child) {
+            Link(Link(a).child).prev = b;
+        }
+        Link(a).child = b;
+        return a;
+    }
+
+    // Meld the children of a removed root back into a single tree: pairs
+    // from left to right, then the pairs from right to left. Without
+    // recursion, so the depth of the heap doesn't matter.
+    static T* MergePairs(T* first)
+    {
+        T* pairs = nullptr;     // Melded pairs, latest first (linked through next)
+        while (first) {
+            T* a = first;
+            T* b = Link(a).next;
+            first = b ? Link(b).next : nullptr;
+            Link(a).next = Link(a).prev = nullptr;
+            if (b) {
+                Link(b).next = Link(b).prev = nullptr;
+                a = Meld(a, b);
+            }
+            Link(a).next = pairs;
+            pairs = a;
+        }
+
+        T* root = nullptr;
+        while (pairs) {
+            T* a = pairs;
+            pairs = Link(a).next;
+            Link(a).next = nullptr;
+            root = root ? Meld(root, a) : a;
+        }
+        return root;
+    }
+
+    T* m_root;
+    size_t m_size;
+};
@@ -14,9 +14,28 @@
 
 namespace LinkedList {
 
+/**
+ * @brief Node storage hooks, defined once by whoever links the list in. The
+ * kernel uses object caches (see Memory/Slab.cpp) so that list operations
+ * don't contend on the heap lock.
+ *
+ */
+void* allocateNode(size_t size);
+void freeNode(void* node, size_t size);
+
 template<typename T>
 class LinkedListNode {
 public:
+    static void* operator new(size_t size)
+    {
+        return allocateNode(size);
+    }
+
+    static void operator delete(void* node, size_t size)
+    {
+        freeNode(node, size);
+    }
+
     /**
      * @brief Construct a new Linked List Node object
      *
@@ -0,0 +1,352 @@
+/**
+ * @file RangeAllocator.hpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief Allocator for ranges of an index space (e.g. virtual pages). Free
+ * extents are kept in a balanced search tree (a treap) ordered by start, and
+ * every node also knows the largest extent in its subtree. Finding the lowest
+ * free extent that fits a request, reserving a given range and freeing a
+ * range (merging it with its neighbours) all take O(log n) in the number of
+ * free extents, no matter how large the ranges are.
+ *
+ * Nodes come from a fixed pool, so the allocator never allocates memory.
+ * @version 0.1
+ * @date 2022-03-25
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ * References:
+ *     https://en.wikipedia.org/wiki/Treap
+ *     https://en.wikipedia.org/wiki/Interval_tree#Augmented_tree
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Range allocator with a fixed number of extents.
+ *
+ * @tparam t_nodes Maximum number of free extents. Reserving a range from the
+ * middle of an extent or freeing a range that touches no other free extent
+ * needs a node, and fails if the pool is exhausted.
+ */
+template<size_t t_nodes>
+class RangeAllocator {
+public:
+    RangeAllocator()
+        : m_root(nullptr)
+        , m_unused(nullptr)
+        , m_seed(0x9E3779B9)
+        , m_extents(0)
+        , m_freeCount(0)
+    {
+        for (size_t i = t_nodes; i-- > 0;) {
+            m_nodes[i].left = m_unused;
+            m_unused = &m_nodes[i];
+        }
+    }
+
+    /**
+     * @brief Reserve the lowest free range of `count` positions.
+     *
+     * @param count Number of positions
+     * @return size_t Start of the range, or npos if no free extent is large enough
+     */
+    size_t Allocate(size_t count)
+    {
+        if (count == 0 || !m_root || m_root->largest < count) {
+            return npos;
+        }
+
+        // The leftmost extent that fits: prefer the left subtree whenever it has one
+        struct Node* node = m_root;
+        for (;;) {
+            if (node->left && node->left->largest >= count) {
+                node = node->left;
+            } else if (node->count >= count) {
+                break;
+            } else {
+                node = node->right;
+            }
+        }
+
+        size_t start = node->start;
+        struct Node *lower, *upper;
+        Split(m_root, start, &lower, &upper);
+        struct Node* extent = TakeMin(&upper);
+        extent->start += count;
+        extent->count -= count;
+        if (extent->count) {
+            Update(extent);
+            upper = Merge(extent, upper);
+        } else {
+            Release(extent);
+        }
+        m_root = Merge(lower, upper);
+        m_freeCount -= count;
+        return start;
+    }
+
+    /**
+     * @brief Reserve a given range.
+     *
+     * @return true The range was free and is now reserved
+     * @return false Part of the range isn't free, or no node is available to
+     * split its extent
+     */
+    bool AllocateAt(size_t start, size_t count)
+    {
+        if (count == 0 || start + count < start) {
+            return false;
+        }
+
+        struct Node *lower, *upper;
+        Split(m_root, start + 1, &lower, &upper);
+        struct Node* extent = TakeMax(&lower);
+        if (!extent || extent->start + extent->count < start + count) {
+            // Not (entirely) inside a free extent
+            m_root = Merge(Merge(lower, extent), upper);
+            return false;
+        }
+
+        size_t end = extent->start + extent->count;
+        struct Node* after = nullptr;
+        if (end > start + count) {
+            if (!(after = Acquire(start + count, end - (start + count)))) {
+                m_root = Merge(Merge(lower, extent), upper);
+                return false;
+            }
+        }
+        if (extent->start < start) {
+            extent->count = start - extent->start;
+            Update(extent);
+            lower = Merge(lower, extent);
+        } else {
+            Release(extent);
+        }
+        m_root = Merge(Merge(lower, after), upper);
+        m_freeCount -= count;
+        return true;
+    }
+
+    /**
+     * @brief Free a range, merging it with the free extents next to it.
+     * Also used to hand the allocator its initial free ranges.
+     *
+     * @return true The range is free now
+     * @return false Part of the range was already free, or no node is
+     * available for a new extent
+     */
+    bool Free(size_t start, size_t count)
+    {
+        if (count == 0 || start + count < start) {
+            return false;
+        }
+
+        struct Node *lower, *upper;
+        Split(m_root, start, &lower, &upper);
+        struct Node* before = TakeMax(&lower);
+        struct Node* after = TakeMin(&upper);
+        if ((before && before->start + before->count > start) || (after && after->start < start + count)) {
+            // Double free
+            m_root = Merge(Merge(lower, before), Merge(after, upper));
+            return false;
+        }
+
+        struct Node* extent;
+        if (before && before->start + before->count == start) {
+            extent = before;
+            extent->count += count;
+            before = nullptr;
+        } else if (!(extent = Acquire(start, count))) {
+            m_root = Merge(Merge(lower, before), Merge(after, upper));
+            return false;
+        }
+        if (after && after->start == start + count) {
+            extent->count += after->count;
+            Release(after);
+            after = nullptr;
+        }
+        Update(extent);
+        m_root = Merge(Merge(lower, before), Merge(Merge(extent, after), upper));
+        m_freeCount += count;
+        return true;
+    }
+
+    /**
+     * @brief Check whether a position is free.
+     *
+     */
+    bool IsFree(size_t pos) const
+    {
+        // Find the last extent starting at or before pos
+        const struct Node* node = m_root;
+        const struct Node* candidate = nullptr;
+        while (node) {
+            if (node->start <= pos) {
+                candidate = node;
+                node = node->right;
+            } else {
+                node = node->left;
+            }
+        }
+        return candidate && pos - candidate->start < candidate->count;
+    }
+
+    /**
+     * @brief Size of the largest free extent.
+     *
+     */
+    size_t Largest() const { return m_root ? m_root->largest : 0; }
+
+    /**
+     * @brief Number of free positions.
+     *
+     */
+    size_t FreeCount() const { return m_freeCount; }
+
+    /**
+     * @brief Number of free extents (nodes in use).
+     *
+     */
+    size_t Extents() const { return m_extents; }
+
+    /**
+     * @brief Returned by Allocate when no range fits.
+     *
+     */
+    static constexpr size_t npos = SIZE_MAX;
+
+private:
+    struct Node {
+        size_t start;
+        size_t count;
+        size_t largest;     // Largest count in this subtree
+        uint32_t priority;  // Heap order of the treap, which keeps it balanced
+        struct Node* left;
+        struct Node* right;
+    };
+
+    [[gnu::always_inline]] static size_t Largest(const struct Node* node) { return node ? node->largest : 0; }
+
+    static void Update(struct Node* node)
+    {
+        size_t largest = node->count;
+        if (Largest(node->left) > largest) {
+            largest = Largest(node->left);
+        }
+        if (Largest(node->right) > largest) {
+            largest = Largest(node->right);
+        }
+        node->largest = largest;
+    }
+
+    // Split a tree into extents starting before `start` and the rest
+    static void Split(struct Node* node, size_t start, struct Node** lower, struct Node** upper)
+    {
+        if (!node) {
+            *lower = *upper = nullptr;
+            return;
+        }
+        if (node->start < start) {
+            Split(node->right, start, &node->right, upper);
+            *lower = node;
+        } else {
+            Split(node->left, start, lower, &node->left);
+            *upper = node;
+        }
+        Update(node);
+    }
+
+    // Join two trees where every extent of `lower` comes before those of `upper`
+    static struct Node* Merge(struct Node* lower, struct Node* upper)
+    {
+        if (!lower) {
+            return upper;
+        }
+        if (!upper) {
+            return lower;
+        }
+        if (lower->priority > upper->priority) {
+            lower->right = Merge(lower->right, upper);
+            Update(lower);
+            return lower;
+        }
+        upper->left = Merge(lower, upper->left);
+        Update(upper);
+        return upper;
+    }
+
+    // Detach the first extent of a tree
+    static struct Node* TakeMin(struct Node** tree)
+    {
+        struct Node* node = *tree;
+        if (!node) {
+            return nullptr;
+        }
+        if (!node->left) {
+            *tree = node->right;
+            node->right = nullptr;
+            Update(node);
+            return node;
+        }
+        struct Node* min = TakeMin(&node->left);
+        Update(node);
+        return min;
+    }
+
+    // Detach the last extent of a tree
+    static struct Node* TakeMax(struct Node** tree)
+    {
+        struct Node* node = *tree;
+        if (!node) {
+            return nullptr;
+        }
+        if (!node->right) {
+            *tree = node->left;
+            node->left = nullptr;
+            Update(node);
+            return node;
+        }
+        struct Node* max = TakeMax(&node->right);
+        Update(node);
+        return max;
+    }
+
+    struct Node* Acquire(size_t start, size_t count)
+    {
+        struct Node* node = m_unused;
+        if (!node) {
+            return nullptr;
+        }
+        m_unused = node->left;
+        m_extents++;
+
+        // xorshift32
+        m_seed ^= m_seed << 13;
+        m_seed ^= m_seed >> 17;
+        m_seed ^= m_seed << 5;
+        node->start = start;
+        node->count = count;
+        node->largest = count;
+        node->priority = m_seed;
+        node->left = nullptr;
+        node->right = nullptr;
+        return node;
+    }
+
+    void Release(struct Node* node)
+    {
+        node->left = m_unused;
+        m_unused = node;
+        m_extents--;
+    }
+
+    struct Node* m_root;
+    struct Node* m_unused;  // Unused nodes, linked through `left`
+    uint32_t m_seed;
+    size_t m_extents;
+    size_t m_freeCount;
+    struct Node m_nodes[t_nodes];
+};
@@ -0,0 +1,356 @@
+/**
+ * @file SizeClassAllocator.hpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief General purpose allocator with segregated size classes. Small
+ * requests are rounded up to one of a handful of size classes, and every
+ * class carves whole pages into equally sized objects with a free list per
+ * page. Requests larger than the biggest class get their own run of pages.
+ * The owner of an object is always found from the header at the start of
+ * its page, so no per-object header is needed.
+ *
+ * The allocator does no locking of its own. Optional caches (e.g. one per
+ * task) hold a few free objects of every class and can be used without any
+ * lock by their single owner.
+ * @version 0.1
+ * @date 2022-03-23
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Size class allocator.
+ *
+ * @tparam t_pages Page source, providing `static void* Alloc(size_t count)`
+ * and `static void Free(void* pages, size_t count)`. Pages must be aligned
+ * to t_page_size.
+ * @tparam t_page_size Page size in bytes
+ */
+template<typename t_pages, size_t t_page_size = 4096>
+class SizeClassAllocator {
+public:
+    static constexpr size_t Alignment = 16;
+    static constexpr size_t ClassCount = 12;
+    static constexpr size_t MaxSmallSize = 1024;
+    static constexpr size_t CacheDepth = 8;
+
+    // Free objects owned by a single user (see CacheAlloc and CacheFree)
+    struct Cache {
+        size_t count[ClassCount];
+        void* objects[ClassCount][CacheDepth];
+    };
+
+    struct Stats {
+        size_t pages;       // Pages taken from the page source
+        size_t smallPages;  // ...of which hold small objects
+        size_t largeAllocs; // Live allocations larger than MaxSmallSize
+    };
+
+    SizeClassAllocator()
+        : m_stats {}
+    {
+        for (size_t i = 0; i < ClassCount; i++) {
+            m_partial[i] = nullptr;
+            m_spare[i] = nullptr;
+        }
+    }
+
+    /**
+     * @brief Size class index for a request, or ClassCount if the request
+     * is served directly from pages.
+     *
+     */
+    [[gnu::always_inline]] static size_t ClassFor(size_t size)
+    {
+        if (size > MaxSmallSize) {
+            return ClassCount;
+        }
+        return s_lookup.index[(size + Alignment - 1) / Alignment];
+    }
+
+    [[gnu::always_inline]] static size_t ClassSize(size_t cls) { return s_classSizes[cls]; }
+
+    /**
+     * @brief Allocate memory aligned to Alignment. If a cache is given and the
+     * request is small, a few extra objects are moved into the cache.
+     *
+     * @param size Requested size in bytes
+     * @param cache Cache of the caller (optional)
+     * @return void* Allocated memory, or nullptr if the page source is exhausted
+     */
+    void* Alloc(size_t size, Cache* cache = nullptr)
+    {
+        size_t cls = ClassFor(size);
+        if (cls == ClassCount) {
+            return AllocLarge(size);
+        }
+
+        void* object = AllocSmall(cls);
+        if (object && cache) {
+            void* extra;
+            while (cache->count[cls] < CacheDepth / 2 && (extra = AllocSmall(cls))) {
+                cache->objects[cls][cache->count[cls]++] = extra;
+            }
+        }
+        return object;
+    }
+
+    /**
+     * @brief Free memory returned by Alloc. If a cache is given and the object
+     * is small, it is kept in the cache (which gives half of its objects back
+     * when full).
+     *
+     * @param ptr Memory to free (nullptr is ignored)
+     * @param cache Cache of the caller (optional)
+     */
+    void Free(void* ptr, Cache* cache = nullptr)
+    {
+        if (!ptr) {
+            return;
+        }
+
+        struct Page* page = PageOf(ptr);
+        if (page->magic == LargeMagic) {
+            m_stats.pages -= page->count;
+            m_stats.largeAllocs--;
+            t_pages::Free(page, page->count);
+            return;
+        }
+
+        size_t cls = page->cls;
+        if (cache) {
+            if (cache->count[cls] == CacheDepth) {
+                while (cache->count[cls] > CacheDepth / 2) {
+                    FreeSmall(cache->objects[cls][--cache->count[cls]]);
+                }
+            }
+            cache->objects[cls][cache->count[cls]++] = ptr;
+            return;
+        }
+        FreeSmall(ptr);
+    }
+
+    /**
+     * @brief Number of usable bytes of an allocation.
+     *
+     */
+    static size_t UsableSize(void* ptr)
+    {
+        struct Page* page = PageOf(ptr);
+        if (page->magic == LargeMagic) {
+            return page->count * t_page_size - HeaderSize;
+        }
+        return s_classSizes[page->cls];
+    }
+
+    /**
+     * @brief Take an object from a cache. Doesn't touch the allocator, so no
+     * lock is needed as long as only the owner uses the cache.
+     *
+     * @return void* Object, or nullptr if the request is large or the cache
+     * has nothing of its class
+     */
+    static void* CacheAlloc(Cache* cache, size_t size)
+    {
+        size_t cls = ClassFor(size);
+        if (cls == ClassCount || cache->count[cls] == 0) {
+            return nullptr;
+        }
+        return cache->objects[cls][--cache->count[cls]];
+    }
+
+    /**
+     * @brief Put a small object into a cache. Doesn't touch the allocator.
+     *
+     * @return true The object was cached
+     * @return false The object is large or the cache is full (use Free)
+     */
+    static bool CacheFree(Cache* cache, void* ptr)
+    {
+        struct Page* page = PageOf(ptr);
+        if (page->magic != SmallMagic || cache->count[page->cls] == CacheDepth) {
+            return false;
+        }
+        cache->objects[page->cls][cache->count[page->cls]++] = ptr;
+        return true;
+    }
+
+    /**
+     * @brief Give every object in a cache back to the allocator.
+     *
+     */
+    void Flush(Cache* cache)
+    {
+        for (size_t cls = 0; cls < ClassCount; cls++) {
+            while (cache->count[cls]) {
+                FreeSmall(cache->objects[cls][--cache->count[cls]]);
+            }
+        }
+    }
+
+    const Stats& Statistics() const { return m_stats; }
+
+private:
+    static constexpr uint32_t SmallMagic = 0x534D4C4C; // "SMLL"
+    static constexpr uint32_t LargeMagic = 0x4C524745; // "LRGE"
+
+    // Header at the start of every page (or run of pages for large allocations)
+    struct Page {
+        uint32_t magic;
+        uint32_t cls;       // Size class (small pages)
+        size_t count;       // Pages in the run (large) or objects in use (small)
+        void* freeList;     // Free objects, linked through their first word (small)
+        struct Page* next;  // Neighbours in the partial list of the class (small)
+        struct Page* prev;
+    };
+
+    static constexpr size_t HeaderSize = (sizeof(struct Page) + Alignment - 1) & ~(Alignment - 1);
+
+    static constexpr size_t s_classSizes[ClassCount] = {
+        16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024,
+    };
+    static_assert(s_classSizes[ClassCount - 1] == MaxSmallSize);
+    static_assert(t_page_size - HeaderSize >= 2 * MaxSmallSize, "Pages must hold at least two of the largest objects");
+
+    // Maps (size / Alignment) rounded up to a size class
+    struct Lookup {
+        uint8_t index[MaxSmallSize / Alignment + 1];
+    };
+
+    static constexpr Lookup BuildLookup()
+    {
+        Lookup lookup {};
+        size_t cls = 0;
+        for (size_t i = 0; i <= MaxSmallSize / Alignment; i++) {
+            while (s_classSizes[cls] < i * Alignment) {
+                cls++;
+            }
+            lookup.index[i] = (uint8_t)cls;
+        }
+        return lookup;
+    }
+
+    static constexpr Lookup s_lookup = BuildLookup();
+
+    [[gnu::always_inline]] static struct Page* PageOf(void* ptr)
+    {
+        return (struct Page*)((uintptr_t)ptr & ~(uintptr_t)(t_page_size - 1));
+    }
+
+    void Link(size_t cls, struct Page* page)
+    {
+        page->prev = nullptr;
+        page->next = m_partial[cls];
+        if (page->next) {
+            page->next->prev = page;
+        }
+        m_partial[cls] = page;
+    }
+
+    void Unlink(size_t cls, struct Page* page)
+    {
+        if (page->prev) {
+            page->prev->next = page->next;
+        } else {
+            m_partial[cls] = page->next;
+        }
+        if (page->next) {
+            page->next->prev = page->prev;
+        }
+    }
+
+    struct Page* NewSmallPage(size_t cls)
+    {
+        struct Page* page = (struct Page*)t_pages::Alloc(1);
+        if (!page) {
+            return nullptr;
+        }
+        m_stats.pages++;
+        m_stats.smallPages++;
+
+        page->magic = SmallMagic;
+        page->cls = (uint32_t)cls;
+        page->count = 0;
+        page->freeList = nullptr;
+        size_t size = s_classSizes[cls];
+        uint8_t* objects = (uint8_t*)page + HeaderSize;
+        for (size_t i = (t_page_size - HeaderSize) / size; i-- > 0;) {
+            void* object = objects + (i * size);
+            *(void**)object = page->freeList;
+            page->freeList = object;
+        }
+        return page;
+    }
+
+    void* AllocSmall(size_t cls)
+    {
+        struct Page* page = m_partial[cls];
+        if (!page) {
+            if (m_spare[cls]) {
+                page = m_spare[cls];
+                m_spare[cls] = nullptr;
+            } else if (!(page = NewSmallPage(cls))) {
+                return nullptr;
+            }
+            Link(cls, page);
+        }
+
+        void* object = page->freeList;
+        page->freeList = *(void**)object;
+        page->count++;
+        if (!page->freeList) {
+            Unlink(cls, page);
+        }
+        return object;
+    }
+
+    void FreeSmall(void* ptr)
+    {
+        struct Page* page = PageOf(ptr);
+        size_t cls = page->cls;
+        if (!page->freeList) {
+            Link(cls, page);
+        }
+        *(void**)ptr = page->freeList;
+        page->freeList = ptr;
+
+        if (--page->count == 0) {
+            // Keep one empty page per class to avoid bouncing on the page source
+            Unlink(cls, page);
+            if (!m_spare[cls]) {
+                m_spare[cls] = page;
+                return;
+            }
+            m_stats.pages--;
+            m_stats.smallPages--;
+            t_pages::Free(page, 1);
+        }
+    }
+
+    void* AllocLarge(size_t size)
+    {
+        if (size > SIZE_MAX - HeaderSize - t_page_size) {
+            return nullptr;
+        }
+        size_t count = (size + HeaderSize + t_page_size - 1) / t_page_size;
+        struct Page* page = (struct Page*)t_pages::Alloc(count);
+        if (!page) {
+            return nullptr;
+        }
+        m_stats.pages += count;
+        m_stats.largeAllocs++;
+
+        page->magic = LargeMagic;
+        page->cls = ClassCount;
+        page->count = count;
+        return (uint8_t*)page + HeaderSize;
+    }
+
+    struct Page* m_partial[ClassCount];  // Pages with free objects, per class
+    struct Page* m_spare[ClassCount];    // One completely free page, per class
+    Stats m_stats;
+};
@@ -12,10 +12,21 @@
  *         https://www.oryx-embedded.com/doc/date__time_8c_source.html
  */
 #include <Devices/Clock/rtc.hpp>
+#include <Devices/Clock/tsc.hpp>
 #include <Library/time.hpp>
 
 namespace Time {
 
+void monotonicInit()
+{
+    TSC::init();
+}
+
+uint64_t monotonicNs()
+{
+    return TSC::nanoseconds();
+}
+
 TimeDescriptor::TimeDescriptor()
 {
     toDate();
@@ -16,6 +16,21 @@
 
 namespace Time {
 
+/**
+ * @brief Calibrates the monotonic clock. Must be called on the bootstrap
+ * processor with interrupts enabled.
+ *
+ */
+void monotonicInit();
+
+/**
+ * @brief Nanoseconds on a clock that never goes backwards. Cheap enough
+ * for scheduler accounting and safe to call from interrupt handlers.
+ * Returns zero until monotonicInit has been called.
+ *
+ */
+uint64_t monotonicNs();
+
 class TimeDescriptor {
 public:
     // Constructors
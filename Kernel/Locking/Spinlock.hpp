@@ -0,0 +1,98 @@
+/**
+ * @file Spinlock.hpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief Busy-waiting lock for data shared between processors. Unlike
+ * a Mutex, a spinlock never blocks the calling task, so it may be used
+ * with interrupts disabled and inside the scheduler itself.
+ * @version 0.1
+ * @date 2022-03-12
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ */
+#pragma once
+
+#include <Arch/Arch.hpp>
+#include <Arch/Memory.hpp>
+
+class Spinlock {
+public:
+    /**
+     * @brief Construct a new Spinlock object
+     *
+     * @param name Spinlock name (for debugging / printing)
+     */
+    constexpr Spinlock(const char* name = nullptr)
+        : m_isLocked(false)
+        , m_name(name)
+    {
+    }
+
+    /**
+     * @brief Aquire the spinlock, busy-waiting until it is available.
+     *
+     */
+    void lock()
+    {
+        while (__atomic_test_and_set(&m_isLocked, __ATOMIC_ACQUIRE)) {
+            // Spin on a plain load so that waiting processors don't
+            // bounce the cache line around with locked writes
+            while (__atomic_load_n(&m_isLocked, __ATOMIC_RELAXED)) {
+                Arch::Memory::pagingShootdownService();
+                Arch::CPU::relax();
+            }
+        }
+    }
+
+    /**
+     * @brief Try to aquire the spinlock and return immediately
+     * if already locked.
+     *
+     * @return bool Returns true on success.
+     */
+    bool tryLock()
+    {
+        return !__atomic_test_and_set(&m_isLocked, __ATOMIC_ACQUIRE);
+    }
+
+    /**
+     * @brief Release the spinlock.
+     *
+     */
+    void unlock()
+    {
+        __atomic_clear(&m_isLocked, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * @brief Spinlock name (for debugging / printing)
+     *
+     */
+    const char* name() const { return m_name; }
+
+private:
+    bool m_isLocked;
+    const char* m_name;
+};
+
+/**
+ * @brief Resource Acquisition Is Initialization spinlock. Locks when
+ * constructed and unlocks when destructed.
+ *
+ */
+class RAIISpinlock {
+public:
+    RAIISpinlock(Spinlock& lock)
+        : m_lock(lock)
+    {
+        m_lock.lock();
+    }
+
+    ~RAIISpinlock()
+    {
+        m_lock.unlock();
+    }
+
+private:
+    Spinlock& m_lock;
+};
@@ -11,6 +11,25 @@
 #include "Logger.hpp"
 #include <Bootloader/Arguments.hpp>
 #include <Library/stdio.hpp>
+#include <Library/string.hpp>
+#include <Library/time.hpp>
+#include <Scheduler/tasks.hpp>
+
+static_assert(LOGGER_MESSAGE_SLOTS < LOGGER_RING_SIZE, "A queued message must fit in the ring");
+
+// Text of a message being formatted into consecutive ring slots
+struct SlotText {
+    void* ring;
+    size_t pos;
+    size_t len;
+};
+
+static int countHelper(unsigned c, void** ptr)
+{
+    (void)c;
+    (*(size_t*)*ptr)++;
+    return 0;
+}
 
 const char* Logger::levelToString(LogLevel lvl)
 {
@@ -32,11 +51,141 @@ const char* Logger::levelToString(LogLevel lvl)
     }
 }
 
+int Logger::SlotTextHelper(unsigned c, void** ptr)
+{
+    struct SlotText* text = (struct SlotText*)*ptr;
+    struct Record* ring = (struct Record*)text->ring;
+    size_t slot = (text->pos + text->len / LOGGER_TEXT_SIZE) & (LOGGER_RING_SIZE - 1);
+    ring[slot].text[text->len % LOGGER_TEXT_SIZE] = (char)c;
+    text->len++;
+    return 0;
+}
+
 void Logger::LogHelper(const char* tag, LogLevel lvl, const char* fmt, va_list ap)
 {
-    RAIIMutex(the().m_logBufferMutex);
-    ksprintf(the().m_logBuffer, "[%-16s] %-22s %s\n", levelToString(lvl), tag, fmt);
-    LogHelperPrint(m_logBuffer, ap);
+    uint64_t timestamp = Time::monotonicNs();
+    size_t len = 0;
+    va_list measure;
+    va_copy(measure, ap);
+    printf_helper(fmt, measure, countHelper, &len);
+    va_end(measure);
+    size_t slots = len / LOGGER_TEXT_SIZE + 1;
+    if (slots > LOGGER_MESSAGE_SLOTS) {
+        // Too long to queue, so write it out right away (after whatever
+        // is queued, unless someone else is writing it out right now)
+        flush();
+        Print("[%5u.%06u] [%-16s] %-22s ",
+            (uint32_t)(timestamp / 1000000000ULL), (uint32_t)(timestamp % 1000000000ULL / 1000),
+            levelToString(lvl), tag);
+        LogHelperPrint(fmt, ap);
+        Print("\n");
+        return;
+    }
+
+    // Claim consecutive slots. A slot is free for position `pos` once its
+    // sequence equals `pos`, and holds a finished message once the sequence
+    // is `pos + 1`. The reader frees slots in order, so the whole run is free
+    // once its last slot is. This keeps the queue safe for any number of
+    // processors and interrupt handlers without taking a lock.
+    size_t pos = __atomic_load_n(&m_writePos, __ATOMIC_RELAXED);
+    for (;;) {
+        size_t last = pos + slots - 1;
+        struct Record* record = &m_ring[last & (LOGGER_RING_SIZE - 1)];
+        intptr_t diff = (intptr_t)__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) - (intptr_t)last;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&m_writePos, &pos, pos + slots, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The queue is full
+            __atomic_fetch_add(&m_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&m_writePos, __ATOMIC_RELAXED);
+        }
+    }
+
+    struct Record* record = &m_ring[pos & (LOGGER_RING_SIZE - 1)];
+    record->timestamp = timestamp;
+    record->tag = tag;
+    record->level = lvl;
+    record->slots = slots;
+    struct SlotText text = { m_ring, pos, 0 };
+    void* textPtr = &text;
+    printf_helper(fmt, ap, SlotTextHelper, textPtr);
+    SlotTextHelper('\0', &textPtr);
+    // The first slot is published last, which publishes the rest with it
+    for (size_t i = slots - 1; i > 0; i--) {
+        __atomic_store_n(&m_ring[(pos + i) & (LOGGER_RING_SIZE - 1)].sequence, pos + i + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&record->sequence, pos + 1, __ATOMIC_RELEASE);
+
+    if (!m_deferred) {
+        flush();
+    }
+}
+
+void Logger::Emit(const struct Record& record, const char* text)
+{
+    uint32_t seconds = (uint32_t)(record.timestamp / 1000000000ULL);
+    uint32_t micros = (uint32_t)(record.timestamp % 1000000000ULL / 1000);
+    Print("[%5u.%06u] [%-16s] %-22s %s\n", seconds, micros, levelToString(record.level), record.tag, text);
+}
+
+// Must be called with the drain lock held
+void Logger::Drain()
+{
+    for (;;) {
+        struct Record* slot = &m_ring[m_readPos & (LOGGER_RING_SIZE - 1)];
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != m_readPos + 1) {
+            break;
+        }
+        // Hand the slots back before writing so that producers aren't held up by slow writers
+        struct Record record = *slot;
+        for (size_t i = 0; i < record.slots; i++) {
+            struct Record* next = &m_ring[(m_readPos + i) & (LOGGER_RING_SIZE - 1)];
+            memcpy(&m_logBuffer[i * LOGGER_TEXT_SIZE], next->text, LOGGER_TEXT_SIZE);
+            __atomic_store_n(&next->sequence, m_readPos + i + LOGGER_RING_SIZE, __ATOMIC_RELEASE);
+        }
+        m_readPos += record.slots;
+        Emit(record, m_logBuffer);
+    }
+
+    size_t dropped = __atomic_load_n(&m_dropped, __ATOMIC_RELAXED);
+    if (dropped != m_droppedReported) {
+        Print("[%-16s] %-22s %zu messages dropped\n", levelToString(lWARNING), "Logger", dropped - m_droppedReported);
+        m_droppedReported = dropped;
+    }
+}
+
+void Logger::flush(bool force)
+{
+    Logger& logger = the();
+    if (force) {
+        logger.Drain();
+        return;
+    }
+
+    // Whoever already holds the lock writes out the messages queued in the meantime.
+    // Check again after unlocking so that a message queued right before the unlock
+    // isn't left behind.
+    while (logger.m_drainLock.tryLock()) {
+        logger.Drain();
+        logger.m_drainLock.unlock();
+        const struct Record& next = logger.m_ring[logger.m_readPos & (LOGGER_RING_SIZE - 1)];
+        if (__atomic_load_n(&next.sequence, __ATOMIC_ACQUIRE) != logger.m_readPos + 1) {
+            break;
+        }
+    }
+}
+
+void Logger::drainTask()
+{
+    the().m_deferred = true;
+    for (;;) {
+        flush();
+        tasks_nano_sleep(LOGGER_DRAIN_INTERVAL_NS);
+    }
 }
 
 void Logger::LogHelperPrint(const char* fmt, va_list ap)
@@ -48,6 +197,14 @@ void Logger::LogHelperPrint(const char* fmt, va_list ap)
     }
 }
 
+void Logger::Log(const Site& site, const char* tag, const char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    the().LogHelper(tag, site.level, fmt, ap);
+    va_end(ap);
+}
+
 void Logger::Trace(const char* tag, const char* fmt, ...)
 {
     if (lTRACE >= getLevel()) {
@@ -145,22 +302,118 @@ Logger& Logger::the()
 }
 
 Logger::Logger()
-    : m_logBufferMutex("Logger")
+    : m_drainLock("Logger")
+    , m_deferred(false)
+    , m_writePos(0)
+    , m_readPos(0)
+    , m_dropped(0)
+    , m_droppedReported(0)
     , m_writersIdx(0)
-#if defined(RELEASE)
-    , m_logLevel(lINFO)
-#elif defined(DEBUG)
-    , m_logLevel(lDEBUG)
-#endif
+    , m_logLevel((LogLevel)LOGGER_DEFAULT_LEVEL)
+{
+    for (size_t i = 0; i < LOGGER_RING_SIZE; i++) {
+        m_ring[i].sequence = i;
+    }
+}
+
+// Call site descriptor table (see LOGGER_REGISTER_SITE)
+extern Logger::Site* _LOGSITES_START[0];
+extern Logger::Site* _LOGSITES_END[0];
+
+static void refreshSite(Logger::Site* site, Logger::LogLevel level)
+{
+    site->enabled = site->override > 0 || (site->override == 0 && site->level >= level);
+}
+
+void Logger::setLevel(LogLevel level)
+{
+    the().m_logLevel = level;
+    for (Site** site = _LOGSITES_START; site < _LOGSITES_END; site++) {
+        refreshSite(*site, level);
+    }
+}
+
+size_t Logger::UpdateSites(const char* match, int8_t override)
+{
+    size_t count = 0;
+    for (Site** entry = _LOGSITES_START; entry < _LOGSITES_END; entry++) {
+        Site* site = *entry;
+        if (strcmp(site->function, match) != 0 && !strstr(site->file, match)) {
+            continue;
+        }
+        site->override = override;
+        refreshSite(site, getLevel());
+        count++;
+    }
+
+    return count;
+}
+
+size_t Logger::enable(const char* match)
+{
+    return UpdateSites(match, 1);
+}
+
+size_t Logger::disable(const char* match)
+{
+    return UpdateSites(match, -1);
+}
+
+size_t Logger::restore(const char* match)
 {
-    // Default constructor
+    return UpdateSites(match, 0);
 }
 
-// Kernel argument callback
-static void argumentCallback(const char* lvl)
+// Copies the next comma separated word of a kernel argument value. Returns
+// the position after the word, or nullptr if there are no more words.
+static const char* nextWord(const char* value, char* word, size_t size)
 {
-    // FIXME: Update kernel argument parser to handle `=`
-    (void)lvl;
+    if (*value == '\0' || *value == ' ') {
+        return nullptr;
+    }
+    size_t len = 0;
+    while (*value && *value != ' ' && *value != ',') {
+        if (len < size - 1) {
+            word[len++] = *value;
+        }
+        value++;
+    }
+    word[len] = '\0';
+    return *value == ',' ? value + 1 : value;
+}
+
+// Kernel argument callbacks
+static void levelCallback(const char* value)
+{
+    static const char* names[] = { "trace", "debug", "verbose", "info", "warning", "error", "none" };
+    char word[MAX_ARGUMENT_LEN];
+    if (!nextWord(value, word, sizeof(word))) {
+        return;
+    }
+    for (size_t lvl = 0; lvl < sizeof(names) / sizeof(names[0]); lvl++) {
+        if (strcmp(word, names[lvl]) == 0) {
+            Logger::setLevel((Logger::LogLevel)lvl);
+            return;
+        }
+    }
+}
+
+static void enableCallback(const char* value)
+{
+    char word[MAX_ARGUMENT_LEN];
+    while ((value = nextWord(value, word, sizeof(word)))) {
+        Logger::enable(word);
+    }
+}
+
+static void disableCallback(const char* value)
+{
+    char word[MAX_ARGUMENT_LEN];
+    while ((value = nextWord(value, word, sizeof(word)))) {
+        Logger::disable(word);
+    }
 }
 
-KERNEL_PARAM(logLevelArg, "--log-level=", argumentCallback);
+KERNEL_PARAM(logLevelArg, "--log-level=", levelCallback);
+KERNEL_PARAM(logEnableArg, "--log-enable=", enableCallback);
+KERNEL_PARAM(logDisableArg, "--log-disable=", disableCallback);
@@ -10,28 +10,111 @@
  */
 #pragma once
 #include <stdarg.h>
-#include <Locking/Mutex.hpp>
-#include <Locking/RAII.hpp>
+#include <stddef.h>
+#include <stdint.h>
+#include <Locking/Spinlock.hpp>
+
+#define LOGGER_RING_SIZE 256                        // Must be a power of two
+#define LOGGER_TEXT_SIZE 96                         // Message text held by each ring slot
+#define LOGGER_MESSAGE_SLOTS 8                      // Slots a queued message may span (longer ones are written right away)
+#define LOGGER_DRAIN_INTERVAL_NS (10ULL * 1000 * 1000)
+
+#define LOGGER_LEVEL_TRACE 0
+#define LOGGER_LEVEL_DEBUG 1
+#define LOGGER_LEVEL_VERBOSE 2
+#define LOGGER_LEVEL_INFO 3
+#define LOGGER_LEVEL_WARNING 4
+#define LOGGER_LEVEL_ERROR 5
+#define LOGGER_LEVEL_NONE 6
+
+// Messages below the compile time floor are removed entirely (including the
+// evaluation of their arguments). The build mode sets LOGGER_MIN_LEVEL and a
+// translation unit may raise its own floor by defining LOGGER_TU_MIN_LEVEL
+// before including any header.
+#ifndef LOGGER_MIN_LEVEL
+#   if defined(RELEASE)
+#       define LOGGER_MIN_LEVEL LOGGER_LEVEL_INFO
+#   else
+#       define LOGGER_MIN_LEVEL LOGGER_LEVEL_TRACE
+#   endif
+#endif
+
+#if defined(LOGGER_TU_MIN_LEVEL) && LOGGER_TU_MIN_LEVEL > LOGGER_MIN_LEVEL
+#   define LOGGER_FLOOR LOGGER_TU_MIN_LEVEL
+#else
+#   define LOGGER_FLOOR LOGGER_MIN_LEVEL
+#endif
+
+// Runtime level until changed (e.g. with --log-level=)
+#if defined(RELEASE)
+#   define LOGGER_DEFAULT_LEVEL LOGGER_LEVEL_INFO
+#else
+#   define LOGGER_DEFAULT_LEVEL LOGGER_LEVEL_DEBUG
+#endif
+
+// Records the address of a call site descriptor in the .logsites table. The
+// descriptor itself can't be placed in the section directly because GCC won't
+// mix statics of inline functions (COMDAT) with regular ones in one section.
+// Inlined copies of a call site add duplicate entries, which is harmless.
+#define LOGGER_REGISTER_SITE(site)                                              \
+    asm(".pushsection .logsites, \"aw\"\n"                                       \
+        ".balign %c1\n"                                                          \
+        ".dc.a %c0\n"                                                            \
+        ".popsection" :: "i"(&(site)), "i"(sizeof(void*)))
+
+// The discarded branch is still type and format checked, but emits no code.
+// Enabled call sites cost a single load and branch.
+#define LOGGER_LOG(level, tag, fmt, ...)                                        \
+    do {                                                                        \
+        if constexpr ((level) >= LOGGER_FLOOR) {                                \
+            static struct Logger::Site loggerSite = {                           \
+                __FILE__, __func__, (Logger::LogLevel)(level),                  \
+                0, (level) >= LOGGER_DEFAULT_LEVEL,                             \
+            };                                                                  \
+            LOGGER_REGISTER_SITE(loggerSite);                                   \
+            if (loggerSite.enabled)                                             \
+                Logger::Log(loggerSite, tag, fmt, ##__VA_ARGS__);               \
+        }                                                                       \
+    } while (0)
+
+#define LOG_TRACE(tag, fmt, ...) LOGGER_LOG(LOGGER_LEVEL_TRACE, tag, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(tag, fmt, ...) LOGGER_LOG(LOGGER_LEVEL_DEBUG, tag, fmt, ##__VA_ARGS__)
+#define LOG_VERBOSE(tag, fmt, ...) LOGGER_LOG(LOGGER_LEVEL_VERBOSE, tag, fmt, ##__VA_ARGS__)
+#define LOG_INFO(tag, fmt, ...) LOGGER_LOG(LOGGER_LEVEL_INFO, tag, fmt, ##__VA_ARGS__)
+#define LOG_WARNING(tag, fmt, ...) LOGGER_LOG(LOGGER_LEVEL_WARNING, tag, fmt, ##__VA_ARGS__)
+#define LOG_ERROR(tag, fmt, ...) LOGGER_LOG(LOGGER_LEVEL_ERROR, tag, fmt, ##__VA_ARGS__)
 
 class Logger
 {
 public:
 
 enum LogLevel {
-    lTRACE,
-    lDEBUG,
-    lVERBOSE,
-    lINFO,
-    lWARNING,
-    lERROR,
-    lNone,
+    lTRACE = LOGGER_LEVEL_TRACE,
+    lDEBUG = LOGGER_LEVEL_DEBUG,
+    lVERBOSE = LOGGER_LEVEL_VERBOSE,
+    lINFO = LOGGER_LEVEL_INFO,
+    lWARNING = LOGGER_LEVEL_WARNING,
+    lERROR = LOGGER_LEVEL_ERROR,
+    lNone = LOGGER_LEVEL_NONE,
 };
 
 typedef int (*LogWriter)(const char* fmt, va_list args);
 
+// Per call site state (one for every LOG_* use)
+struct Site {
+    const char* file;
+    const char* function;
+    LogLevel level;
+    int8_t override;    // 1 forced on, -1 forced off, 0 follows the global level
+    bool enabled;       // The only thing checked at the call site
+};
+
 Logger(Logger const&) = delete;
 void operator=(Logger const&) = delete;
 
+// Prefer the LOG_* macros, which skip the call (and argument evaluation)
+// for levels below the compile time floor and for disabled call sites
+[[gnu::format(printf, 3, 4)]] static void Log(const Site& site, const char* tag, const char* fmt, ...);
 [[gnu::format(printf, 2, 3)]] static void Trace(const char* tag, const char* fmt, ...);
 [[gnu::format(printf, 2, 3)]] static void Verbose(const char* tag, const char* fmt, ...);
 [[gnu::format(printf, 2, 3)]] static void Debug(const char* tag, const char* fmt, ...);
@@ -40,24 +123,95 @@ void operator=(Logger const&) = delete;
 [[gnu::format(printf, 2, 3)]] static void Error(const char* tag, const char* fmt, ...);
 [[gnu::format(printf, 1, 2)]] static void Print(const char* fmt, ...);
 
+/**
+ * @brief Write out every queued message now. Messages are normally written
+ * by the logger task (see drainTask), so this is only needed when that
+ * task may never run again.
+ *
+ * @param force Don't wait for whoever is currently writing messages. Only
+ * for when nothing else will run anymore (e.g. panic).
+ */
+static void flush(bool force = false);
+
+/**
+ * @brief Task that writes queued messages in the background. Until it
+ * runs, messages are written as soon as they are logged.
+ *
+ */
+static void drainTask();
+
+/**
+ * @brief Number of messages discarded because the queue was full.
+ *
+ */
+static size_t dropped() { return __atomic_load_n(&the().m_dropped, __ATOMIC_RELAXED); }
+
 static bool addWriter(LogWriter writer);
 static bool removeWriter(LogWriter writer);
-static void setLevel(LogLevel level) { the().m_logLevel = level; }
+static void setLevel(LogLevel level);
 static LogLevel getLevel() { return the().m_logLevel; }
 
+/**
+ * @brief Force call sites on regardless of the global level. Only call sites
+ * above the compile time floor exist, so e.g. Trace messages can only be
+ * enabled in builds that keep them.
+ *
+ * @param match Function name (tag) or part of a file path (e.g. "paging.cpp")
+ * @return size_t Number of call sites changed
+ */
+static size_t enable(const char* match);
+
+/**
+ * @brief Force call sites off regardless of the global level.
+ *
+ * @param match Function name (tag) or part of a file path
+ * @return size_t Number of call sites changed
+ */
+static size_t disable(const char* match);
+
+/**
+ * @brief Make call sites follow the global level again.
+ *
+ * @param match Function name (tag) or part of a file path
+ * @return size_t Number of call sites changed
+ */
+static size_t restore(const char* match);
+
 static Logger& the();
 
 private:
+    // A queued message, formatted when it is logged. Longer messages continue
+    // into the `text` of the slots after the first one, which only uses its
+    // other fields.
+    struct Record {
+        size_t sequence;    // Slot ownership (see LogHelper)
+        uint64_t timestamp;
+        const char* tag;
+        LogLevel level;
+        size_t slots;       // Slots the message spans, starting with this one
+        char text[LOGGER_TEXT_SIZE];
+    };
+
     Logger();
     const char* levelToString(LogLevel lvl);
     void LogHelper(const char* tag, LogLevel lvl, const char* fmt, va_list args);
     void LogHelperPrint(const char* fmt, va_list args);
+    void Emit(const struct Record& record, const char* text);
+    static int SlotTextHelper(unsigned c, void** ptr);
+    static size_t UpdateSites(const char* match, int8_t override);
+    void Drain();
 
     static const uint8_t m_maxWriterCount = 2;
-    static const uint32_t m_maxBufferSize = 1024;
-    Mutex m_logBufferMutex;
+    static const uint32_t m_maxBufferSize = LOGGER_MESSAGE_SLOTS * LOGGER_TEXT_SIZE;
+    Spinlock m_drainLock;   // Held by whoever is writing out messages
+    bool m_deferred;
+    size_t m_writePos;
+    size_t m_readPos;
+    size_t m_dropped;
+    size_t m_droppedReported;
     size_t m_writersIdx;
     LogLevel m_logLevel;
     LogWriter m_writers[m_maxWriterCount];
-    char m_logBuffer[m_maxBufferSize];
+    char m_logBuffer[m_maxBufferSize];   // Text of the message being written out
+    struct Record m_ring[LOGGER_RING_SIZE];
 };
@@ -0,0 +1,25 @@
+/**
+ * @file MapFlags.hpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief Virtual memory mapping flags
+ * @version 0.1
+ * @date 2022-03-24
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ */
+#pragma once
+
+namespace Memory::Virtual {
+
+enum MapFlags
+{
+    NONE = 0,
+    READ_ONLY = 1,
+    USERMODE = 2,
+    WRITE_THROUGH = 4,
+    CACHE_DISABLE = 8,
+    WRITE_COMBINING = 16,   // Buffer writes into bursts (e.g. framebuffers). Overrides the cache flags.
+};
+
+} // !namespace Memory::Virtual
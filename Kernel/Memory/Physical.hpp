@@ -10,9 +10,14 @@
  */
 #pragma once
 
+#include <Arch/Arch.hpp>
 #include <Arch/Memory.hpp>
-#include <Library/Bitset.hpp>
+#include <Library/Buddy.hpp>
+#include <Locking/Spinlock.hpp>
+#include <Memory/MemoryMap.hpp>
 #include <Memory/MemorySection.hpp>
+#include <Library/time.hpp>
+#include <Support/sections.hpp>
 #include <Logger.hpp>
 #include <Panic.hpp>
 #include <stddef.h>
@@ -20,9 +25,11 @@
 
 #define KADDR_TO_PHYS(addr) ((addr) - KERNEL_BASE)
 
+#define PHYS_MAX_ORDER 10   // Largest contiguous allocation is 2^10 pages (4 MiB)
+#define PHYS_DEFERRED_RUNS 64   // Separate runs of pages reserved before the allocator is active
+
 namespace Memory::Physical {
 
-// FIXME: Mutex lock all of these operations
 class Manager {
 public:
     Manager(Manager const&) = delete;
@@ -34,16 +41,31 @@ public:
         return instance;
     }
 
+    /**
+     * @brief Size the frame allocator to the installed memory and pick the
+     * physical pages that will hold its bitmaps. No frames can be allocated
+     * until paging has mapped those pages and called activate. Pages
+     * reserved in the meantime are remembered and reserved on activation.
+     *
+     * @param map Memory map from the bootloader
+     */
     static void initialize(MemoryMap& map)
     {
         // populate the physical memory map based on bootloader information
         size_t freeMegabytes = 0;
         size_t reservedMegabytes = 0;
+        size_t frames = 0;
 
         for (size_t i = 0; i < map.Count(); i++) {
             auto section = map.Get(i);
+            if (section.initialized() && (section.type() == Available || isReclaimable(section))) {
+                // Counted in pages, since the end of the last section can be 4 GiB
+                size_t end = ADDRESS_TO_PAGE_IDX(section.base()) + section.pages();
+                if (end > frames) {
+                    frames = end;
+                }
+            }
             if (section.initialized() && section.type() == Available) {
-                setFree(section);
                 freeMegabytes += B_TO_MB(section.size());
                 continue;
             }
@@ -51,23 +73,128 @@ public:
             reservedMegabytes += B_TO_MB(section.size());
         }
 
-        Logger::Info(__func__, "Available memory: %zu MB", freeMegabytes);
-        Logger::Info(__func__, "Reserved memory: %zu MB", reservedMegabytes);
-        Logger::Info(__func__, "Total memory: %zu MB", freeMegabytes + reservedMegabytes);
+        // Only frames up to the end of the highest available (or reclaimable)
+        // section are managed
+        frames = (frames + ((size_t)1 << PHYS_MAX_ORDER) - 1) & ~(((size_t)1 << PHYS_MAX_ORDER) - 1);
+        if (frames > MEM_BITMAP_SIZE) {
+            frames = MEM_BITMAP_SIZE;
+        }
+        Manager& manager = the();
+        manager.m_map = map;
+        manager.m_numFrames = frames;
+        manager.m_storage = findStorage(map, Frames::StorageWords(frames) * sizeof(size_t));
+
+        LOG_INFO(__func__, "Available memory: %zu MB", freeMegabytes);
+        LOG_INFO(__func__, "Reserved memory: %zu MB", reservedMegabytes);
+        LOG_INFO(__func__, "Total memory: %zu MB", freeMegabytes + reservedMegabytes);
+        LOG_INFO(__func__, "Frame bitmaps: %zu KiB for %zu frames", B_TO_KB(manager.m_storage.size()), frames);
+    }
+
+    /**
+     * @brief Physical pages picked by initialize for the frame bitmaps.
+     * Paging maps them and passes the mapping to activate.
+     *
+     */
+    static Section storage()
+    {
+        return the().m_storage;
+    }
+
+    /**
+     * @brief Start handing out frames. Every available section is freed,
+     * then the pages reserved since initialize (including the bitmap pages
+     * themselves, once paging has mapped them) are taken back out. Both
+     * work on whole runs, so this takes time proportional to the number of
+     * memory map entries rather than the amount of memory.
+     *
+     * @param storage Virtual address of the pages returned by storage()
+     */
+    static void activate(void* storage)
+    {
+        uint64_t start = Time::monotonicNs();
+        Manager& manager = the();
+        uintptr_t flags = Arch::CPU::interruptsSave();
+        manager.m_lock.lock();
+        manager.m_frames.Init(manager.m_numFrames, (size_t*)storage);
+        for (size_t i = 0; i < manager.m_map.Count(); i++) {
+            auto section = manager.m_map.Get(i);
+            if (section.initialized() && section.type() == Available) {
+                manager.m_frames.Free(ADDRESS_TO_PAGE_IDX(section.base()), section.pages());
+            }
+        }
+        for (size_t i = 0; i < manager.m_deferredCount; i++) {
+            manager.m_frames.ReserveRange(manager.m_deferred[i].first, manager.m_deferred[i].end - manager.m_deferred[i].first);
+        }
+        manager.m_deferredCount = 0;
+        manager.m_active = true;
+        manager.m_lock.unlock();
+        Arch::CPU::interruptsRestore(flags);
+        if (manager.m_deferredWasted) {
+            LOG_WARNING(__func__, "%zu extra frames stay reserved (too many runs reserved early)", manager.m_deferredWasted);
+        }
+        LOG_INFO(__func__, "%zu free frames, ready in %Lu us", manager.m_frames.FreeCount(), (Time::monotonicNs() - start) / 1000);
+    }
+
+    /**
+     * @brief Give the memory the bootloader and the firmware's ACPI tables
+     * were using back to the allocator. Must only be called once nothing
+     * reads the bootloader structures anymore (the handoff copies what the
+     * kernel keeps while parsing) and after activate. The first MiB stays
+     * reserved, since the kernel keeps it identity mapped for its own use.
+     *
+     */
+    static void reclaim()
+    {
+        Manager& manager = the();
+        size_t reclaimed[2] = { 0, 0 };
+        if (!manager.m_active) {
+            panic("Reclaiming memory before the frame allocator is active!");
+        }
+        uintptr_t flags = Arch::CPU::interruptsSave();
+        manager.m_lock.lock();
+        for (size_t i = 0; i < manager.m_map.Count(); i++) {
+            auto section = manager.m_map.Get(i);
+            if (!section.initialized() || !isReclaimable(section)) {
+                continue;
+            }
+            size_t first = ADDRESS_TO_PAGE_IDX(Arch::Memory::pageAlignUp(section.base()));
+            size_t end = ADDRESS_TO_PAGE_IDX(section.base()) + section.pages();
+            if (first < ADDRESS_TO_PAGE_IDX(EARLY_KERNEL_START)) {
+                first = ADDRESS_TO_PAGE_IDX(EARLY_KERNEL_START);
+            }
+            if (end > manager.m_numFrames) {
+                end = manager.m_numFrames;
+            }
+            if (first >= end) {
+                continue;
+            }
+            manager.m_frames.Free(first, end - first);
+            reclaimed[section.type() == ACPI] += end - first;
+        }
+        manager.m_lock.unlock();
+        Arch::CPU::interruptsRestore(flags);
+
+        LOG_INFO(__func__, "Reclaimed %zu MB of bootloader memory and %zu MB of ACPI memory",
+            KB_TO_MB(reclaimed[0] * B_TO_KB(ARCH_PAGE_SIZE)), KB_TO_MB(reclaimed[1] * B_TO_KB(ARCH_PAGE_SIZE)));
     }
 
     // TODO: Make private (start)
 
     [[gnu::always_inline]] static void setFree(Section& sect)
     {
-        for (size_t i = 0; i < sect.pages(); i++) {
-            setFree(sect.base() + (i * ARCH_PAGE_SIZE));
+        uintptr_t flags = Arch::CPU::interruptsSave();
+        the().m_lock.lock();
+        size_t count = sect.pages();
+        if (the().clamp(ADDRESS_TO_PAGE_IDX(sect.base()), count)) {
+            the().m_frames.Free(ADDRESS_TO_PAGE_IDX(sect.base()), count);
         }
+        the().m_lock.unlock();
+        Arch::CPU::interruptsRestore(flags);
     }
 
     [[gnu::always_inline]] static void setUsed(Section& sect)
     {
-        Logger::Debug(
+        LOG_DEBUG(
             __func__,
             "0x%08zX-0x%08zX 0x%08zX [%zu] [%s]",
             sect.base(),
@@ -75,41 +202,61 @@ public:
             sect.size(),
             sect.pages(),
             sect.typeString());
-        // TODO: Optimize bitmap library to take number of bits to set
-        for (size_t i = 0; i < sect.pages(); i++) {
-            setUsed(ADDRESS_TO_PAGE_IDX(sect.base()) + i);
-        }
+        uintptr_t flags = Arch::CPU::interruptsSave();
+        the().m_lock.lock();
+        the().reserve(ADDRESS_TO_PAGE_IDX(sect.base()), sect.pages());
+        the().m_lock.unlock();
+        Arch::CPU::interruptsRestore(flags);
     }
 
     [[gnu::always_inline]] static void setFree(Arch::Memory::Address addr)
     {
-        the().m_memory.Clear(ADDRESS_TO_PAGE_IDX(addr));
+        setFree(addr.val());
     }
 
     [[gnu::always_inline]] static void setUsed(Arch::Memory::Address addr)
     {
-        the().m_memory.Set(ADDRESS_TO_PAGE_IDX(addr));
+        setUsed(addr.val());
     }
 
     [[gnu::always_inline]] static void setFree(uintptr_t addr)
     {
-        the().m_memory.Clear(ADDRESS_TO_PAGE_IDX(addr));
+        uintptr_t flags = Arch::CPU::interruptsSave();
+        the().m_lock.lock();
+        size_t count = 1;
+        if (the().clamp(ADDRESS_TO_PAGE_IDX(addr), count)) {
+            the().m_frames.Free(ADDRESS_TO_PAGE_IDX(addr), count);
+        }
+        the().m_lock.unlock();
+        Arch::CPU::interruptsRestore(flags);
     }
 
     [[gnu::always_inline]] static void setUsed(uintptr_t addr)
     {
-        the().m_memory.Set(ADDRESS_TO_PAGE_IDX(addr));
+        uintptr_t flags = Arch::CPU::interruptsSave();
+        the().m_lock.lock();
+        the().reserve(ADDRESS_TO_PAGE_IDX(addr), 1);
+        the().m_lock.unlock();
+        Arch::CPU::interruptsRestore(flags);
     }
 
     [[gnu::always_inline]] static bool isFree(uintptr_t addr)
     {
-        return the().m_memory.Test(ADDRESS_TO_PAGE_IDX(addr)) == 0;
+        uintptr_t flags = Arch::CPU::interruptsSave();
+        the().m_lock.lock();
+        // Frames that aren't managed (such as MMIO) are never free
+        size_t count = 1;
+        bool free = the().clamp(ADDRESS_TO_PAGE_IDX(addr), count)
+            && the().m_frames.IsFree(ADDRESS_TO_PAGE_IDX(addr));
+        the().m_lock.unlock();
+        Arch::CPU::interruptsRestore(flags);
+        return free;
     }
 
     [[gnu::always_inline]] static bool isFree(Section& sect)
     {
         for (size_t i = 0; i < sect.pages(); i++) {
-            if (!isFree(sect.base()) + (i * ARCH_PAGE_SIZE)) {
+            if (!isFree(sect.base() + (i * ARCH_PAGE_SIZE))) {
                 return false;
             }
         }
@@ -119,6 +266,55 @@ public:
 
     // TODO: Make private (end)
 
+    /**
+     * @brief Allocate physically contiguous page frames. Runs of up to
+     * 2^PHYS_MAX_ORDER pages are supported and are aligned to the next
+     * power of two of the page count.
+     *
+     * @param count Number of contiguous pages
+     * @return uintptr_t Physical address of the first page, or npos if
+     * no contiguous run of that size is available (or the allocator isn't
+     * active yet)
+     */
+    [[gnu::always_inline]] static uintptr_t allocPages(size_t count)
+    {
+        uintptr_t flags = Arch::CPU::interruptsSave();
+        the().m_lock.lock();
+        size_t frame = the().m_active ? the().m_frames.Alloc(count) : Frames::npos;
+        the().m_lock.unlock();
+        Arch::CPU::interruptsRestore(flags);
+        if (frame == Frames::npos) {
+            return npos;
+        }
+
+        return PAGE_IDX_TO_ADDRESS(frame);
+    }
+
+    /**
+     * @brief Return physically contiguous page frames to the allocator.
+     *
+     * @param physAddr Physical address of the first page
+     * @param count Number of contiguous pages
+     */
+    [[gnu::always_inline]] static void freePages(uintptr_t physAddr, size_t count)
+    {
+        uintptr_t flags = Arch::CPU::interruptsSave();
+        the().m_lock.lock();
+        bool managed = the().clamp(ADDRESS_TO_PAGE_IDX(physAddr), count);
+        bool doubleFree = false;
+        for (size_t i = 0; managed && i < count && !doubleFree; i++) {
+            doubleFree = the().m_frames.IsFree(ADDRESS_TO_PAGE_IDX(physAddr) + i);
+        }
+        if (managed && !doubleFree) {
+            the().m_frames.Free(ADDRESS_TO_PAGE_IDX(physAddr), count);
+        }
+        the().m_lock.unlock();
+        Arch::CPU::interruptsRestore(flags);
+        // Not under the lock, since drawing the panic may fault in pages
+        if (doubleFree) {
+            panicf("Double free of physical page 0x%08zX", physAddr);
+        }
+    }
 
     /**
      * @brief Return the next available physical page address
@@ -127,14 +323,12 @@ public:
      */
     [[gnu::always_inline]] static uintptr_t getPage()
     {
-        uintptr_t pAddr = findNextFreePhysicalAddress();
+        uintptr_t pAddr = allocPages(1);
         if (pAddr == npos) {
             panic("Out of memory!");
         }
 
-        // Convert a frame index to physical address
-        setUsed(PAGE_IDX_TO_ADDRESS(pAddr));
-        return PAGE_IDX_TO_ADDRESS(pAddr);
+        return pAddr;
     }
 
     /**
@@ -144,25 +338,160 @@ public:
      */
     [[gnu::always_inline]] static void freePage(uintptr_t physAddr)
     {
-        setFree(physAddr);
+        freePages(physAddr, 1);
     }
 
-    // FIXME: Doesn't return an address -- returns a frame index
-    [[gnu::always_inline]] static uintptr_t findNextFreePhysicalAddress()
+    /**
+     * @brief Number of free page frames.
+     *
+     */
+    [[gnu::always_inline]] static size_t freeCount()
     {
-        return the().m_memory.FindFirstBit(false);
+        return the().m_frames.FreeCount();
     }
 
     static const size_t npos = SIZE_MAX;
 
 private:
-    Bitset<MEM_BITMAP_SIZE> m_memory;
+    // Sized to the installed memory by initialize
+    typedef Buddy<0, PHYS_MAX_ORDER> Frames;
+
+    struct Run {
+        size_t first;
+        size_t end;     // One past the last frame
+    };
+
+    Frames m_frames;
+    // Taken with interrupts disabled, since the page fault handler
+    // allocates frames (see Memory::newPageLazy)
+    Spinlock m_lock;
+    bool m_active;
+    size_t m_numFrames;
+    Section m_storage;
+    MemoryMap m_map;
+    struct Run m_deferred[PHYS_DEFERRED_RUNS];  // Sorted, and neither overlapping nor touching
+    size_t m_deferredCount;
+    size_t m_deferredWasted;    // Free frames reserved to make room in m_deferred
 
     Manager()
-        : m_memory(1)
+        : m_lock("physical")
+        , m_active(false)
+        , m_numFrames(0)
+        , m_deferredCount(0)
+        , m_deferredWasted(0)
     {
         // Always assume memory is reserved until proven otherwise
     }
+
+    [[gnu::always_inline]] static bool isReclaimable(Section& section)
+    {
+        return section.type() == Bootloader || section.type() == ACPI;
+    }
+
+    // Lowest available pages above the kernel image that can hold `size` bytes
+    static Section findStorage(MemoryMap& map, size_t size)
+    {
+        size = Arch::Memory::pageAlignUp(size);
+        uintptr_t kernelEnd = Arch::Memory::pageAlignUp(KADDR_TO_PHYS(KERNEL_END));
+        for (size_t i = 0; i < map.Count(); i++) {
+            auto section = map.Get(i);
+            if (!section.initialized() || section.type() != Available) {
+                continue;
+            }
+            uintptr_t base = Arch::Memory::pageAlignUp(section.base() > kernelEnd ? section.base() : kernelEnd);
+            uintptr_t last = section.base() + (section.pages() * ARCH_PAGE_SIZE) - 1;
+            if (base <= last && last - base >= size - 1) {
+                return Section(base, size);
+            }
+        }
+
+        panic("No memory for the frame bitmaps!");
+    }
+
+    // Trim a run of frames to the ones managed by the allocator, returning false
+    // if none are. MMIO such as the framebuffer or the local APIC is reserved
+    // like memory but usually lies above the highest managed frame.
+    bool clamp(size_t first, size_t& count) const
+    {
+        if (first >= m_numFrames) {
+            return false;
+        }
+        if (count > m_numFrames - first) {
+            count = m_numFrames - first;
+        }
+        return count != 0;
+    }
+
+    // Must be called with the lock held. Before activation the pages are
+    // remembered instead. Only the parts in available sections are kept,
+    // since activate doesn't free anything else.
+    void reserve(size_t first, size_t count)
+    {
+        if (!clamp(first, count)) {
+            return;
+        }
+        if (m_active) {
+            m_frames.ReserveRange(first, count);
+            return;
+        }
+        for (size_t i = 0; i < m_map.Count(); i++) {
+            auto section = m_map.Get(i);
+            if (!section.initialized() || section.type() != Available) {
+                continue;
+            }
+            size_t start = ADDRESS_TO_PAGE_IDX(section.base());
+            size_t end = start + section.pages();
+            start = first > start ? first : start;
+            end = first + count < end ? first + count : end;
+            if (start < end) {
+                defer(start, end);
+            }
+        }
+    }
+
+    // Add [first, end) to the deferred runs, merged with every run it overlaps
+    // or touches. Once the list is full, the closest run is stretched to cover
+    // it instead, which keeps the frames in between reserved but never fails.
+    void defer(size_t first, size_t end)
+    {
+        size_t idx = 0;
+        while (idx < m_deferredCount && m_deferred[idx].end < first) {
+            idx++;
+        }
+        if (idx < m_deferredCount && m_deferred[idx].first <= end) {
+            struct Run* run = &m_deferred[idx];
+            run->first = first < run->first ? first : run->first;
+            run->end = end > run->end ? end : run->end;
+            size_t next = idx + 1;
+            while (next < m_deferredCount && m_deferred[next].first <= run->end) {
+                run->end = m_deferred[next].end > run->end ? m_deferred[next].end : run->end;
+                next++;
+            }
+            size_t merged = next - idx - 1;
+            for (size_t i = next; i < m_deferredCount; i++) {
+                m_deferred[i - merged] = m_deferred[i];
+            }
+            m_deferredCount -= merged;
+            return;
+        }
+        if (m_deferredCount == PHYS_DEFERRED_RUNS) {
+            size_t before = idx > 0 ? first - m_deferred[idx - 1].end : SIZE_MAX;
+            size_t after = idx < m_deferredCount ? m_deferred[idx].first - end : SIZE_MAX;
+            if (before <= after) {
+                m_deferred[idx - 1].end = end;
+                m_deferredWasted += before;
+            } else {
+                m_deferred[idx].first = first;
+                m_deferredWasted += after;
+            }
+            return;
+        }
+        for (size_t i = m_deferredCount; i > idx; i--) {
+            m_deferred[i] = m_deferred[i - 1];
+        }
+        m_deferred[idx] = { .first = first, .end = end };
+        m_deferredCount++;
+    }
 };
 
 }
@@ -0,0 +1,277 @@
+/**
+ * @file Slab.cpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief Object caches for fixed size kernel objects
+ * @version 0.1
+ * @date 2022-03-22
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ */
+#include <Library/LinkedList.hpp>
+#include <Memory/Slab.hpp>
+#include <Memory/heap.hpp>
+#include <Memory/paging.hpp>
+#include <Logger.hpp>
+
+namespace Memory {
+
+static SlabCache* caches = nullptr;
+static Spinlock cachesLock("slab caches");
+
+template<typename T>
+static void link(T** list, T* slab)
+{
+    slab->prev = nullptr;
+    slab->next = *list;
+    if (*list) {
+        (*list)->prev = slab;
+    }
+    *list = slab;
+}
+
+template<typename T>
+static void unlink(T** list, T* slab)
+{
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+// Must be called with the cache lock held
+void* SlabCache::slabAlloc()
+{
+    struct Slab* slab = m_partial;
+    if (!slab) {
+        if (!(slab = m_empty)) {
+            return nullptr;
+        }
+        unlink(&m_empty, slab);
+        m_emptyCount--;
+        link(&m_partial, slab);
+    }
+
+    void* object = slab->freeList;
+    slab->freeList = *(void**)object;
+    slab->inUse++;
+    if (!slab->freeList) {
+        unlink(&m_partial, slab);
+        link(&m_full, slab);
+    }
+    return object;
+}
+
+// Must be called with the cache lock held. Returns true if the object's slab
+// is now completely free and was taken off the lists so that its page can be
+// released.
+bool SlabCache::slabFree(void* object)
+{
+    struct Slab* slab = (struct Slab*)Arch::Memory::pageAlign((uintptr_t)object);
+    if (!slab->freeList) {
+        unlink(&m_full, slab);
+        link(&m_partial, slab);
+    }
+    *(void**)object = slab->freeList;
+    slab->freeList = object;
+
+    if (--slab->inUse == 0) {
+        unlink(&m_partial, slab);
+        if (m_emptyCount >= SLAB_MAX_EMPTY) {
+            m_slabs--;
+            return true;
+        }
+        link(&m_empty, slab);
+        m_emptyCount++;
+    }
+    return false;
+}
+
+bool SlabCache::grow()
+{
+    // Pages come from the paging code, which sleeps on a mutex, so this
+    // must happen without the cache lock or interrupts disabled
+    struct Slab* slab = (struct Slab*)Memory::newPage(1);
+    if (!slab) {
+        return false;
+    }
+
+    // Thread the free list through the objects
+    uint8_t* objects = (uint8_t*)slab + m_offset;
+    slab->freeList = nullptr;
+    slab->inUse = 0;
+    for (size_t i = m_capacity; i-- > 0;) {
+        void* object = objects + (i * m_stride);
+        *(void**)object = slab->freeList;
+        slab->freeList = object;
+    }
+
+    uintptr_t flags = Arch::CPU::interruptsSave();
+    m_lock.lock();
+    link(&m_empty, slab);
+    m_emptyCount++;
+    m_slabs++;
+    m_lock.unlock();
+    Arch::CPU::interruptsRestore(flags);
+
+    if (!__atomic_test_and_set(&m_registered, __ATOMIC_RELAXED)) {
+        RAIISpinlock lock(cachesLock);
+        m_nextCache = caches;
+        caches = this;
+    }
+    return true;
+}
+
+// Must be called with the cache lock held
+void SlabCache::refill(struct Magazine* magazine)
+{
+    void* object;
+    while (magazine->count < SLAB_MAGAZINE_SIZE / 2 && (object = slabAlloc())) {
+        magazine->objects[magazine->count++] = object;
+    }
+}
+
+void* SlabCache::alloc()
+{
+    for (;;) {
+        uintptr_t flags = Arch::CPU::interruptsSave();
+        struct Magazine* magazine = &m_magazines[Arch::CPU::id()];
+        if (magazine->count) {
+            magazine->hits++;
+        } else {
+            m_lock.lock();
+            refill(magazine);
+            m_lock.unlock();
+        }
+
+        if (magazine->count) {
+            void* object = magazine->objects[--magazine->count];
+            magazine->allocs++;
+            Arch::CPU::interruptsRestore(flags);
+            if (m_ctor) {
+                m_ctor(object);
+            }
+            return object;
+        }
+
+        Arch::CPU::interruptsRestore(flags);
+        if (!grow()) {
+            return nullptr;
+        }
+    }
+}
+
+void SlabCache::free(void* object)
+{
+    if (!object) {
+        return;
+    }
+
+    uintptr_t flags = Arch::CPU::interruptsSave();
+    struct Magazine* magazine = &m_magazines[Arch::CPU::id()];
+    struct Slab* release = nullptr;
+    if (magazine->count == SLAB_MAGAZINE_SIZE) {
+        // Give half of the magazine back to the slabs
+        m_lock.lock();
+        while (magazine->count > SLAB_MAGAZINE_SIZE / 2) {
+            void* returned = magazine->objects[--magazine->count];
+            if (slabFree(returned)) {
+                struct Slab* slab = (struct Slab*)Arch::Memory::pageAlign((uintptr_t)returned);
+                slab->next = release;
+                release = slab;
+            }
+        }
+        m_lock.unlock();
+    } else {
+        magazine->hits++;
+    }
+    magazine->objects[magazine->count++] = object;
+    magazine->frees++;
+    Arch::CPU::interruptsRestore(flags);
+
+    while (release) {
+        struct Slab* slab = release;
+        release = slab->next;
+        if (Arch::CPU::interruptsWereEnabled(flags)) {
+            Memory::freePage(slab, 1);
+            continue;
+        }
+        // Freeing pages may sleep, so keep the slab around instead
+        flags = Arch::CPU::interruptsSave();
+        m_lock.lock();
+        link(&m_empty, slab);
+        m_emptyCount++;
+        m_slabs++;
+        m_lock.unlock();
+        Arch::CPU::interruptsRestore(flags);
+    }
+}
+
+SlabCache::Stats SlabCache::stats()
+{
+    Stats stats = {
+        .objectSize = m_size,
+        .objectsPerSlab = m_capacity,
+        .slabs = m_slabs,
+        .inUse = 0,
+        .allocs = 0,
+        .frees = 0,
+        .magazineHits = 0,
+    };
+    for (size_t cpu = 0; cpu < ARCH_MAX_CPUS; cpu++) {
+        stats.allocs += m_magazines[cpu].allocs;
+        stats.frees += m_magazines[cpu].frees;
+        stats.magazineHits += m_magazines[cpu].hits;
+    }
+    stats.inUse = stats.allocs - stats.frees;
+    return stats;
+}
+
+void SlabCache::report()
+{
+    RAIISpinlock lock(cachesLock);
+    for (SlabCache* cache = caches; cache; cache = cache->m_nextCache) {
+        Stats stats = cache->stats();
+        LOG_INFO(__func__, "%s: %zu x %zu bytes in use, %zu slabs (%zu per slab), %zu allocs, %zu frees, %zu magazine hits",
+            cache->name(), stats.inUse, stats.objectSize, stats.slabs, stats.objectsPerSlab,
+            stats.allocs, stats.frees, stats.magazineHits);
+    }
+}
+
+} // !namespace Memory
+
+namespace LinkedList {
+
+// Linked list nodes are small and come and go often, so they get size classes
+static Memory::SlabCache nodeCaches[] = {
+    { "list-node-16", 16 },
+    { "list-node-32", 32 },
+    { "list-node-64", 64 },
+};
+
+void* allocateNode(size_t size)
+{
+    for (Memory::SlabCache& cache : nodeCaches) {
+        if (size <= cache.objectSize()) {
+            return cache.alloc();
+        }
+    }
+    return malloc(size);
+}
+
+void freeNode(void* node, size_t size)
+{
+    for (Memory::SlabCache& cache : nodeCaches) {
+        if (size <= cache.objectSize()) {
+            cache.free(node);
+            return;
+        }
+    }
+    free(node);
+}
+
+} // !namespace LinkedList
@@ -0,0 +1,144 @@
+/**
+ * @file Slab.hpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief Object caches for fixed size kernel objects. Each cache carves
+ * pages into equally sized objects and keeps a small stack of free objects
+ * per processor (a magazine), so most allocations and frees touch neither
+ * the general heap nor a shared lock.
+ * @version 0.1
+ * @date 2022-03-22
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ * References:
+ *     https://www.usenix.org/legacy/publications/library/proceedings/bos94/bonwick.html
+ *     https://www.usenix.org/legacy/event/usenix01/full_papers/bonwick/bonwick.pdf
+ *
+ */
+#pragma once
+
+#include <Arch/Arch.hpp>
+#include <Arch/Memory.hpp>
+#include <Locking/Spinlock.hpp>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SLAB_MAGAZINE_SIZE 16   // Free objects kept per processor
+#define SLAB_MAX_EMPTY 1        // Completely free pages kept per cache
+
+namespace Memory {
+
+class SlabCache {
+public:
+    typedef void (*Constructor)(void* object);
+
+    struct Stats {
+        size_t objectSize;
+        size_t objectsPerSlab;
+        size_t slabs;           // Pages owned by the cache
+        size_t inUse;           // Objects handed out and not freed yet
+        size_t allocs;
+        size_t frees;
+        size_t magazineHits;    // Allocations and frees that didn't take the cache lock
+    };
+
+    /**
+     * @brief Construct a new object cache. No memory is allocated until the
+     * first object is.
+     *
+     * @param name Cache name (for statistics)
+     * @param size Object size in bytes (must fit in a page)
+     * @param align Object alignment (power of two)
+     * @param ctor Called on every object before it is handed out (optional)
+     */
+    constexpr SlabCache(const char* name, size_t size, size_t align = sizeof(void*), Constructor ctor = nullptr)
+        : m_name(name)
+        , m_ctor(ctor)
+        , m_size(size)
+        , m_stride(alignUp(size < sizeof(void*) ? sizeof(void*) : size, align))
+        , m_offset(alignUp(sizeof(struct Slab), align))
+        , m_capacity((ARCH_PAGE_SIZE - alignUp(sizeof(struct Slab), align)) / m_stride)
+        , m_lock(name)
+        , m_partial(nullptr)
+        , m_full(nullptr)
+        , m_empty(nullptr)
+        , m_emptyCount(0)
+        , m_slabs(0)
+        , m_registered(false)
+        , m_nextCache(nullptr)
+        , m_magazines {}
+    {
+    }
+
+    /**
+     * @brief Allocate an object. May allocate a page, so it must not be
+     * called from an interrupt handler.
+     *
+     * @return void* Object, or nullptr if no memory is available
+     */
+    void* alloc();
+
+    /**
+     * @brief Return an object to the cache. Safe with interrupts disabled.
+     *
+     * @param object Object returned by alloc (nullptr is ignored)
+     */
+    void free(void* object);
+
+    /**
+     * @brief Gather the cache statistics.
+     *
+     */
+    Stats stats();
+
+    const char* name() const { return m_name; }
+    size_t objectSize() const { return m_size; }
+
+    /**
+     * @brief Log the statistics of every cache that has allocated memory.
+     *
+     */
+    static void report();
+
+private:
+    // Header at the start of every page owned by a cache
+    struct Slab {
+        struct Slab* next;
+        struct Slab* prev;
+        void* freeList;     // Free objects (the link is kept in the object)
+        size_t inUse;
+    };
+
+    struct Magazine {
+        size_t count;
+        void* objects[SLAB_MAGAZINE_SIZE];
+        size_t allocs;
+        size_t frees;
+        size_t hits;
+    };
+
+    static constexpr size_t alignUp(size_t value, size_t align) { return (value + align - 1) & ~(align - 1); }
+
+    void* slabAlloc();
+    bool slabFree(void* object);
+    bool grow();
+    void refill(struct Magazine* magazine);
+
+    const char* m_name;
+    Constructor m_ctor;
+    size_t m_size;
+    size_t m_stride;
+    size_t m_offset;        // Offset of the first object in a slab
+    size_t m_capacity;      // Objects per slab
+    Spinlock m_lock;        // Protects the slab lists
+    struct Slab* m_partial;
+    struct Slab* m_full;
+    struct Slab* m_empty;
+    size_t m_emptyCount;
+    size_t m_slabs;
+    bool m_registered;
+    SlabCache* m_nextCache;
+    struct Magazine m_magazines[ARCH_MAX_CPUS];
+};
+
+} // !namespace Memory
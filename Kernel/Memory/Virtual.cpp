@@ -1,4 +1,6 @@
 #include "Virtual.hpp"
+#include <Memory/paging.hpp>
+#include <Library/string.hpp>
 #include <Locking/RAII.hpp>
 #include <Panic.hpp>
 
@@ -9,20 +11,20 @@ void* Manager::map(uintptr_t vaddr, size_t size, enum MapFlags flags)
     size = B_TO_PAGES(size);
     if (vaddr == npos) {
         // Automatically find the next available location
-        vaddr = findFirstFreePageRange(size);
+        vaddr = Memory::reserveVirtualRange(size);
     } else {
         // Attempt to map at the requested location
-        if (vaddr < m_rangeStart || vaddr + size > m_rangeEnd) {
-            return nullptr;
-        }
-        if (!isPageRangeFree(vaddr, size)) {
+        if (vaddr < m_rangeStart || vaddr + (size * ARCH_PAGE_SIZE) > m_rangeEnd) {
             return nullptr;
         }
+        vaddr = Memory::reserveVirtualRange(size, vaddr);
+    }
+    if (!vaddr) {
+        return nullptr;
     }
 
     for (uintptr_t i = 0; i < size; i++) {
-        mapPhysicalToVirtual(Physical::Manager::the().getPage(), vaddr, flags);
-        vaddr += ARCH_PAGE_SIZE;
+        mapPhysicalToVirtual(Physical::Manager::the().getPage(), vaddr + (i * ARCH_PAGE_SIZE), flags);
     }
 
     return (void*)vaddr;
@@ -30,8 +32,22 @@ void* Manager::map(uintptr_t vaddr, size_t size, enum MapFlags flags)
 
 void Manager::unmap(void* addr, size_t size)
 {
-    (void)addr;
-    (void)size;
+    uintptr_t vaddr = Arch::Memory::pageAlign((uintptr_t)addr);
+    size = B_TO_PAGES(size);
+    TLBFlushBatch batch;
+    for (uintptr_t i = 0; i < size; i++) {
+        Arch::Memory::Address page(vaddr + (i * ARCH_PAGE_SIZE));
+        Arch::Memory::Address paddr;
+        if (!virtualToPhysical(page, paddr)) {
+            continue;
+        }
+        Arch::Memory::Table& table = getTable(page.virtualAddress().dirIndex);
+        memset(&table.entries[page.virtualAddress().tableIndex], 0, sizeof(struct Arch::Memory::TableEntry));
+        Physical::Manager::freePage(paddr.val());
+        batch.add(page.val());
+    }
+    batch.flush();
+    Memory::releaseVirtualRange(vaddr, size);
 }
 
 void Manager::mapPhysicalToVirtual(uintptr_t paddr, uintptr_t vaddr, enum MapFlags flags)
@@ -55,6 +71,7 @@ void Manager::mapPhysicalToVirtual(uintptr_t paddr, uintptr_t vaddr, enum MapFla
             .accessed = 0,
             .ignoredA = 0,
             .size = 0,
+            .global = 0,
             .ignoredB = 0,
             .tableAddr = Arch::Memory::Address(Physical::Manager::getPage()).page().pageAddr
         };
@@ -92,6 +109,12 @@ void Manager::mapPhysicalToVirtual(uintptr_t paddr, uintptr_t vaddr, enum MapFla
     if (flags & CACHE_DISABLE) {
         tableEntry.cacheDisable = 1;
     }
+    if (flags & WRITE_COMBINING) {
+        // Page attribute table entry 4 (see Arch::Memory::pagingEnableWriteCombining)
+        tableEntry.writeThrough = 0;
+        tableEntry.cacheDisable = 0;
+        tableEntry.pageAttrTable = 1;
+    }
 }
 
 void Manager::initDirectory()
@@ -104,14 +127,15 @@ void Manager::initDirectory()
 
     // recursively map the last page table to the page directory
     m_directory.entries[ARCH_PAGE_TABLE_ENTRIES - 1] = {
-        .present = 0,
-        .readWrite = 0,
+        .present = 1,
+        .readWrite = 1,
         .usermode = 0,
         .writeThrough = 0,
         .cacheDisable = 0,
         .accessed = 0,
         .ignoredA = 0,
         .size = 0,
+        .global = 0,
         .ignoredB = 0,
         .tableAddr = paddrDir.page().pageAddr,
     };
@@ -126,110 +150,6 @@ Arch::Memory::Table& Manager::getTable(size_t directoryIndex)
     return *((Arch::Memory::Table*)tableAddr);
 }
 
-uintptr_t Manager::findFirstFreePageRange(size_t range)
-{
-    // FIXME: Handle edge cases where the start and end values are not aligned to the start of a page table
-
-    size_t freeRange = 0;
-    Arch::Memory::Address freeRangeAddress(npos);
-    Arch::Memory::Address startAddr(m_searchStart);
-    Arch::Memory::Address endAddr(m_rangeEnd);
-    Logger::Debug(__func__, "Start: 0x%0zX, Size: 0x%0zX, End: 0x%0zX", (size_t)startAddr.val(), m_rangeSize, (size_t)endAddr.val());
-    for (uint32_t dirIdx = startAddr.virtualAddress().dirIndex; dirIdx < endAddr.virtualAddress().dirIndex; dirIdx++) {
-        Logger::Debug(__func__, "Enter directory (%zu)", dirIdx);
-        Arch::Memory::DirectoryEntry& dirEntry = m_directory.entries[dirIdx];
-        if (!dirEntry.present) {
-            Logger::Debug(__func__, "Directory (idx: %zu) not present", dirIdx);
-            if (freeRange == 0) {
-                freeRangeAddress = Arch::Memory::Address(Arch::Memory::VirtualAddress {
-                    .offset = 0,
-                    .tableIndex = 0,
-                    .dirIndex = dirIdx,
-                });
-            }
-
-            freeRange += ARCH_PAGE_TABLE_ENTRIES;
-            if (freeRange >= range) {
-                // Implicit conversion to uintptr_t
-                return freeRangeAddress;
-            }
-
-            continue;
-        }
-
-        // Always start at 0, unless this is the first iteration inside the directory entries, in which case
-        // we want to start on the page table index correlating to the startAddr.
-        uint32_t tableIdxStart = 0;
-        if (dirIdx == startAddr.virtualAddress().dirIndex) {
-            tableIdxStart = startAddr.virtualAddress().tableIndex;
-        }
-
-        Logger::Debug(__func__, "tableIdxStart: %zu", tableIdxStart);
-        Arch::Memory::Table& table = getTable(dirIdx);
-        for (uint32_t tableIdx = tableIdxStart; tableIdx < ARCH_PAGE_TABLE_ENTRIES; tableIdx++) {
-            // TODO: Make this able to return before the end of a page table (see TODO at start of function)
-
-            Logger::Debug(__func__, "Enter table (%zu)", tableIdx);
-            Arch::Memory::TableEntry& tableEntry = table.entries[tableIdx];
-            if (!tableEntry.present) {
-                Logger::Debug(__func__, "Table (idx: %zu) not present", tableIdx);
-                if (freeRange == 0) {
-                    freeRangeAddress = Arch::Memory::Address(Arch::Memory::VirtualAddress {
-                        .offset = 0,
-                        .tableIndex = tableIdx,
-                        .dirIndex = dirIdx,
-                    });
-                }
-
-                if (++freeRange >= range) {
-                    // Implicit conversion to uintptr_t
-                    return freeRangeAddress;
-                }
-
-                continue;
-            }
-
-            // Loop into next table entry. Nothing free here.
-            freeRange = 0;
-        }
-
-        // Loop into next directry entry. Nothing free here.
-    }
-
-    // Absolutely nothing free in this directory.
-    return npos;
-}
-
-bool Manager::isPageFree(Arch::Memory::Address vaddr)
-{
-    vaddr = Arch::Memory::pageAlign(vaddr);
-    Arch::Memory::DirectoryEntry& dirEntry = m_directory.entries[vaddr.virtualAddress().dirIndex];
-    if (!dirEntry.present) {
-        return false;
-    }
-
-    Arch::Memory::Table& table = getTable(vaddr.virtualAddress().dirIndex);
-    Arch::Memory::TableEntry& tableEntry = table.entries[vaddr.virtualAddress().tableIndex];
-    if (!tableEntry.present) {
-        return false;
-    }
-
-    return true;
-}
-
-bool Manager::isPageRangeFree(Arch::Memory::Address vaddr, size_t size)
-{
-    size = Arch::Memory::pageAlignUp(size);
-    vaddr = Arch::Memory::pageAlign(vaddr);
-    for (uintptr_t page = vaddr; page < vaddr + size; page += ARCH_PAGE_SIZE) {
-        if (!isPageFree(page)) {
-            return false;
-        }
-    }
-
-    return true;
-}
-
 bool Manager::virtualToPhysical(Arch::Memory::Address vaddr, Arch::Memory::Address& result)
 {
     // Assume page directory is mapped in
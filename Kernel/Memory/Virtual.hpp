@@ -10,20 +10,12 @@
  */
 #pragma once
 #include <Arch/Memory.hpp>
+#include <Memory/MapFlags.hpp>
 #include <Memory/Physical.hpp>
 #include <Locking/Mutex.hpp>
 
 namespace Memory::Virtual {
 
-enum MapFlags
-{
-    NONE = 0,
-    READ_ONLY = 1,
-    USERMODE = 2,
-    WRITE_THROUGH = 4,
-    CACHE_DISABLE = 8,
-};
-
 class Manager {
 public:
     Manager(Arch::Memory::Directory& dir, uintptr_t rangeStart, size_t rangeSize)
@@ -31,7 +23,6 @@ public:
         , m_rangeStart(rangeStart)
         , m_rangeSize(rangeSize)
         , m_rangeEnd(rangeStart + rangeSize)
-        , m_searchStart(rangeStart)
     {
         // Default constructor
     }
@@ -41,7 +32,7 @@ public:
         , m_directory(dir)
         , m_rangeStart(rangeStart)
         , m_rangeSize(rangeSize)
-        , m_searchStart(rangeStart)
+        , m_rangeEnd(rangeStart + rangeSize)
     {
         // Named lock constructor
     }
@@ -57,14 +48,10 @@ protected:
     size_t m_rangeStart;
     size_t m_rangeSize;
     size_t m_rangeEnd;
-    size_t m_searchStart;
 
     void initDirectory();
     void mapPhysicalToVirtual(uintptr_t paddr, uintptr_t vaddr, enum MapFlags flags = NONE);
     Arch::Memory::Table& getTable(size_t directoryIndex);
-    uintptr_t findFirstFreePageRange(size_t range);
-    bool isPageFree(Arch::Memory::Address vaddr);
-    bool isPageRangeFree(Arch::Memory::Address vaddr, size_t size);
     bool virtualToPhysical(Arch::Memory::Address vaddr, Arch::Memory::Address& result);
 };
 
@@ -1,72 +1,434 @@
 /**
  * @file heap.cpp
  * @author Keeton Feavel (keetonfeavel@cedarville.edu)
- * @brief Liballoc heap implementation
- * @version 0.1
+ * @brief Kernel heap implementation
+ * @version 0.2
  * @date 2021-08-24
  *
  * @copyright Copyright the Xyris Contributors (c) 2021
  *
  */
-#include <Library/errno.hpp>
-#include <Locking/Mutex.hpp>
+#include <Bootloader/Arguments.hpp>
+#include <Devices/Serial/rs232.hpp>
+#include <Library/SizeClassAllocator.hpp>
+#include <Library/string.hpp>
+#include <Library/time.hpp>
+#include <Locking/RAII.hpp>
+#include <Locking/Spinlock.hpp>
 #include <Memory/heap.hpp>
 #include <Memory/paging.hpp>
+#include <Scheduler/tasks.hpp>
+#include <Logger.hpp>
 #include <stddef.h>
+#include <stdint.h>
+
+struct KernelPages {
+    static void* Alloc(size_t count)
+    {
+        return Memory::newPageMustSucceed(count * ARCH_PAGE_SIZE - 1);
+    }
+
+    static void Free(void* pages, size_t count)
+    {
+        Memory::freePage(pages, count * ARCH_PAGE_SIZE - 1);
+    }
+};
+
+typedef SizeClassAllocator<KernelPages, ARCH_PAGE_SIZE> KernelHeap;
+
+struct heap_cache {
+    KernelHeap::Cache objects;
+};
 
 static Mutex lock("alloc");
+static KernelHeap heap;
+
+static inline KernelHeap::Cache* taskCache()
+{
+    struct task* current = tasks_current();
+    return (current && current->heap_cache) ? &current->heap_cache->objects : NULL;
+}
+
+#ifdef HEAP_PROFILE
+
+#define HEAP_PROFILE_SITES 256      // Distinct call sites (power of two)
+#define HEAP_PROFILE_LIVE 4096      // Live allocations tracked at once (power of two)
+#define HEAP_PROFILE_INTERVAL 30    // Default seconds between periodic dumps
+
+namespace Profile {
+
+struct Site {
+    uintptr_t caller;       // Return address of the allocation (0 if unused)
+    size_t allocs;
+    size_t frees;
+    size_t liveBytes;
+    size_t peakBytes;
+    uint64_t lifetimeNs;    // Total lifetime of the freed allocations
+};
+
+struct Live {
+    uintptr_t ptr;          // 0 if unused
+    size_t size;
+    uint64_t time;
+    struct Site* site;
+};
+
+static struct Site sites[HEAP_PROFILE_SITES];
+static struct Site overflow;                    // Call sites that didn't fit
+static struct Live live[HEAP_PROFILE_LIVE];
+static size_t liveCount;
+static size_t liveBytes;
+static size_t peakBytes;
+static size_t untracked;                        // Allocations made while the live table was full
+static Spinlock lock("heap profile");
+static uint64_t interval = HEAP_PROFILE_INTERVAL;
+
+// Copy of the sites taken for dumping, so that nothing is printed with the lock held
+static struct Site snapshot[HEAP_PROFILE_SITES];
+static uint16_t order[HEAP_PROFILE_SITES];
+static Spinlock dumpLock("heap profile dump");
+
+static inline size_t hash(uintptr_t value)
+{
+    return (size_t)((value >> 4) * 2654435761u);
+}
+
+static struct Site* siteFor(uintptr_t caller)
+{
+    size_t idx = hash(caller) & (HEAP_PROFILE_SITES - 1);
+    for (size_t probe = 0; probe < HEAP_PROFILE_SITES; probe++) {
+        if (sites[idx].caller == caller) {
+            return &sites[idx];
+        }
+        if (sites[idx].caller == 0) {
+            sites[idx].caller = caller;
+            return &sites[idx];
+        }
+        idx = (idx + 1) & (HEAP_PROFILE_SITES - 1);
+    }
+    return &overflow;
+}
+
+static void recordAlloc(void* ptr, size_t size, void* caller)
+{
+    if (!ptr) {
+        return;
+    }
+
+    uintptr_t flags = Arch::CPU::interruptsSave();
+    lock.lock();
+    struct Site* site = siteFor((uintptr_t)caller);
+    site->allocs++;
+    // Keep the table sparse enough for short probe sequences
+    if (liveCount < HEAP_PROFILE_LIVE / 4 * 3) {
+        size_t idx = hash((uintptr_t)ptr) & (HEAP_PROFILE_LIVE - 1);
+        while (live[idx].ptr) {
+            idx = (idx + 1) & (HEAP_PROFILE_LIVE - 1);
+        }
+        live[idx] = { (uintptr_t)ptr, size, Time::monotonicNs(), site };
+        liveCount++;
+        site->liveBytes += size;
+        if (site->liveBytes > site->peakBytes) {
+            site->peakBytes = site->liveBytes;
+        }
+        liveBytes += size;
+        if (liveBytes > peakBytes) {
+            peakBytes = liveBytes;
+        }
+    } else {
+        untracked++;
+    }
+    lock.unlock();
+    Arch::CPU::interruptsRestore(flags);
+}
+
+static void recordFree(void* ptr)
+{
+    uintptr_t flags = Arch::CPU::interruptsSave();
+    lock.lock();
+    size_t idx = hash((uintptr_t)ptr) & (HEAP_PROFILE_LIVE - 1);
+    while (live[idx].ptr && live[idx].ptr != (uintptr_t)ptr) {
+        idx = (idx + 1) & (HEAP_PROFILE_LIVE - 1);
+    }
+
+    if (live[idx].ptr) {
+        struct Site* site = live[idx].site;
+        site->frees++;
+        site->liveBytes -= live[idx].size;
+        site->lifetimeNs += Time::monotonicNs() - live[idx].time;
+        liveBytes -= live[idx].size;
+        liveCount--;
+
+        // Shift later entries of the probe sequence back into the hole, so no
+        // tombstones are needed
+        size_t hole = idx;
+        for (size_t next = (hole + 1) & (HEAP_PROFILE_LIVE - 1); live[next].ptr; next = (next + 1) & (HEAP_PROFILE_LIVE - 1)) {
+            size_t home = hash(live[next].ptr) & (HEAP_PROFILE_LIVE - 1);
+            if (((next - home) & (HEAP_PROFILE_LIVE - 1)) >= ((next - hole) & (HEAP_PROFILE_LIVE - 1))) {
+                live[hole] = live[next];
+                hole = next;
+            }
+        }
+        live[hole].ptr = 0;
+    }
+    lock.unlock();
+    Arch::CPU::interruptsRestore(flags);
+}
+
+// When forced (from a panic), the lock may be held by a recording this
+// processor interrupted, so the tables are copied without it if need be.
+static void dump(bool force)
+{
+    uintptr_t flags = Arch::CPU::interruptsSave();
+    bool locked = true;
+    if (force) {
+        locked = lock.tryLock();
+    } else {
+        lock.lock();
+    }
+    size_t totalLive = liveBytes;
+    size_t totalPeak = peakBytes;
+    size_t totalUntracked = untracked;
+    size_t count = 0;
+    for (size_t i = 0; i < HEAP_PROFILE_SITES; i++) {
+        if (sites[i].caller) {
+            snapshot[count++] = sites[i];
+        }
+    }
+    if (overflow.allocs) {
+        snapshot[count++] = overflow;
+    }
+    if (locked) {
+        lock.unlock();
+    }
+    Arch::CPU::interruptsRestore(flags);
+
+    // Largest live bytes first, then largest peak
+    for (size_t i = 0; i < count; i++) {
+        size_t j = i;
+        const struct Site& site = snapshot[i];
+        while (j > 0) {
+            const struct Site& prev = snapshot[order[j - 1]];
+            if (prev.liveBytes > site.liveBytes || (prev.liveBytes == site.liveBytes && prev.peakBytes >= site.peakBytes)) {
+                break;
+            }
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = (uint16_t)i;
+    }
+
+    RS232::printf("heap profile: %zu bytes live, %zu bytes peak, %zu untracked allocations\n",
+        totalLive, totalPeak, totalUntracked);
+    RS232::printf("    caller       allocs      frees       live       peak  avg life (ms)\n");
+    for (size_t i = 0; i < count; i++) {
+        const struct Site& site = snapshot[order[i]];
+        uint32_t lifetimeMs = site.frees ? (uint32_t)(site.lifetimeNs / site.frees / 1000000) : 0;
+        RS232::printf("    0x%08zx %10zu %10zu %10zu %10zu %14u\n",
+            (size_t)site.caller, site.allocs, site.frees, site.liveBytes, site.peakBytes, (unsigned)lifetimeMs);
+    }
+}
+
+static void intervalCallback(const char* value)
+{
+    uint64_t seconds = 0;
+    while (*value >= '0' && *value <= '9') {
+        seconds = seconds * 10 + (uint64_t)(*value++ - '0');
+    }
+    interval = seconds;
+}
+
+KERNEL_PARAM(heapProfileArg, "--heap-profile=", intervalCallback);
+
+} // !namespace Profile
+
+#else
+
+namespace Profile {
+
+static inline void recordAlloc(void*, size_t, void*) { }
+static inline void recordFree(void*) { }
+
+} // !namespace Profile
+
+#endif
+
+static void* allocate(size_t size, void* caller)
+{
+    KernelHeap::Cache* cache = taskCache();
+    void* ptr = cache ? KernelHeap::CacheAlloc(cache, size) : NULL;
+    if (!ptr) {
+        RAIIMutex raii(lock);
+        ptr = heap.Alloc(size, cache);
+    }
+    Profile::recordAlloc(ptr, size, caller);
+    return ptr;
+}
+
+static void release(void* ptr)
+{
+    if (!ptr) {
+        return;
+    }
+
+    Profile::recordFree(ptr);
+    KernelHeap::Cache* cache = taskCache();
+    if (cache && KernelHeap::CacheFree(cache, ptr)) {
+        return;
+    }
+
+    RAIIMutex raii(lock);
+    heap.Free(ptr, cache);
+}
 
 extern "C" {
 
-int liballoc_lock()
+void* malloc(size_t size)
+{
+    return allocate(size, __builtin_return_address(0));
+}
+
+void free(void* ptr)
 {
-    return (lock.lock() ? 0 : 1);
+    release(ptr);
 }
 
-int liballoc_unlock()
+void* calloc(size_t count, size_t size)
 {
-    return (lock.unlock() ? 0 : 1);
+    if (size && count > SIZE_MAX / size) {
+        return NULL;
+    }
+
+    void* ptr = allocate(count * size, __builtin_return_address(0));
+    if (ptr) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    void* caller = __builtin_return_address(0);
+    if (!ptr) {
+        return allocate(size, caller);
+    }
+    if (!size) {
+        release(ptr);
+        return NULL;
+    }
+
+    size_t usable = KernelHeap::UsableSize(ptr);
+    if (size <= usable && KernelHeap::ClassFor(size) == KernelHeap::ClassFor(usable)) {
+        Profile::recordFree(ptr);
+        Profile::recordAlloc(ptr, size, caller);
+        return ptr;
+    }
+
+    void* resized = allocate(size, caller);
+    if (resized) {
+        memcpy(resized, ptr, size < usable ? size : usable);
+        release(ptr);
+    }
+    return resized;
+}
+
+}
+
+namespace Memory::Heap {
+
+bool enableTaskCache()
+{
+    struct task* current = tasks_current();
+    if (!current) {
+        return false;
+    }
+    if (!current->heap_cache) {
+        current->heap_cache = (struct heap_cache*)calloc(1, sizeof(struct heap_cache));
+    }
+    return current->heap_cache != NULL;
 }
 
-void* liballoc_alloc(unsigned int count)
+void releaseTaskCache()
 {
-    return Memory::newPageMustSucceed(count * ARCH_PAGE_SIZE - 1);
+    struct task* current = tasks_current();
+    if (!current || !current->heap_cache) {
+        return;
+    }
+
+    struct heap_cache* cache = current->heap_cache;
+    current->heap_cache = NULL;
+    Profile::recordFree(cache);
+    RAIIMutex raii(lock);
+    heap.Flush(&cache->objects);
+    heap.Free(cache);
 }
 
-int liballoc_free(void* page, unsigned int count)
+void report()
 {
-    Memory::freePage(page, count * ARCH_PAGE_SIZE - 1);
-    return 0;
+    KernelHeap::Stats stats;
+    {
+        RAIIMutex raii(lock);
+        stats = heap.Statistics();
+    }
+    LOG_INFO(__func__, "%zu pages (%zu for small objects), %zu large allocations",
+        stats.pages, stats.smallPages, stats.largeAllocs);
 }
 
+void dumpProfile(bool force)
+{
+#ifdef HEAP_PROFILE
+    // A panic may have interrupted a dump or a recording on this processor
+    if (force) {
+        Profile::dump(true);
+        return;
+    }
+    if (Profile::dumpLock.tryLock()) {
+        Profile::dump(false);
+        Profile::dumpLock.unlock();
+    }
+#else
+    (void)force;
+#endif
 }
 
+void profileTask()
+{
+#ifdef HEAP_PROFILE
+    while (Profile::interval) {
+        tasks_nano_sleep(Profile::interval * 1000000000ULL);
+        dumpProfile();
+    }
+#endif
+}
+
+} // !namespace Memory::Heap
+
 void* operator new(size_t size)
 {
-    return malloc(size);
+    return allocate(size, __builtin_return_address(0));
 }
 
 void* operator new[](size_t size)
 {
-    return malloc(size);
+    return allocate(size, __builtin_return_address(0));
 }
 
 void operator delete(void* p)
 {
-    free(p);
+    release(p);
 }
 
 void operator delete[](void* p)
 {
-    free(p);
+    release(p);
 }
 
 void operator delete(void* p, long unsigned int)
 {
-    free(p);
+    release(p);
 }
 
 void operator delete[](void* p, long unsigned int)
 {
-    free(p);
+    release(p);
 }
@@ -1,15 +1,13 @@
 /**
  * @file heap.hpp
  * @author Keeton Feavel (keetonfeavel@cedarville.edu)
- * @brief Liballoc heap implementation
- * @version 0.3
+ * @brief Kernel heap. Small allocations come from segregated size classes,
+ * large ones directly from pages (see Library/SizeClassAllocator.hpp).
+ * @version 0.4
  * @date 2019-11-22
  *
  * @copyright Copyright the Xyris Contributors (c) 2019
- * Code shamelessly taken from the OSDev Wiki. The article
- * can be found at the link below.
  *
- * https://wiki.osdev.org/User:Mrvn/LinkedListBucketHeapImplementation
  */
 #pragma once
 
@@ -17,49 +15,52 @@
 
 extern "C" {
 
+extern void* malloc(size_t);
+extern void* realloc(void*, size_t);
+extern void* calloc(size_t, size_t);
+extern void free(void*);
+
+}
+
+namespace Memory::Heap {
+
 /**
- * @brief This function is supposed to lock the memory data structures. It
- * could be as simple as disabling interrupts or acquiring a spinlock.
- * It's up to you to decide.
+ * @brief Give the running task a private cache of small objects. Allocations
+ * and frees that hit the cache don't take the heap lock. Worth it for tasks
+ * that allocate and free small objects often.
  *
- * @return 0 if the lock was acquired successfully. Anything else is
- * failure.
+ * @return true The task has a cache
+ * @return false No task is running or the cache couldn't be allocated
  */
-int liballoc_lock();
+bool enableTaskCache();
 
 /**
- * @brief This function unlocks what was previously locked by the liballoc_lock
- * function.  If it disabled interrupts, it enables interrupts. If it
- * had acquiried a spinlock, it releases the spinlock. etc.
+ * @brief Give the objects in the running task's cache back to the heap and
+ * release the cache. Called when a task exits.
  *
- * @return 0 if the lock was successfully released.
  */
-int liballoc_unlock();
+void releaseTaskCache();
 
 /**
- * @brief This is the hook into the local system which allocates pages. It
- * accepts an integer parameter which is the number of pages
- * required.  The page size was set up in the liballoc_init function.
+ * @brief Log heap statistics.
  *
- * @return NULL if the pages were not allocated.
- * @return A pointer to the allocated memory.
  */
-void* liballoc_alloc(unsigned int);
+void report();
 
 /**
- * @brief This frees previously allocated memory. The void* parameter passed
- * to the function is the exact same value returned from a previous
- * liballoc_alloc call.
- *
- * The integer value is the number of pages to free.
+ * @brief Write the allocation profile (live bytes, peak bytes, allocation and
+ * free counts and average lifetime per call site) to the serial port. Only
+ * kernels built with HEAP_PROFILE (`scons HEAP_PROFILE=1`) record a profile.
  *
- * @return 0 if the memory was successfully freed.
+ * @param force Dump even if another dump may be in progress (used on panic)
  */
-int liballoc_free(void*, unsigned int);
+void dumpProfile(bool force = false);
 
-extern void* malloc(size_t);
-extern void* realloc(void*, size_t);
-extern void* calloc(size_t, size_t);
-extern void free(void*);
+/**
+ * @brief Dumps the allocation profile periodically. The interval in seconds
+ * is set with the --heap-profile= kernel argument (0 disables periodic dumps).
+ *
+ */
+void profileTask();
 
-}
+} // !namespace Memory::Heap
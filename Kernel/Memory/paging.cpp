@@ -9,8 +9,12 @@
  * @copyright Copyright Keeton Feavel and Micah Switzer (c) 2019
  *
  */
+#include <Arch/Arch.hpp>
 #include <Arch/Memory.hpp>
-#include <Library/Bitset.hpp>
+#include <Library/RangeAllocator.hpp>
+#include <Library/string.hpp>
+#include <Locking/RAII.hpp>
+#include <Locking/Spinlock.hpp>
 #include <Memory/Physical.hpp>
 #include <Memory/paging.hpp>
 #include <Memory/Virtual.hpp>
@@ -23,19 +27,45 @@ namespace Memory {
 
 static Mutex pagingLock("paging");
 
-static Bitset<MEM_BITMAP_SIZE> virtualMemoryBitset;
+// Free kernel virtual address space, in pages
+static RangeAllocator<VIRTUAL_RANGE_EXTENTS> virtualRanges;
+static Spinlock virtualRangesLock("virtual ranges");
+static bool largePages = false;
+static bool writeCombining = false;
+// One page per processor through which new frames are zeroed (see zeroFrame)
+static uintptr_t scratchPages = 0;
+
+// The last directory entry points at the directory itself, so that once the
+// directory is loaded every page table shows up in the last 4 MiB of the
+// address space (table i at PAGING_TABLES_BASE + i pages)
+#define PAGING_RECURSIVE_ENTRY  (ARCH_PAGE_DIR_ENTRIES - 1)
+#define PAGING_TABLES_BASE      ((uintptr_t)PAGING_RECURSIVE_ENTRY << ARCH_PAGE_DIR_ENTRY_SHIFT)
+// Page tables needed before the directory is loaded (early memory, the kernel
+// image, the scratch pages and the frame bitmaps), after which tables come
+// from the frame allocator
+#define PAGING_BOOT_TABLES      12
 
 // both of these must be page aligned for anything to work right at all
 [[gnu::section(".page_tables,\"aw\", @nobits#")]] static struct Arch::Memory::Directory pageDirectory;
-// page tables for the entire 32-bit address space
-[[gnu::section(".page_tables,\"aw\", @nobits#")]] static struct Arch::Memory::Table pageTables[ARCH_PAGE_DIR_ENTRIES];
+[[gnu::section(".page_tables,\"aw\", @nobits#")]] static struct Arch::Memory::Table bootTables[PAGING_BOOT_TABLES];
+static size_t bootTablesUsed = 0;
+// Set once the directory is loaded and the recursive mapping can be used
+static bool directoryLoaded = false;
+static Spinlock tablesLock("page tables");
 
 static void pageFaultCallback(struct registers* regs);
+static bool populateLazyPage(uintptr_t addr);
 static void initDirectory();
 static void mapEarlyMem();
 static void mapKernel();
-static uintptr_t findNextFreeVirtualAddress(size_t seq);
-static void mapKernelPageTable(size_t idx, struct Arch::Memory::Table* table);
+static uintptr_t mapFrameBitmaps();
+static size_t reserveRange(size_t count);
+static bool reserveRangeAt(size_t start, size_t count);
+static void mapKernelPageTable(size_t idx, uintptr_t table);
+static void zeroFrame(uintptr_t frame);
+static struct Arch::Memory::Table* ensureTable(size_t pde);
+static void createTable(size_t pde);
+static bool setLargePage(uintptr_t vaddr, uintptr_t paddr, enum Virtual::MapFlags flags);
 static Virtual::Manager virtualManager("virtual", pageDirectory, ARCH_DIR_ALIGN(KERNEL_START), ARCH_DIR_ALIGN_UP(KERNEL_END - KERNEL_START));
 
 void init()
@@ -43,19 +73,173 @@ void init()
     // DONE: Move logic from this point until next TODO into Kernel.hpp/.cpp
     Interrupts::registerHandler(Interrupts::EXCEPTION_PAGE_FAULT, pageFaultCallback);
     initDirectory();
+    // Page 0 stays reserved so that NULL is never handed out, and the last
+    // directory entry is reserved for the recursive mapping
+    virtualRanges.Free(1, ((ARCH_PAGE_DIR_ENTRIES - 1) * ARCH_PAGE_TABLE_ENTRIES) - 1);
+    // Both must be enabled before a directory using them is loaded
+    largePages = Arch::Memory::pagingEnableLargePages();
+    Arch::Memory::pagingEnableGlobalPages();
+    writeCombining = Arch::Memory::pagingEnableWriteCombining();
     // TODO: Move logic from this point on into Kernel.hpp/.cpp
     mapEarlyMem();  // Map early memory into kernel page tables in a 1:1 manner
     mapKernel();    // Map kernel into kernel page tables
+    scratchPages = reserveRange(ARCH_MAX_CPUS) * ARCH_PAGE_SIZE;
+    ensureTable(scratchPages >> ARCH_PAGE_DIR_ENTRY_SHIFT);
+    ensureTable((scratchPages + (ARCH_MAX_CPUS * ARCH_PAGE_SIZE) - 1) >> ARCH_PAGE_DIR_ENTRY_SHIFT);
+    uintptr_t frameBitmaps = mapFrameBitmaps();
     Arch::Memory::setPageDirectory(Arch::Memory::pageAlign(KADDR_TO_PHYS((uintptr_t)&pageDirectory)));
     Arch::Memory::pagingEnable();
+    directoryLoaded = true;
+    // Page tables (and everything else) come from the frame allocator from here on
+    Physical::Manager::activate((void*)frameBitmaps);
 }
 
+// Page fault error code bits
+#define PAGE_FAULT_PRESENT  0x1     // The page was present (protection violation)
+#define PAGE_FAULT_USERMODE 0x4     // The access came from user mode
+
+// Marker kept in the unused bits of a table entry that isn't present: the page
+// is reserved (see newPageLazy) and gets a frame on first touch
+#define PAGE_LAZY 1
+// Marker for an entry being unmapped by freePage. The frame is kept in the
+// entry until no processor can still be using a stale translation of it.
+#define PAGE_FREEING 2
+
 static void pageFaultCallback(struct registers* regs)
 {
+    if (!(regs->err_code & (PAGE_FAULT_PRESENT | PAGE_FAULT_USERMODE))
+        && populateLazyPage(Arch::Memory::pagingFaultAddress())) {
+        return;
+    }
     panic(regs);
 }
 
-static inline void mapKernelPageTable(size_t idx, struct Arch::Memory::Table* table)
+// Page table of a present (and not large) directory entry
+static struct Arch::Memory::Table* pageTable(size_t pde)
+{
+    if (directoryLoaded) {
+        return (struct Arch::Memory::Table*)(PAGING_TABLES_BASE + (pde * ARCH_PAGE_SIZE));
+    }
+    // Only boot tables exist so far, and those are part of the kernel image
+    return (struct Arch::Memory::Table*)(((uintptr_t)pageDirectory.entries[pde].tableAddr << ARCH_PAGE_TABLE_ENTRY_SHIFT) + KERNEL_BASE);
+}
+
+// Page table entry of an address whose page table exists
+static struct Arch::Memory::TableEntry* tableEntry(uintptr_t vaddr)
+{
+    size_t page = vaddr >> ARCH_PAGE_TABLE_ENTRY_SHIFT;
+    return &pageTable(page / ARCH_PAGE_TABLE_ENTRIES)->entries[page % ARCH_PAGE_TABLE_ENTRIES];
+}
+
+// Get the page table of a directory entry, creating an empty one if needed.
+// Returns NULL if the entry maps a large page.
+static struct Arch::Memory::Table* ensureTable(size_t pde)
+{
+    uintptr_t flags = Arch::CPU::interruptsSave();
+    tablesLock.lock();
+    if (!pageDirectory.entries[pde].present) {
+        createTable(pde);
+    }
+    struct Arch::Memory::Table* table = pageDirectory.entries[pde].size ? NULL : pageTable(pde);
+    tablesLock.unlock();
+    Arch::CPU::interruptsRestore(flags);
+    return table;
+}
+
+// Create an empty page table for a directory entry. The caller holds the tables lock.
+static void createTable(size_t pde)
+{
+    uintptr_t table;
+    if (!directoryLoaded) {
+        if (bootTablesUsed == PAGING_BOOT_TABLES) {
+            panic("Out of boot page tables.\n");
+        }
+        struct Arch::Memory::Table* bootTable = &bootTables[bootTablesUsed++];
+        memset(bootTable, 0, sizeof(struct Arch::Memory::Table));
+        table = KADDR_TO_PHYS((uintptr_t)bootTable);
+    } else {
+        table = Physical::Manager::allocPages(1);
+        if (table == Physical::Manager::npos) {
+            panic("Unable to allocate a page table.\n");
+        }
+        // Cleared before it is linked in, since other processors may walk it right away
+        zeroFrame(table);
+    }
+    mapKernelPageTable(pde, table);
+    if (directoryLoaded) {
+        Arch::Memory::pageInvalidate(pageTable(pde));
+    }
+}
+
+// Zero a physical frame through the scratch page of the executing processor
+static void zeroFrame(uintptr_t frame)
+{
+    uintptr_t flags = Arch::CPU::interruptsSave();
+    void* scratch = (void*)(scratchPages + (Arch::CPU::id() * ARCH_PAGE_SIZE));
+    struct Arch::Memory::TableEntry* entry = tableEntry((uintptr_t)scratch);
+    *entry = {
+        .present = 1,
+        .readWrite = 1,
+        .usermode = 0,
+        .writeThrough = 0,
+        .cacheDisable = 0,
+        .accessed = 0,
+        .dirty = 0,
+        .pageAttrTable = 0,
+        .global = 0,
+        .unused = 0,
+        .pageAddr = (uint32_t)frame >> ARCH_PAGE_TABLE_ENTRY_SHIFT,
+    };
+    Arch::Memory::pageInvalidate(scratch);
+    memset(scratch, 0, ARCH_PAGE_SIZE);
+    memset(entry, 0, sizeof(struct Arch::Memory::TableEntry));
+    Arch::Memory::pageInvalidate(scratch);
+    Arch::CPU::interruptsRestore(flags);
+}
+
+// Back the reserved page containing addr with a zeroed frame. This runs in the
+// page fault handler and can't take the paging lock, so the entry is only ever
+// replaced atomically: if another processor backs the page first (or the page
+// is freed meanwhile), the frame is given back.
+static bool populateLazyPage(uintptr_t addr)
+{
+    // Lazy pages always have a page table, which must not be touched otherwise
+    struct Arch::Memory::DirectoryEntry dirEntry = pageDirectory.entries[addr >> ARCH_PAGE_DIR_ENTRY_SHIFT];
+    if (!dirEntry.present || dirEntry.size) {
+        return false;
+    }
+
+    struct Arch::Memory::TableEntry* entry = tableEntry(addr);
+    struct Arch::Memory::TableEntry expected;
+    __atomic_load(entry, &expected, __ATOMIC_ACQUIRE);
+    if (expected.present) {
+        // Another processor backed the page while this one was faulting
+        return true;
+    }
+    if (expected.unused != PAGE_LAZY) {
+        return false;
+    }
+
+    uintptr_t frame = Physical::Manager::allocPages(1);
+    if (frame == Physical::Manager::npos) {
+        LOG_ERROR(__func__, "Out of memory backing page 0x%08zx", (size_t)addr);
+        return false;
+    }
+    zeroFrame(frame);
+
+    struct Arch::Memory::TableEntry desired = expected;
+    desired.present = 1;
+    desired.unused = 0;
+    desired.pageAddr = (uint32_t)frame >> ARCH_PAGE_TABLE_ENTRY_SHIFT;
+    if (!__atomic_compare_exchange(entry, &expected, &desired, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+        Physical::Manager::freePage(frame);
+        return expected.present;
+    }
+    Arch::Memory::pageInvalidate((void*)Arch::Memory::pageAlign(addr));
+    return true;
+}
+
+static inline void mapKernelPageTable(size_t idx, uintptr_t table)
 {
     pageDirectory.entries[idx] = {
         .present = 1,
@@ -66,40 +250,81 @@ static inline void mapKernelPageTable(size_t idx, struct Arch::Memory::Table* ta
         .accessed = 0,
         .ignoredA = 0,
         .size = 0,
+        .global = 0,
         .ignoredB = 0,
         // TODO: Get rid of this shift by using ``union Address``
-        .tableAddr = (uint32_t)KADDR_TO_PHYS((uintptr_t)table) >> ARCH_PAGE_TABLE_ENTRY_SHIFT
+        .tableAddr = (uint32_t)table >> ARCH_PAGE_TABLE_ENTRY_SHIFT
     };
 }
 
 static void initDirectory()
 {
-    // For every page in kernel memory
-    for (size_t i = 0; i < ARCH_PAGE_DIR_ENTRIES - 1; i++) {
-        mapKernelPageTable(i, &pageTables[i]);
-        // clear out the page tables
-        for (size_t j = 0; j < ARCH_PAGE_TABLE_ENTRIES; j++) {
-            memset(&pageTables[i].entries[j], 0, sizeof(struct Arch::Memory::TableEntry));
-        }
+    // Page tables are created as they are needed (see ensureTable)
+    memset(&pageDirectory, 0, sizeof(pageDirectory));
+    mapKernelPageTable(PAGING_RECURSIVE_ENTRY, KADDR_TO_PHYS((uintptr_t)&pageDirectory));
+}
+
+// In a large page directory entry, the page attribute table bit takes the
+// place of the lowest physical address bit
+#define LARGE_PAGE_PAT 1
+
+static void setEntryFlags(struct Arch::Memory::TableEntry* entry, enum Virtual::MapFlags flags)
+{
+    if (flags & Virtual::READ_ONLY) {
+        entry->readWrite = 0;
+    }
+    if (flags & Virtual::WRITE_THROUGH) {
+        entry->writeThrough = 1;
+    }
+    if (flags & Virtual::CACHE_DISABLE) {
+        entry->cacheDisable = 1;
     }
+    if ((flags & Virtual::WRITE_COMBINING) && writeCombining) {
+        // Page attribute table entry 4 (see Arch::Memory::pagingEnableWriteCombining)
+        entry->writeThrough = 0;
+        entry->cacheDisable = 0;
+        entry->pageAttrTable = 1;
+    }
+}
+
+// Only the higher half is shared by every address space. Identity mapped low
+// memory (e.g. the processor trampoline) must not linger in the TLB as global.
+static inline bool isGlobal(uintptr_t vaddr)
+{
+    return vaddr >= KERNEL_BASE;
 }
 
-void mapKernelPage(Arch::Memory::Address vaddr, Arch::Memory::Address paddr)
+void mapKernelPage(Arch::Memory::Address vaddr, Arch::Memory::Address paddr, enum Virtual::MapFlags flags)
 {
     // Set the page directory entry (pde) and page table entry (pte)
     size_t pde = vaddr.virtualAddress().dirIndex;
     size_t pte = vaddr.virtualAddress().tableIndex;
 
     // Print a debug message to serial
-    Logger::Trace(__func__, "map 0x%0zx to 0x%0zx, pde = 0x%0zx, pte = 0x%0zx", paddr.val(), vaddr.val(), pde, pte);
+    LOG_TRACE(__func__, "map 0x%0zx to 0x%0zx, pde = 0x%0zx, pte = 0x%0zx", paddr.val(), vaddr.val(), pde, pte);
 
     // If the page's virtual address is not aligned
     if (vaddr.virtualAddress().offset) {
         panicf("Attempted to map a non-page-aligned virtual address.\n(Address: 0x%0zx)\n", vaddr.val());
     }
 
+    // If the page is part of a large page, it must already be mapped the same way
+    struct Arch::Memory::DirectoryEntry* dirEntry = &pageDirectory.entries[pde];
+    if (dirEntry->present && dirEntry->size) {
+        if (((uintptr_t)(dirEntry->tableAddr & ~LARGE_PAGE_PAT) << ARCH_PAGE_TABLE_ENTRY_SHIFT) + (vaddr.val() & (ARCH_LARGE_PAGE_SIZE - 1)) == paddr.val()) {
+            return;
+        }
+
+        panic("Attempted to map already mapped page.\n");
+    }
+
+    struct Arch::Memory::Table* table = ensureTable(pde);
+    if (!table) {
+        panic("Attempted to map already mapped page.\n");
+    }
+
     // If the page is already mapped into memory
-    Arch::Memory::TableEntry* entry = &(pageTables[pde].entries[pte]);
+    Arch::Memory::TableEntry* entry = &table->entries[pte];
     if (entry->present) {
         if (entry->pageAddr == paddr.page().pageAddr) {
             // this page was already mapped the same way
@@ -109,7 +334,7 @@ void mapKernelPage(Arch::Memory::Address vaddr, Arch::Memory::Address paddr)
         panic("Attempted to map already mapped page.\n");
     }
     // Set the page information
-    pageTables[pde].entries[pte] = {
+    *entry = {
         .present = 1,                       // The page is present
         .readWrite = 1,                     // The page has r/w permissions
         .usermode = 0,                      // These are kernel pages
@@ -118,69 +343,210 @@ void mapKernelPage(Arch::Memory::Address vaddr, Arch::Memory::Address paddr)
         .accessed = 0,                      // The page is unaccessed
         .dirty = 0,                         // The page is clean
         .pageAttrTable = 0,                 // The page has no attribute table
-        .global = 0,                        // The page is local
+        .global = isGlobal(vaddr.val()),    // Higher half pages are in every address space
         .unused = 0,                        // Ignored
         .pageAddr = paddr.page().pageAddr,  // Page physical address
     };
-    // Set the associated bit in the bitmaps
+    setEntryFlags(entry, flags);
+    // Mark the page as used (pages from newPage are reserved already)
     Physical::Manager::the().setUsed(paddr);
-    virtualMemoryBitset.Set(vaddr.page().pageAddr);
+    reserveRangeAt(vaddr.page().pageAddr, 1);
 }
 
-void mapKernelRangeVirtual(Section sect)
+// Map the large page starting at vaddr with a single directory entry. Fails if
+// large pages aren't supported or part of the range already has a page table.
+static bool mapKernelLargePage(uintptr_t vaddr, uintptr_t paddr, enum Virtual::MapFlags flags)
 {
-    for (Arch::Memory::Address a(sect.base()); a < sect.end(); a += ARCH_PAGE_SIZE) {
-        mapKernelPage(a, a);
+    size_t pde = vaddr >> ARCH_PAGE_DIR_ENTRY_SHIFT;
+    // The last directory entry is reserved for the recursive mapping
+    if (!largePages || pde == PAGING_RECURSIVE_ENTRY) {
+        return false;
+    }
+
+    uintptr_t irqFlags = Arch::CPU::interruptsSave();
+    tablesLock.lock();
+    bool mapped = setLargePage(vaddr, paddr, flags);
+    tablesLock.unlock();
+    Arch::CPU::interruptsRestore(irqFlags);
+    return mapped;
+}
+
+// Point a directory entry at a large page. The caller holds the tables lock.
+static bool setLargePage(uintptr_t vaddr, uintptr_t paddr, enum Virtual::MapFlags flags)
+{
+    size_t pde = vaddr >> ARCH_PAGE_DIR_ENTRY_SHIFT;
+    struct Arch::Memory::DirectoryEntry* dirEntry = &pageDirectory.entries[pde];
+    if (dirEntry->present && !dirEntry->size) {
+        return false;
+    }
+    if (dirEntry->present) {
+        if ((uintptr_t)(dirEntry->tableAddr & ~LARGE_PAGE_PAT) << ARCH_PAGE_TABLE_ENTRY_SHIFT == paddr) {
+            // this page was already mapped the same way
+            return true;
+        }
+
+        panic("Attempted to map already mapped page.\n");
+    }
+    if (!reserveRangeAt(pde * ARCH_PAGE_TABLE_ENTRIES, ARCH_PAGE_TABLE_ENTRIES)) {
+        return false;
+    }
+
+    LOG_TRACE(__func__, "map 0x%0zx to 0x%0zx, pde = 0x%0zx", (size_t)paddr, (size_t)vaddr, pde);
+    *dirEntry = {
+        .present = 1,
+        .readWrite = 1,
+        .usermode = 0,
+        .writeThrough = 0,
+        .cacheDisable = 0,
+        .accessed = 0,
+        .ignoredA = 0,
+        .size = 1,
+        .global = isGlobal(vaddr),
+        .ignoredB = 0,
+        .tableAddr = (uint32_t)paddr >> ARCH_PAGE_TABLE_ENTRY_SHIFT,
+    };
+    if (flags & Virtual::READ_ONLY) {
+        dirEntry->readWrite = 0;
+    }
+    if (flags & Virtual::WRITE_THROUGH) {
+        dirEntry->writeThrough = 1;
     }
+    if (flags & Virtual::CACHE_DISABLE) {
+        dirEntry->cacheDisable = 1;
+    }
+    if ((flags & Virtual::WRITE_COMBINING) && writeCombining) {
+        dirEntry->writeThrough = 0;
+        dirEntry->cacheDisable = 0;
+        dirEntry->tableAddr |= LARGE_PAGE_PAT;
+    }
+    return true;
 }
 
-void mapKernelRangePhysical(Section sect)
+// Map [start, end) to physical memory `offset` bytes below it
+static void mapKernelRange(uintptr_t start, uintptr_t end, uintptr_t offset, bool large, enum Virtual::MapFlags flags)
 {
-    for (Arch::Memory::Address a(sect.base()); a < sect.end(); a += ARCH_PAGE_SIZE) {
-        Arch::Memory::Address phys(KADDR_TO_PHYS(a));
-        mapKernelPage(a, phys);
+    // Large pages need the virtual and physical address at the same offset into the page
+    large = large && (offset & (ARCH_LARGE_PAGE_SIZE - 1)) == 0;
+    for (uintptr_t vaddr = Arch::Memory::pageAlign(start); vaddr < end;) {
+        uintptr_t base = ARCH_DIR_ALIGN(vaddr);
+        if (large && mapKernelLargePage(base, base - offset, flags)) {
+            // Only the pages of the range itself are taken from the physical allocator
+            uintptr_t next = base + ARCH_LARGE_PAGE_SIZE;
+            Section used(vaddr - offset, ((end < next ? end : next) - vaddr + ARCH_PAGE_SIZE - 1) & ~(uintptr_t)(ARCH_PAGE_SIZE - 1));
+            Physical::Manager::the().setUsed(used);
+            vaddr = next;
+            continue;
+        }
+
+        mapKernelPage(vaddr, vaddr - offset, flags);
+        vaddr += ARCH_PAGE_SIZE;
     }
 }
 
+void mapKernelRangeVirtual(Section sect, bool large, enum Virtual::MapFlags flags)
+{
+    mapKernelRange(sect.base(), sect.end(), 0, large, flags);
+}
+
+void mapKernelRangePhysical(Section sect, bool large, enum Virtual::MapFlags flags)
+{
+    mapKernelRange(sect.base(), sect.end(), sect.base() - KADDR_TO_PHYS(sect.base()), large, flags);
+}
+
 static void mapEarlyMem()
 {
     // identity map the first 1 MiB of RAM
-    Logger::Debug(__func__, "==== MAP EARLY MEM ====");
+    LOG_DEBUG(__func__, "==== MAP EARLY MEM ====");
     mapKernelRangeVirtual(Section(EARLY_MEM_START, EARLY_KERNEL_START - EARLY_MEM_START));
 }
 
 static void mapKernel()
 {
-    Logger::Debug(__func__, "==== MAP HH KERNEL ====");
-    mapKernelRangePhysical(Section(Arch::Memory::pageAlign(KERNEL_START), Arch::Memory::pageAlignUp(KERNEL_SIZE)));
+    LOG_DEBUG(__func__, "==== MAP HH KERNEL ====");
+    mapKernelRangePhysical(Section(Arch::Memory::pageAlign(KERNEL_START), Arch::Memory::pageAlignUp(KERNEL_SIZE)), true);
+}
+
+// Map the pages the physical memory manager picked for its bitmaps
+static uintptr_t mapFrameBitmaps()
+{
+    LOG_DEBUG(__func__, "==== MAP FRAME BITMAPS ====");
+    Section storage = Physical::Manager::storage();
+    size_t start = reserveRange(storage.pages());
+    if (start == RangeAllocator<VIRTUAL_RANGE_EXTENTS>::npos) {
+        panic("No address space for the frame bitmaps.\n");
+    }
+    uintptr_t vaddr = start * ARCH_PAGE_SIZE;
+    // Mapping reserves the frames, which keeps them away from the allocator once active
+    mapKernelRange(vaddr, vaddr + storage.size(), vaddr - storage.base(), false, Virtual::NONE);
+    return vaddr;
 }
 
 /**
- * note: this can't find more than 32 sequential pages
- * @param seq the number of sequential pages to get
+ * @param count the number of sequential pages to get
  */
-static uintptr_t findNextFreeVirtualAddress(size_t seq)
+static size_t reserveRange(size_t count)
+{
+    uintptr_t flags = Arch::CPU::interruptsSave();
+    virtualRangesLock.lock();
+    size_t start = virtualRanges.Allocate(count);
+    virtualRangesLock.unlock();
+    Arch::CPU::interruptsRestore(flags);
+    return start;
+}
+
+static bool reserveRangeAt(size_t start, size_t count)
+{
+    uintptr_t flags = Arch::CPU::interruptsSave();
+    virtualRangesLock.lock();
+    bool reserved = virtualRanges.AllocateAt(start, count);
+    virtualRangesLock.unlock();
+    Arch::CPU::interruptsRestore(flags);
+    return reserved;
+}
+
+static void releaseRange(size_t start, size_t count)
+{
+    uintptr_t flags = Arch::CPU::interruptsSave();
+    virtualRangesLock.lock();
+    bool freed = virtualRanges.Free(start, count);
+    virtualRangesLock.unlock();
+    Arch::CPU::interruptsRestore(flags);
+    if (!freed) {
+        LOG_ERROR(__func__, "Unable to release pages 0x%08zx - 0x%08zx", start * ARCH_PAGE_SIZE, (start + count) * ARCH_PAGE_SIZE);
+    }
+}
+
+uintptr_t reserveVirtualRange(size_t pages, uintptr_t addr)
 {
-    return virtualMemoryBitset.FindFirstRange(seq, false);
+    if (addr) {
+        return reserveRangeAt(addr >> ARCH_PAGE_TABLE_ENTRY_SHIFT, pages) ? Arch::Memory::pageAlign(addr) : 0;
+    }
+    size_t start = reserveRange(pages);
+    return start == RangeAllocator<VIRTUAL_RANGE_EXTENTS>::npos ? 0 : start * ARCH_PAGE_SIZE;
+}
+
+void releaseVirtualRange(uintptr_t addr, size_t pages)
+{
+    releaseRange(addr >> ARCH_PAGE_TABLE_ENTRY_SHIFT, pages);
 }
 
 void* newPage(size_t size)
 {
     RAIIMutex lock(pagingLock);
     size_t page_count = PAGE_COUNT(size);
-    size_t free_idx = findNextFreeVirtualAddress(page_count);
+    size_t free_idx = reserveRange(page_count);
 
     if (free_idx == SIZE_MAX) {
         return NULL;
     }
 
     for (size_t i = free_idx; i < free_idx + page_count; i++) {
-        size_t phys_page_idx = Physical::Manager::the().findNextFreePhysicalAddress();
-        if (phys_page_idx == Physical::Manager::npos) {
+        uintptr_t phys_page = Physical::Manager::allocPages(1);
+        if (phys_page == Physical::Manager::npos) {
             return NULL;
         }
 
-        Arch::Memory::Address phys(phys_page_idx * ARCH_PAGE_SIZE);
+        Arch::Memory::Address phys(phys_page);
         Arch::Memory::Address vaddr(i * ARCH_PAGE_SIZE);
         mapKernelPage(vaddr, phys);
     }
@@ -188,6 +554,41 @@ void* newPage(size_t size)
     return (void*)(free_idx * ARCH_PAGE_SIZE);
 }
 
+void* newPageLazy(size_t size, enum Virtual::MapFlags flags)
+{
+    RAIIMutex lock(pagingLock);
+    size_t page_count = PAGE_COUNT(size);
+    size_t free_idx = reserveRange(page_count);
+
+    if (free_idx == SIZE_MAX) {
+        return NULL;
+    }
+
+    for (size_t i = free_idx; i < free_idx + page_count; i++) {
+        struct Arch::Memory::TableEntry entry = {
+            .present = 0,                       // Backed on first touch
+            .readWrite = 1,
+            .usermode = 0,
+            .writeThrough = 0,
+            .cacheDisable = 0,
+            .accessed = 0,
+            .dirty = 0,
+            .pageAttrTable = 0,
+            .global = isGlobal(i * ARCH_PAGE_SIZE),
+            .unused = PAGE_LAZY,
+            .pageAddr = 0,
+        };
+        setEntryFlags(&entry, flags);
+        struct Arch::Memory::Table* table = ensureTable(i / ARCH_PAGE_TABLE_ENTRIES);
+        if (!table) {
+            panic("Attempted to map already mapped page.\n");
+        }
+        __atomic_store(&table->entries[i % ARCH_PAGE_TABLE_ENTRIES], &entry, __ATOMIC_RELEASE);
+    }
+
+    return (void*)(free_idx * ARCH_PAGE_SIZE);
+}
+
 // TODO: Use assert here
 void* newPageMustSucceed(size_t size)
 {
@@ -199,28 +600,86 @@ void* newPageMustSucceed(size_t size)
     return addr;
 }
 
+void TLBFlushBatch::add(uintptr_t vaddr)
+{
+    if (m_count < TLB_FLUSH_BATCH_MAX) {
+        m_pages[m_count] = Arch::Memory::pageAlign(vaddr);
+    }
+    m_count++;
+}
+
+void TLBFlushBatch::flush()
+{
+    if (m_count > TLB_FLUSH_BATCH_MAX) {
+        Arch::Memory::pagingFlushTLB();
+    } else {
+        for (size_t i = 0; i < m_count; i++) {
+            Arch::Memory::pageInvalidate((void*)m_pages[i]);
+        }
+    }
+    m_count = 0;
+}
+
 void freePage(void* page, size_t size)
 {
     RAIIMutex lock(pagingLock);
+    TLBFlushBatch batch;
     size_t page_count = PAGE_COUNT(size);
-    Arch::Memory::Address addr((uintptr_t)page);
-    for (size_t i = addr.virtualAddress().tableIndex; i < addr.virtualAddress().tableIndex + page_count; i++) {
-        virtualMemoryBitset.Clear(i);
-        // this is the same as the line above
-        struct Arch::Memory::TableEntry* pte = &(pageTables[i / ARCH_PAGE_TABLE_ENTRIES].entries[i % ARCH_PAGE_TABLE_ENTRIES]);
+    size_t first = (uintptr_t)page >> ARCH_PAGE_TABLE_ENTRY_SHIFT;
+    bool backed = false;
+    for (size_t i = first; i < first + page_count; i++) {
+        // unmap it atomically, since the page fault handler may be backing a lazy page
+        uintptr_t vaddr = i * ARCH_PAGE_SIZE;
+        struct Arch::Memory::DirectoryEntry* dirEntry = &pageDirectory.entries[i / ARCH_PAGE_TABLE_ENTRIES];
+        if (!dirEntry->present || dirEntry->size) {
+            continue;
+        }
+        struct Arch::Memory::TableEntry freeing = {};
+        struct Arch::Memory::TableEntry pte;
+        __atomic_load(tableEntry(vaddr), &pte, __ATOMIC_ACQUIRE);
+        do {
+            // lazy pages that were never touched have no frame
+            freeing.unused = pte.present ? PAGE_FREEING : 0;
+            freeing.pageAddr = pte.present ? pte.pageAddr : 0;
+        } while (!__atomic_compare_exchange(tableEntry(vaddr), &pte, &freeing, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+        if (pte.present) {
+            batch.add(vaddr);
+            backed = true;
+        }
+    }
+    // every processor must drop its translations before the frames are reused
+    batch.flush();
+    if (backed) {
+        Arch::Memory::pagingShootdownTLB();
+    }
+    for (size_t i = first; backed && i < first + page_count; i++) {
+        uintptr_t vaddr = i * ARCH_PAGE_SIZE;
+        struct Arch::Memory::DirectoryEntry* dirEntry = &pageDirectory.entries[i / ARCH_PAGE_TABLE_ENTRIES];
+        if (!dirEntry->present || dirEntry->size) {
+            continue;
+        }
+        struct Arch::Memory::TableEntry empty = {};
+        struct Arch::Memory::TableEntry pte;
+        __atomic_load(tableEntry(vaddr), &pte, __ATOMIC_ACQUIRE);
+        if (pte.unused != PAGE_FREEING) {
+            continue;
+        }
+        __atomic_store(tableEntry(vaddr), &empty, __ATOMIC_RELEASE);
         // the frame field is actually the page frame's index basically it's frame 0, 1...(2^21-1)
-        Physical::Manager::the().setFree(pte->pageAddr);
-        // zero it out to unmap it
-        memset(pte, 0, sizeof(struct Arch::Memory::TableEntry));
-        // clear that tlb
-        Arch::Memory::pageInvalidate(page);
+        Physical::Manager::freePage((uintptr_t)pte.pageAddr << ARCH_PAGE_TABLE_ENTRY_SHIFT);
     }
+    releaseRange(first, page_count);
 }
 
 bool isPresent(uintptr_t addr)
 {
-    // Convert the address into an index and check whether the page is in the bitmap
-    return virtualMemoryBitset[addr >> ARCH_PAGE_TABLE_ENTRY_SHIFT];
+    // Convert the address into an index and check whether the page is reserved
+    uintptr_t flags = Arch::CPU::interruptsSave();
+    virtualRangesLock.lock();
+    bool present = !virtualRanges.IsFree(addr >> ARCH_PAGE_TABLE_ENTRY_SHIFT);
+    virtualRangesLock.unlock();
+    Arch::CPU::interruptsRestore(flags);
+    return present;
 }
 
 // TODO: maybe enforce access control here in the future
@@ -12,11 +12,49 @@
 
 #include <Arch/Memory.hpp>
 #include <Memory/MemoryMap.hpp>
+#include <Memory/MapFlags.hpp>
 #include <stddef.h>
 #include <stdint.h>
 
+#define TLB_FLUSH_BATCH_MAX 32      // Pages invalidated one by one before the whole TLB is flushed instead
+#define VIRTUAL_RANGE_EXTENTS 1024  // Free extents of kernel virtual address space that can be tracked
+
 namespace Memory {
 
+/**
+ * @brief Collects pages whose translations changed and invalidates them
+ * together once the page table updates are done. Past TLB_FLUSH_BATCH_MAX
+ * pages, a single flush of the whole TLB is cheaper than invalidating every
+ * page. Only the executing processor is flushed.
+ *
+ */
+class TLBFlushBatch {
+public:
+    TLBFlushBatch()
+        : m_count(0)
+    {
+    }
+
+    ~TLBFlushBatch() { flush(); }
+
+    /**
+     * @brief Add a page to the batch.
+     *
+     * @param vaddr Virtual address in the page
+     */
+    void add(uintptr_t vaddr);
+
+    /**
+     * @brief Invalidate every page added since the last flush.
+     *
+     */
+    void flush();
+
+private:
+    size_t m_count;     // Pages added (more than TLB_FLUSH_BATCH_MAX means all of them)
+    uintptr_t m_pages[TLB_FLUSH_BATCH_MAX];
+};
+
 /**
  * @brief Sets up the environment, page directories etc and enables paging.
  *
@@ -33,6 +71,20 @@ void init();
  */
 void* newPage(size_t size);
 
+/**
+ * @brief Reserves pages in memory without backing them yet. Every page gets
+ * a zeroed frame the first time it is touched, so large buffers that are
+ * used sparsely only cost memory for the pages actually used. The first
+ * touch allocates, so it shouldn't happen with interrupts disabled. The
+ * pages can't be used as a stack (the fault would have no stack to run on).
+ * Free them with freePage.
+ *
+ * @param size Size in bytes
+ * @param flags Mapping flags (USERMODE is ignored)
+ * @return void* Page memory address
+ */
+void* newPageLazy(size_t size, enum Virtual::MapFlags flags = Virtual::NONE);
+
 // TODO: Docs
 void* newPageMustSucceed(size_t size);
 
@@ -45,6 +97,24 @@ void* newPageMustSucceed(size_t size);
  */
 void freePage(void* page, size_t size);
 
+/**
+ * @brief Reserve kernel virtual address space without mapping anything into
+ * it. Every page mapped by the kernel is reserved through here as well.
+ *
+ * @param pages Number of pages
+ * @param addr Address the range must start at, or 0 for the lowest free range
+ * @return uintptr_t Start of the range, or 0 if it is not available
+ */
+uintptr_t reserveVirtualRange(size_t pages, uintptr_t addr = 0);
+
+/**
+ * @brief Give back address space reserved with reserveVirtualRange.
+ *
+ * @param addr Start of the range
+ * @param pages Number of pages
+ */
+void releaseVirtualRange(uintptr_t addr, size_t pages);
+
 /**
  * @brief Checks whether an address is mapped into memory.
  *
@@ -66,21 +136,30 @@ uintptr_t getPageDirPhysAddr();
  *
  * @param vaddr Virtual address (in kernel space)
  * @param paddr Physical address
+ * @param flags Mapping flags (USERMODE is ignored)
  */
-void mapKernelPage(Arch::Memory::Address vaddr, Arch::Memory::Address paddr);
+void mapKernelPage(Arch::Memory::Address vaddr, Arch::Memory::Address paddr, enum Virtual::MapFlags flags = Virtual::NONE);
 
 /**
  * @brief Map an address range into the kernel virtual address space.
  *
  * @param sect Memory section
+ * @param large Map the range with large pages where possible. The range is
+ * widened to ARCH_LARGE_PAGE_SIZE boundaries, so neighbouring memory becomes
+ * accessible as well. Falls back to regular pages if large pages are not
+ * supported or part of a large page is already mapped.
+ * @param flags Mapping flags (USERMODE is ignored)
  */
-void mapKernelRangeVirtual(Section sect);
+void mapKernelRangeVirtual(Section sect, bool large = false, enum Virtual::MapFlags flags = Virtual::NONE);
 
 /**
  * @brief Map a kernel address range into physical memory.
  *
  * @param sect Memory section
+ * @param large Map the range with large pages where possible (see
+ * mapKernelRangeVirtual)
+ * @param flags Mapping flags (USERMODE is ignored)
  */
-void mapKernelRangePhysical(Section sect);
+void mapKernelRangePhysical(Section sect, bool large = false, enum Virtual::MapFlags flags = Virtual::NONE);
 
 } // !namespace Paging
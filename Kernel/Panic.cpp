@@ -13,6 +13,8 @@
 #include <Devices/Graphics/graphics.hpp>
 #include <Devices/Serial/rs232.hpp>
 #include <Library/stdio.hpp>
+#include <Logger.hpp>
+#include <Memory/heap.hpp>
 #include <Panic.hpp>
 #include <Stacktrace.hpp>
 #include <Scheduler/tasks.hpp>
@@ -65,6 +67,11 @@ static void printMoo()
 
 [[noreturn]] static void panicInternal(const char* msg, struct registers *registers)
 {
+    Arch::CPU::haltOthers();
+    // Nothing may be lost, and the transmit interrupt may never fire again
+    RS232::setBackpressure(RS232::Backpressure::Wait);
+    RS232::flush(true);
+    Logger::flush(true);
     printMoo();
     if (msg) {
         log_all("%s\n\n", msg);
@@ -76,6 +83,8 @@ static void printMoo()
         log_all("%s", buf);
     }
     Stack::printTrace(PANIC_MAX_TRACE);
+    Memory::Heap::dumpProfile(true);
+    RS232::flush(true);
     Arch::haltAndCatchFire();
 }
 
@@ -13,11 +13,14 @@
 #include <Scheduler/tasks.hpp>
 #include <Panic.hpp>
 #include <Memory/heap.hpp>
+#include <Memory/Slab.hpp>
+#include <Library/Heap.hpp>
 #include <Library/stdio.hpp>
+#include <Library/time.hpp>
 #include <Devices/Serial/rs232.hpp>
 #include <stdint.h>
-#include <x86gprintrin.h>   // needed for __rdtsc
 #include <Arch/i686/timer.hpp> // TODO: Remove ASAP
+#include <Locking/Spinlock.hpp>
 #include <Logger.hpp>
 
 /* forward declarations */
@@ -25,7 +28,8 @@ static void _enqueue_task(struct tasklist *, task *);
 static struct task *_dequeue_task(struct tasklist *);
 static void _cleaner_task_impl(void);
 static void _schedule(void);
-extern "C" void _tasks_enqueue_ready(struct task *task);
+static void _tasks_enqueue_ready(struct task *task);
+static void _arm_timer(struct tasks_cpu *cpu);
 void tasks_update_time();
 void _wakeup(struct task *task);
 
@@ -37,23 +41,42 @@ void _wakeup(struct task *task);
     static inline struct task *_dequeue_##name() { \
         return _dequeue_task(&tasks_##name); }
 
-struct task *current_task = NULL;
+/* per-processor scheduler state */
+struct tasks_cpu
+{
+    size_t id;
+    struct tasklist ready;
+    size_t ready_count;
+    struct task *idle;
+    uint64_t idle_time;
+    uint64_t last_time;
+    uint64_t time_slice_remaining;
+    uint64_t last_timer_time;
+    size_t lock_count;
+    size_t postpone_count;
+    bool postponed;
+    bool tickless;
+};
+
+// sleeping tasks ordered by wakeup time (earliest first)
+struct _wakes_before
+{
+    bool operator()(const struct task *a, const struct task *b) {
+        return a->wakeup_time < b->wakeup_time; }
+};
+
 static struct task _cleaner_task;
 static struct task _first_task;
+static struct task _idle_tasks[ARCH_MAX_CPUS];
+static struct tasks_cpu _cpus[ARCH_MAX_CPUS];
 
-struct tasklist tasks_ready = { /* Zero */ };
-NAMED_TASKLIST(sleeping);
+static MinHeap<struct task, &task::sleep_link, _wakes_before> tasks_sleeping;
 NAMED_TASKLIST(stopped);
 
-// map between task state and the list it is in
-static struct tasklist *_state_lists[TASK_STATE_COUNT] = {
-    [TASK_RUNNING] = NULL, // not in a list
-    [TASK_READY] = &tasks_ready,
-    [TASK_SLEEPING] = &tasks_sleeping,
-    [TASK_BLOCKED] = NULL, // in a list specific to the blocking primitive
-    [TASK_STOPPED] = &tasks_stopped,
-    [TASK_PAUSED] = NULL, // not in a list
-};
+// protects every tasklist and every processor's ready queue
+static Spinlock _scheduler_spinlock("scheduler");
+// Dynamically allocated tasks. Freed by the cleaner after it drops the scheduler lock.
+static Memory::SlabCache taskCache("task", sizeof(struct task), alignof(struct task));
 
 // map between task state and its name
 static const char *_state_names[TASK_STATE_COUNT] = {
@@ -65,57 +88,55 @@ static const char *_state_names[TASK_STATE_COUNT] = {
     [TASK_PAUSED] = "PAUSED",
 };
 
-static uint64_t _idle_time = 0;
-static uint64_t _idle_start = 0;
-static uint64_t _last_time = 0;
-static uint64_t _time_slice_remaining = 0;
-static uint64_t _last_timer_time = 0;
-static size_t _scheduler_lock = 0;
-static size_t _scheduler_postpone_count = 0;
-static bool _scheduler_postponed = false;
-static uint64_t _instr_per_ns;
+// only valid while interrupts are disabled (otherwise the task may migrate)
+static inline struct tasks_cpu *_cpu()
+{
+    return &_cpus[Arch::CPU::id()];
+}
 
 static void _aquire_scheduler_lock()
 {
     asm volatile("cli");
-    _scheduler_postpone_count++;
-    _scheduler_lock++;
+    struct tasks_cpu *cpu = _cpu();
+    if (cpu->lock_count++ == 0) {
+        _scheduler_spinlock.lock();
+    }
+    cpu->postpone_count++;
 }
 
-static void _release_scheduler_lock()
+// drop one level of the scheduler lock without running postponed scheduling
+static void _unlock_scheduler(struct tasks_cpu *cpu)
 {
-    _scheduler_postpone_count--;
-    if (_scheduler_postpone_count == 0) {
-        if (_scheduler_postponed) {
-            _scheduler_postponed = false;
-            _schedule();
-        }
-    }
-    _scheduler_lock--;
-    if (_scheduler_lock == 0) {
+    cpu->lock_count--;
+    if (cpu->lock_count == 0) {
+        _scheduler_spinlock.unlock();
         asm volatile("sti");
     }
 }
 
-static void _discover_cpu_speed()
+static void _release_scheduler_lock()
 {
-    uint32_t curr_tick = timer_tick;
-    uint64_t curr_rtsc = __rdtsc();
-    while (timer_tick != curr_tick + 1) { }
-    curr_rtsc = __rdtsc() - curr_rtsc;
-    _instr_per_ns = curr_rtsc / 1000000;
-    // will be inaccurate, but it's the best we can do in these circumstances
-    if (_instr_per_ns == 0) _instr_per_ns = 1;
+    struct tasks_cpu *cpu = _cpu();
+    cpu->postpone_count--;
+    if (cpu->postpone_count == 0) {
+        if (cpu->postponed) {
+            cpu->postponed = false;
+            _schedule();
+            // this task may have been resumed by another processor
+            cpu = _cpu();
+        }
+    }
+    _unlock_scheduler(cpu);
 }
 
 static inline uint64_t _get_cpu_time_ns()
 {
-    return (__rdtsc()) / _instr_per_ns;
+    return Time::monotonicNs();
 }
 
 static void _print_task(const char* tag, const struct task *task)
 {
-    Logger::Debug(tag, "%s is %s", task->name, _state_names[task->state]);
+    LOG_DEBUG(tag, "%s is %s", task->name, _state_names[task->state]);
 }
 
 #ifdef DEBUG
@@ -127,19 +148,40 @@ static void _print_task(const char* tag, const struct task *task)
 static void _print_tasklist(const char *name, const struct tasklist *list)
 {
     struct task *task = list->head;
-    Logger::Verbose(__func__, "%s:", name);
+    LOG_VERBOSE(__func__, "%s:", name);
     while (task != NULL) {
         _print_task("\t", task);
         task = task->next;
     }
 }
 
+// returns the list that a task in the given state is in
+static const struct tasklist *_state_list(const struct task *task)
+{
+    switch (task->state) {
+        case TASK_READY:
+            return &_cpus[task->cpu].ready;
+        case TASK_STOPPED:
+            return &tasks_stopped;
+        default:
+            // running and paused tasks are not in a list and blocked
+            // tasks are in a list specific to the blocking primitive
+            return NULL;
+    }
+}
+
 static void _print_tasklist(const struct task *task)
 {
-    const struct tasklist *list = _state_lists[task->state];
+    const struct tasklist *list = _state_list(task);
     const char *state_name = _state_names[task->state];
+    if (task->state == TASK_SLEEPING) {
+        // sleeping tasks are kept in a heap instead of a list
+        LOG_VERBOSE(__func__, "%s:", state_name);
+        tasks_sleeping.ForEach([](struct task *sleeper) { _print_task("\t", sleeper); });
+        return;
+    }
     if (list == NULL) {
-        Logger::Warning(__func__, "no tasklist available for %s tasks.", state_name);
+        LOG_WARNING(__func__, "no tasklist available for %s tasks.", state_name);
         return;
     }
 
@@ -148,12 +190,20 @@ static void _print_tasklist(const struct task *task)
 
 static void _on_timer();
 
+static void _init_cpu(size_t id, struct task *idle)
+{
+    struct tasks_cpu *cpu = &_cpus[id];
+    cpu->id = id;
+    cpu->idle = idle;
+    // update the timer variables
+    cpu->last_time = _get_cpu_time_ns();
+    cpu->last_timer_time = cpu->last_time;
+}
+
 void tasks_init()
 {
     // get a pointer to the first task's tcb
     struct task *this_task = &_first_task;
-    // discover the CPU speed for accurate scheduling
-    _discover_cpu_speed();
     *this_task = {
         // this will be filled in when we switch to another task for the first time
         .stack_top = 0,
@@ -171,21 +221,74 @@ void tasks_init()
         .name = "[main]",
         // this is not backed by dynamic memory
         .alloc = ALLOC_STATIC,
+        // this is the bootstrap processor
+        .cpu = 0,
+        .on_cpu = true,
+        // the FPU state is loaded the first time it's used
+        .fpu_used = false,
+        .fpu_cpu = SIZE_MAX,
+        .fpu_state = { },
+        // allocations go straight to the heap
+        .heap_cache = NULL,
+        // not sleeping
+        .sleep_link = { },
     };
     TASK_ACTION(__func__, this_task);
+    // this is the current task
+    Arch::CPU::setCurrentTask(this_task);
     // create a task for the cleaner and set it's state to "paused"
     (void) tasks_new(_cleaner_task_impl, &_cleaner_task, TASK_PAUSED, "[cleaner]");
     _cleaner_task.state = TASK_PAUSED;
-    // update the timer variables
-    _last_time = _get_cpu_time_ns();
-    _last_timer_time = _last_time;
+    // the bootstrap processor's idle task never runs anything but the idle loop
+    (void) tasks_new(tasks_idle, &_idle_tasks[0], TASK_PAUSED, "[idle]");
+    _init_cpu(0, &_idle_tasks[0]);
     // enable time slices
-    _time_slice_remaining = TIME_SLICE_SIZE;
-    // this is the current task
-    current_task = this_task;
+    _cpus[0].time_slice_remaining = TIME_SLICE_SIZE;
     timer_register_callback(_on_timer);
 }
 
+void tasks_init_secondary()
+{
+    size_t id = Arch::CPU::id();
+    struct task *this_task = &_idle_tasks[id];
+    *this_task = {
+        // this will be filled in when we switch to another task for the first time
+        .stack_top = 0,
+        // this will be the same for kernel tasks
+        .page_dir = Memory::getPageDirPhysAddr(),
+        // the idle task is never in a list
+        .next = NULL,
+        // this task is currently running
+        .state = TASK_RUNNING,
+        .time_used = 0,
+        .wakeup_time = 0,
+        .name = "[idle]",
+        .alloc = ALLOC_STATIC,
+        .cpu = id,
+        .on_cpu = true,
+        .fpu_used = false,
+        .fpu_cpu = SIZE_MAX,
+        .fpu_state = { },
+        .heap_cache = NULL,
+        .sleep_link = { },
+    };
+    TASK_ACTION(__func__, this_task);
+    _init_cpu(id, this_task);
+    // idle processors don't use time slices
+    _cpus[id].time_slice_remaining = 0;
+    Arch::CPU::setCurrentTask(this_task);
+}
+
+void tasks_idle()
+{
+    for (;;) {
+        // enable interrupts to process timer and other events
+        asm volatile("sti");
+        // immediately halt the CPU
+        asm volatile("hlt");
+    }
+}
+
 static void _task_starting()
 {
     // this is called whenever a new task is about to start
@@ -193,10 +296,7 @@ static void _task_starting()
 
     // the task before this caused the scheduler to lock
     // so we must unlock here
-    _scheduler_lock--;
-    if (_scheduler_lock == 0) {
-        asm volatile("sti");
-    }
+    _unlock_scheduler(_cpu());
 }
 
 static void _task_stopping()
@@ -276,14 +376,55 @@ static void _remove_task(struct tasklist *list, struct task *task, struct task *
     task->next = NULL;
 }
 
-extern "C" void _tasks_enqueue_ready(struct task *task)
+// must be called with the scheduler lock held
+static void _tasks_enqueue_ready(struct task *task)
 {
-    _enqueue_task(&tasks_ready, task);
+    struct tasks_cpu *cpu = &_cpus[task->cpu];
+    _enqueue_task(&cpu->ready, task);
+    cpu->ready_count++;
+    if (cpu->tickless && cpu == _cpu()) {
+        // bring back the periodic tick so that the new task gets a time slice
+        _arm_timer(cpu);
+    }
+}
+
+static struct task *_tasks_dequeue_ready(struct tasks_cpu *cpu)
+{
+    struct task *task = _dequeue_task(&cpu->ready);
+    if (task != NULL) {
+        cpu->ready_count--;
+    }
+    return task;
 }
 
-static struct task *_tasks_dequeue_ready()
+// take the oldest task from the processor with the longest ready queue
+static struct task *_tasks_steal(struct tasks_cpu *thief)
 {
-    return _dequeue_task(&tasks_ready);
+    struct tasks_cpu *victim = NULL;
+    for (size_t i = 0; i < ARCH_MAX_CPUS; i++) {
+        struct tasks_cpu *cpu = &_cpus[i];
+        if (cpu != thief && cpu->ready_count > (victim == NULL ? 0 : victim->ready_count)) {
+            victim = cpu;
+        }
+    }
+    if (victim == NULL) {
+        return NULL;
+    }
+
+    struct task *pre = NULL;
+    for (struct task *task = victim->ready.head; task != NULL; pre = task, task = task->next) {
+        // a task can be woken up before it has switched away from its processor
+        if (task->on_cpu) {
+            continue;
+        }
+        _remove_task(&victim->ready, task, pre);
+        victim->ready_count--;
+        task->cpu = thief->id;
+        TASK_ACTION(__func__, task);
+        return task;
+    }
+
+    return NULL;
 }
 
 struct task *tasks_new(void (*entry)(void), struct task *storage, task_state state, const char *name)
@@ -291,7 +432,7 @@ struct task *tasks_new(void (*entry)(void), struct task *storage, task_state sta
     struct task *new_task = storage;
     if (storage == NULL) {
         // allocate memory for our task structure
-        new_task = (struct task*)malloc(sizeof(struct task));
+        new_task = (struct task*)taskCache.alloc();
         // panic if the alloc fails (we have no fallback)
         if (new_task == NULL) {
             panic("Unable to allocate memory for new task struct.");
@@ -326,81 +467,102 @@ struct task *tasks_new(void (*entry)(void), struct task *storage, task_state sta
     new_task->time_used = 0;
     new_task->name = name;
     new_task->alloc = storage == NULL ? ALLOC_DYNAMIC : ALLOC_STATIC;
+    new_task->on_cpu = false;
+    new_task->fpu_used = false;
+    new_task->fpu_cpu = SIZE_MAX;
+    new_task->heap_cache = NULL;
+    _aquire_scheduler_lock();
+    // idle processors will steal the task if this one is busy
+    new_task->cpu = _cpu()->id;
     if (state == TASK_READY) {
         _tasks_enqueue_ready(new_task);
     }
+    _release_scheduler_lock();
     TASK_ACTION(__func__, new_task);
     return new_task;
 }
 
+// must be called with the scheduler lock held
 void tasks_update_time()
 {
+    struct tasks_cpu *cpu = _cpu();
+    struct task *current = tasks_current();
     uint64_t current_time = _get_cpu_time_ns();
-    uint64_t delta = current_time - _last_time;
-    if (current_task == NULL) {
-        _idle_time += delta;
+    uint64_t delta = current_time - cpu->last_time;
+    if (current == cpu->idle) {
+        cpu->idle_time += delta;
     } else {
-        current_task->time_used += delta;
+        current->time_used += delta;
+    }
+    cpu->last_time = current_time;
+}
+
+static void _switch_to(struct tasks_cpu *cpu, struct task *task)
+{
+    struct task *current = tasks_current();
+    // count the time that the current task ran for
+    tasks_update_time();
+    if (current->state == TASK_RUNNING) {
+        if (current == cpu->idle) {
+            // the idle task is never in a list
+            current->state = TASK_PAUSED;
+        } else {
+            // the current task was pre-empted
+            current->state = TASK_READY;
+            _tasks_enqueue_ready(current);
+        }
     }
-    _last_time = current_time;
+    // idle processors don't need time slices
+    cpu->time_slice_remaining = task == cpu->idle ? 0 : TIME_SLICE_SIZE;
+    // reset the last "timer time" since the time slice was reset
+    cpu->last_timer_time = _get_cpu_time_ns();
+    // the scheduler lock is held until the switch is complete,
+    // so nobody else can observe these in between
+    current->on_cpu = false;
+    task->on_cpu = true;
+    task->cpu = cpu->id;
+    _arm_timer(cpu);
+    // the FPU state is only saved if the current task used it
+    Arch::CPU::fpuSwitch(current);
+    // switch to the task
+    tasks_switch_to(task);
 }
 
 static void _schedule()
 {
-    if (_scheduler_postpone_count != 0) {
+    struct tasks_cpu *cpu = _cpu();
+    if (cpu->postpone_count != 0) {
         // don't schedule if there's more work to be done
-        _scheduler_postponed = true;
+        cpu->postponed = true;
         return;
     }
-    if (current_task == NULL) {
-        // we are currently idling and will schedule at a later time
+    struct task *current = tasks_current();
+    // get the next task
+    struct task *task = _tasks_dequeue_ready(cpu);
+    if (task == current) {
+        // the current task was woken up again before it could switch away
+        current->state = TASK_RUNNING;
+        cpu->time_slice_remaining = TIME_SLICE_SIZE;
+        _arm_timer(cpu);
         return;
     }
-    // get the next task
-    struct task *task = _tasks_dequeue_ready();
+    // look for work on other processors before going idle
+    if (task == NULL && (current->state != TASK_RUNNING || current == cpu->idle)) {
+        task = _tasks_steal(cpu);
+    }
     // don't need to do anything if there's nothing ready to run
     if (task == NULL) {
-        if (current_task->state == TASK_RUNNING) {
+        if (current->state == TASK_RUNNING) {
             // still running the same task
             // but also reset the time slice counter
-            _time_slice_remaining = TIME_SLICE_SIZE;
+            cpu->time_slice_remaining = current == cpu->idle ? 0 : TIME_SLICE_SIZE;
+            _arm_timer(cpu);
             return;
         }
-        // disable time slices because there are no tasks available to run
-        _time_slice_remaining = 0;
-        // count the time that this task ran for
-        tasks_update_time();
-        /*** idle ***/
-        // borrow this task to return to once we're not idle anymore
-        struct task *borrowed = current_task;
-        // set the current task to null to indicate an idle state
-        current_task = NULL;
-        _idle_start = _get_cpu_time_ns();
-        do {
-            // enable interrupts to process timer and other events
-            asm ("sti");
-            // immediately halt the CPU
-            asm ("hlt");
-            // disable interrupts to restore our lock
-            asm ("cli");
-            // check if there's a task ready to be run
-        } while (task = _tasks_dequeue_ready(), task == NULL);
-        // count the time we spent idling
-        tasks_update_time();
-        // reset the current task
-        current_task = borrowed;
-        _idle_start = _idle_start - _get_cpu_time_ns();
-        _idle_time += _idle_start;
-    } else {
-        // just do time accounting once
-        tasks_update_time();
+        // nothing to run, so idle until a task is woken up
+        task = cpu->idle;
     }
-    // reset the time slice because a new task is being scheduled
-    _time_slice_remaining = TIME_SLICE_SIZE;
-    // reset the last "timer time" since the time slice was reset
-    _last_timer_time = _get_cpu_time_ns();
-    // switch to the task
-    tasks_switch_to(task);
+    _switch_to(cpu, task);
 }
 
 void tasks_schedule()
@@ -415,24 +577,40 @@ void tasks_schedule()
 
 uint64_t tasks_get_self_time()
 {
+    _aquire_scheduler_lock();
     tasks_update_time();
-    return current_task->time_used;
+    uint64_t time_used = tasks_current()->time_used;
+    _release_scheduler_lock();
+    return time_used;
 }
 
 void tasks_block_current(task_state reason)
 {
     _aquire_scheduler_lock();
-    current_task->state = reason;
-    TASK_ACTION(__func__, current_task);
+    struct task *current = tasks_current();
+    current->state = reason;
+    TASK_ACTION(__func__, current);
     _schedule();
     _release_scheduler_lock();
 }
 
+// must be called with the scheduler lock held
+static void _claim_task(struct task *task)
+{
+    // queue woken tasks on the waking processor, since their own processor
+    // may be tickless and wouldn't notice them until its next deadline.
+    // a task that hasn't switched away yet has to stay where it is.
+    if (!task->on_cpu) {
+        task->cpu = _cpu()->id;
+    }
+}
+
 void tasks_unblock(struct task *task)
 {
     _aquire_scheduler_lock();
     task->state = TASK_READY;
     TASK_ACTION(__func__, task);
+    _claim_task(task);
     _tasks_enqueue_ready(task);
     _release_scheduler_lock();
 }
@@ -441,51 +619,76 @@ void _wakeup(struct task *task)
 {
     task->state = TASK_READY;
     task->wakeup_time = (0ULL - 1);
+    _claim_task(task);
     _tasks_enqueue_ready(task);
     TASK_ACTION(__func__, task);
 }
 
+// must be called with the scheduler lock held
+static void _arm_timer(struct tasks_cpu *cpu)
+{
+    if (cpu->ready_count != 0) {
+        // other tasks are waiting, so time slices need the periodic tick
+        if (cpu->tickless) {
+            cpu->tickless = false;
+            timer_periodic();
+        }
+        return;
+    }
+    // nothing to pre-empt to, so only wake up for the next sleeper
+    uint64_t delay = TASKS_TICKLESS_MAX_NS;
+    if (!tasks_sleeping.Empty()) {
+        // fire up to the slack late so that nearby deadlines share one interrupt
+        uint64_t deadline = tasks_sleeping.Top()->wakeup_time + TASKS_TIMER_SLACK_NS;
+        uint64_t time = _get_cpu_time_ns();
+        if (deadline <= time) {
+            delay = 0;
+        } else if (deadline - time < delay) {
+            delay = deadline - time;
+        }
+    }
+    cpu->tickless = true;
+    timer_oneshot(delay);
+}
+
+// runs on every processor's timer tick
 static void _on_timer()
 {
     _aquire_scheduler_lock();
 
-    struct task *pre = NULL;
-    struct task *task = tasks_sleeping.head;
-    struct task *next;
+    struct tasks_cpu *cpu = _cpu();
     bool need_schedule = false;
     uint64_t time = _get_cpu_time_ns();
     uint64_t time_delta;
 
-    while (task != NULL) {
-        next = task->next;
-        if (time >= task->wakeup_time) {
-            Logger::Verbose(__func__, "timer: waking sleeping task");
-            _remove_task(&tasks_sleeping, task, pre);
-            _wakeup(task);
-            task->next = NULL;
-            need_schedule = true;
-        } else {
-            pre = task;
-        }
-        task = next;
+    while (!tasks_sleeping.Empty() && tasks_sleeping.Top()->wakeup_time <= time) {
+        LOG_VERBOSE(__func__, "timer: waking sleeping task");
+        _wakeup(tasks_sleeping.Pop());
+        need_schedule = true;
     }
 
-    if (_time_slice_remaining != 0) {
-        time_delta = time - _last_timer_time;
-        _last_timer_time = time;
-        if (time_delta >= _time_slice_remaining) {
+    if (cpu->time_slice_remaining != 0) {
+        time_delta = time - cpu->last_timer_time;
+        cpu->last_timer_time = time;
+        if (time_delta >= cpu->time_slice_remaining) {
             // schedule (and maybe pre-empt)
             // the schedule function will reset the time slice
-            Logger::Trace(__func__, "timer: time slice expired");
+            LOG_TRACE(__func__, "timer: time slice expired");
             need_schedule = true;
         } else {
             // decrement the time slice counter
-            _time_slice_remaining -= time_delta;
+            cpu->time_slice_remaining -= time_delta;
         }
+    } else if (tasks_current() == cpu->idle) {
+        // an idle processor picks up tasks that were queued (or can be stolen)
+        need_schedule = true;
     }
 
     if (need_schedule) {
         _schedule();
+    } else {
+        // a one-shot tick has to be re-armed every time
+        _arm_timer(cpu);
     }
 
     _release_scheduler_lock();
@@ -495,10 +698,11 @@ void tasks_nano_sleep_until(uint64_t time)
 {
     // TODO: maybe validate that this time is in the future?
     _aquire_scheduler_lock();
-    current_task->state = TASK_SLEEPING;
-    current_task->wakeup_time = time;
-    _enqueue_sleeping(current_task);
-    TASK_ACTION(__func__, current_task);
+    struct task *current = tasks_current();
+    current->state = TASK_SLEEPING;
+    current->wakeup_time = time;
+    tasks_sleeping.Push(current);
+    TASK_ACTION(__func__, current);
     _schedule();
     _release_scheduler_lock();
 }
@@ -511,17 +715,23 @@ void tasks_nano_sleep(uint64_t time)
 void tasks_exit()
 {
     // userspace cleanup can happen here
-    Logger::Debug(__func__, "task \"%s\" (0x%08lx) exiting", current_task->name, (uint32_t)current_task);
+    struct task *current = tasks_current();
+    LOG_DEBUG(__func__, "task \"%s\" (0x%08lx) exiting", current->name, (uint32_t)current);
+    Memory::Heap::releaseTaskCache();
 
     _aquire_scheduler_lock();
     // all scheduling-specific operations must happen here
-    _enqueue_stopped(current_task);
+    _enqueue_stopped(current);
 
     // the ordering of these two should really be reversed
     // but the scheduler currently isn't very smart
     tasks_block_current(TASK_STOPPED);
 
-    tasks_unblock(&_cleaner_task);
+    // the cleaner may already be queued or running on another processor,
+    // and it checks for stopped tasks under the lock before pausing again
+    if (_cleaner_task.state == TASK_PAUSED) {
+        tasks_unblock(&_cleaner_task);
+    }
 
     _release_scheduler_lock();
 }
@@ -534,26 +744,35 @@ static void _clean_stopped_task(struct task *task)
     Memory::freePage((void *)page, 1);
     // somehow determine if the task was dynamically allocated or not
     // just assume statically allocated tasks will never exit (bad idea)
-    if (task->alloc == ALLOC_DYNAMIC) free(task);
+    if (task->alloc == ALLOC_DYNAMIC) taskCache.free(task);
 }
 
 static void _cleaner_task_impl()
 {
     for (;;) {
         struct task *task;
+        struct tasklist stopped = { NULL, NULL };
         _aquire_scheduler_lock();
 
-        while (tasks_stopped.head != NULL) {
-            task = _dequeue_stopped();
-            Logger::Debug(__func__, "cleaning up task %s (0x%08lx)", task->name ? task->name : "N/A", (uint32_t)task);
-            _clean_stopped_task(task);
+        if (tasks_stopped.head == NULL) {
+            // a schedule occuring at this point would be okay
+            // it just needs to occur before the loop repeats
+            tasks_block_current(TASK_PAUSED);
+            _release_scheduler_lock();
+            continue;
         }
 
-        // a schedule occuring at this point would be okay
-        // it just needs to occur before the loop repeats
-        tasks_block_current(TASK_PAUSED);
-
+        // freeing stacks takes the paging mutex, which may block, so the
+        // tasks are only taken off the list while the lock is held
+        while ((task = _dequeue_stopped()) != NULL) {
+            _enqueue_task(&stopped, task);
+        }
         _release_scheduler_lock();
+
+        while ((task = _dequeue_task(&stopped)) != NULL) {
+            LOG_DEBUG(__func__, "cleaning up task %s (0x%08lx)", task->name ? task->name : "N/A", (uint32_t)task);
+            _clean_stopped_task(task);
+        }
     }
 }
 
@@ -562,11 +781,18 @@ void tasks_sync_block(struct task_sync *ts)
     _aquire_scheduler_lock();
 #ifdef DEBUG
     if (ts->dbg_name != NULL) {
-        Logger::Debug(__func__, "blocking %s", ts->dbg_name);
+        LOG_DEBUG(__func__, "blocking %s", ts->dbg_name);
     }
 #endif
+    if (ts->wakeup_pending) {
+        // the primitive was released after the caller checked it,
+        // so return and let the caller check again
+        ts->wakeup_pending = false;
+        _release_scheduler_lock();
+        return;
+    }
     // push the current task to the waiting queue
-    _enqueue_task(&ts->waiting, current_task);
+    _enqueue_task(&ts->waiting, tasks_current());
     // now block until the mutex is freed
     tasks_block_current(TASK_BLOCKED);
     _release_scheduler_lock();
@@ -577,14 +803,15 @@ void tasks_sync_unblock(struct task_sync *ts)
     _aquire_scheduler_lock();
 #ifdef DEBUG
     if (ts->dbg_name != NULL) {
-        Logger::Debug(__func__, "unblocking %s", ts->dbg_name);
+        LOG_DEBUG(__func__, "unblocking %s", ts->dbg_name);
     }
 #endif
     // iterate all tasks that were blocked and unblock them
     struct task *task = ts->waiting.head;
     struct task *next = NULL;
     if (task == NULL) {
-        // no other tasks were blocked
+        // no other tasks were blocked (yet)
+        ts->wakeup_pending = true;
         goto exit;
     }
     do {
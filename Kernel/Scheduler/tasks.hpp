@@ -10,11 +10,18 @@
  */
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <Arch/Arch.hpp>
+#include <Library/Heap.hpp>
 #include <Memory/paging.hpp>
 
 #define TIME_SLICE_SIZE (1 * 1000 * 1000ULL)
+// sleepers due within this long after the first one are woken by the same timer interrupt
+#define TASKS_TIMER_SLACK_NS (100 * 1000ULL)
+// longest a processor without pre-emption work goes between timer interrupts
+// (bounds how long an idle processor takes to notice tasks it could steal)
+#define TASKS_TICKLESS_MAX_NS (10 * 1000 * 1000ULL)
 
 enum task_state
 {
@@ -39,11 +46,31 @@ struct task
     uint64_t wakeup_time;
     const char *name;
     task_alloc alloc;
+    size_t cpu;     // processor whose ready queue the task belongs to
+    bool on_cpu;    // is the task currently running on a processor?
+    // FPU / SSE state, only saved for tasks that use it (see Arch::CPU::fpuSwitch)
+    bool fpu_used;  // has the task ever used the FPU?
+    size_t fpu_cpu; // processor whose FPU registers last held this state (SIZE_MAX if none)
+    uint8_t fpu_state[ARCH_FPU_STATE_SIZE + ARCH_FPU_STATE_ALIGN];
+    struct heap_cache *heap_cache; // private small object cache (see Memory::Heap::enableTaskCache)
+    struct HeapLink<struct task> sleep_link; // position among the sleeping tasks
 };
+// must match the task structure in tasks.s
+static_assert(offsetof(struct task, stack_top) == 0);
+static_assert(offsetof(struct task, page_dir) == 4);
+static_assert(offsetof(struct task, state) == 12);
 
-extern struct task *current_task;
+/**
+ * @brief Returns the task running on the executing processor
+ * (or NULL if the scheduler has not been initialized yet).
+ *
+ */
+static inline struct task *tasks_current()
+{
+    return Arch::CPU::currentTask();
+}
 
-#define TASK_ONLY if (current_task != NULL)
+#define TASK_ONLY if (tasks_current() != NULL)
 
 struct tasklist
 {
@@ -57,6 +84,9 @@ struct task_sync
     struct task* possessor;
     const char *dbg_name;
     struct tasklist waiting;
+    // set when an unblock found nobody waiting, so that a task which
+    // is just about to block (on another processor) retries instead
+    bool wakeup_pending;
 };
 
 static inline void tasks_sync_init(struct task_sync *ts) {
@@ -64,14 +94,29 @@ static inline void tasks_sync_init(struct task_sync *ts) {
         .possessor = NULL,
         .dbg_name = NULL,
         .waiting = { },
+        .wakeup_pending = false,
     };
 }
 
 /**
- * @brief Initializes the kernel task manager.
+ * @brief Initializes the kernel task manager. Must be called on the
+ * bootstrap processor.
  *
  */
 void tasks_init();
+/**
+ * @brief Initializes the scheduler state of an application processor.
+ * The calling context becomes the processor's idle task, so the caller
+ * must continue into tasks_idle once the processor is ready.
+ *
+ */
+void tasks_init_secondary();
+/**
+ * @brief Idle loop. Halts the processor until an interrupt (usually
+ * the timer) gives the scheduler a chance to run something else.
+ *
+ */
+[[noreturn]] void tasks_idle();
 /**
  * @brief Switches to a provided task.
  *
@@ -8,6 +8,7 @@ run_debugger() {
         -S -s \
         -drive file=Distribution/i686/"${MODE}"/xyris.img,index=0,media=disk,format=raw \
         -m 4G \
+        -smp 4 \
         -rtc clock=host \
         -vga std \
         -serial stdio
@@ -17,6 +18,7 @@ run_no_debugger() {
     qemu-system-x86_64 \
         -drive file=Distribution/i686/"${MODE}"/xyris.img,index=0,media=disk,format=raw \
         -m 4G \
+        -smp 4 \
         -rtc clock=host \
         -vga std \
         -serial stdio \
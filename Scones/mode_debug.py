@@ -3,7 +3,11 @@ def generate(env):
         MODE='Debug'
     )
     env.Append(
-        CPPDEFINES={'DEBUG': None},
+        CPPDEFINES={
+            'DEBUG': None,
+            # Log calls below this level are compiled out
+            'LOGGER_MIN_LEVEL': 'LOGGER_LEVEL_TRACE',
+        },
         CCFLAGS=[
             '-ggdb3'
         ],
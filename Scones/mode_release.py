@@ -3,7 +3,11 @@ def generate(env):
         MODE='Release'
     )
     env.Append(
-        CPPDEFINES={'RELEASE': None},
+        CPPDEFINES={
+            'RELEASE': None,
+            # Log calls below this level are compiled out
+            'LOGGER_MIN_LEVEL': 'LOGGER_LEVEL_INFO',
+        },
         CCFLAGS=[
             '-O3',
         ],
@@ -0,0 +1,18 @@
+#include <Library/LinkedList.hpp>
+
+// Linked list node storage hooks. The kernel backs them with object caches,
+// the tests simply use the host heap.
+namespace LinkedList {
+
+void* allocateNode(size_t size)
+{
+    return ::operator new(size);
+}
+
+void freeNode(void* node, size_t size)
+{
+    (void)size;
+    ::operator delete(node);
+}
+
+} // !namespace LinkedList
@@ -0,0 +1,163 @@
+/**
+ * @file test-allocator.cpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief Size class allocator unit tests
+ * @version 0.1
+ * @date 2022-03-23
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ */
+#include <catch2/catch.hpp>
+// Size class allocator is header-only template
+#include <Library/SizeClassAllocator.hpp>
+#include <stdlib.h>
+#include <string.h>
+
+#define ALLOCATOR_PAGE_SIZE 4096
+
+struct HostPages {
+    static inline size_t live = 0;
+
+    static void* Alloc(size_t count)
+    {
+        live += count;
+        return aligned_alloc(ALLOCATOR_PAGE_SIZE, count * ALLOCATOR_PAGE_SIZE);
+    }
+
+    static void Free(void* pages, size_t count)
+    {
+        live -= count;
+        ::free(pages);
+    }
+};
+
+typedef SizeClassAllocator<HostPages, ALLOCATOR_PAGE_SIZE> Allocator;
+
+TEST_CASE("size class allocator operations", "[allocator]") {
+    Allocator allocator;
+
+    SECTION("size classes") {
+        REQUIRE(Allocator::ClassSize(Allocator::ClassFor(0)) == 16);
+        REQUIRE(Allocator::ClassSize(Allocator::ClassFor(1)) == 16);
+        REQUIRE(Allocator::ClassSize(Allocator::ClassFor(17)) == 32);
+        REQUIRE(Allocator::ClassSize(Allocator::ClassFor(65)) == 96);
+        REQUIRE(Allocator::ClassSize(Allocator::ClassFor(1024)) == 1024);
+        REQUIRE(Allocator::ClassFor(1025) == Allocator::ClassCount);
+        for (size_t size = 1; size <= Allocator::MaxSmallSize; size++) {
+            size_t cls = Allocator::ClassFor(size);
+            REQUIRE(Allocator::ClassSize(cls) >= size);
+            REQUIRE((cls == 0 || Allocator::ClassSize(cls - 1) < size));
+        }
+    }
+
+    SECTION("allocations are aligned and don't overlap") {
+        const size_t count = 2000;
+        uint8_t* ptrs[count];
+        size_t sizes[count];
+        uint32_t seed = 1234;
+        for (size_t i = 0; i < count; i++) {
+            seed = seed * 1103515245 + 12345;
+            // Mostly small, some large allocations
+            sizes[i] = (seed >> 8) % 64 == 0 ? (seed >> 12) % 20000 + 1 : (seed >> 12) % 600 + 1;
+            ptrs[i] = (uint8_t*)allocator.Alloc(sizes[i]);
+            REQUIRE(ptrs[i] != nullptr);
+            REQUIRE((uintptr_t)ptrs[i] % Allocator::Alignment == 0);
+            REQUIRE(Allocator::UsableSize(ptrs[i]) >= sizes[i]);
+            memset(ptrs[i], (int)(i & 0xFF), sizes[i]);
+        }
+        for (size_t i = 0; i < count; i++) {
+            for (size_t j = 0; j < sizes[i]; j++) {
+                REQUIRE(ptrs[i][j] == (uint8_t)(i & 0xFF));
+            }
+        }
+        for (size_t i = 0; i < count; i++) {
+            allocator.Free(ptrs[i]);
+        }
+        REQUIRE(allocator.Statistics().largeAllocs == 0);
+        // At most one spare page per class stays around
+        REQUIRE(allocator.Statistics().pages <= Allocator::ClassCount);
+        REQUIRE(HostPages::live == allocator.Statistics().pages);
+    }
+
+    SECTION("freed objects are reused") {
+        void* a = allocator.Alloc(40);
+        allocator.Free(a);
+        REQUIRE(allocator.Alloc(48) == a);
+        allocator.Free(a);
+    }
+
+    SECTION("caches") {
+        Allocator::Cache cache {};
+        void* a = allocator.Alloc(100, &cache);
+        REQUIRE(cache.count[Allocator::ClassFor(100)] == Allocator::CacheDepth / 2);
+        void* b = Allocator::CacheAlloc(&cache, 100);
+        REQUIRE(b != nullptr);
+        REQUIRE(b != a);
+        REQUIRE(Allocator::CacheAlloc(&cache, 5000) == nullptr);
+
+        REQUIRE(Allocator::CacheFree(&cache, a));
+        REQUIRE(Allocator::CacheAlloc(&cache, 100) == a);
+
+        void* large = allocator.Alloc(5000, &cache);
+        REQUIRE_FALSE(Allocator::CacheFree(&cache, large));
+        allocator.Free(large, &cache);
+        REQUIRE(allocator.Statistics().largeAllocs == 0);
+
+        allocator.Free(a, &cache);
+        allocator.Free(b, &cache);
+        allocator.Flush(&cache);
+        for (size_t cls = 0; cls < Allocator::ClassCount; cls++) {
+            REQUIRE(cache.count[cls] == 0);
+        }
+        REQUIRE(allocator.Statistics().pages <= Allocator::ClassCount);
+    }
+}
+
+TEST_CASE("size class allocator benchmarks", "[allocator][!benchmark]") {
+    Allocator allocator;
+    Allocator::Cache cache {};
+    const size_t count = 256;
+    void* ptrs[count];
+    size_t sizes[count];
+    uint32_t seed = 99;
+    for (size_t i = 0; i < count; i++) {
+        seed = seed * 1103515245 + 12345;
+        sizes[i] = (seed >> 8) % 512 + 1;
+    }
+
+    BENCHMARK("host malloc / free") {
+        for (size_t i = 0; i < count; i++) {
+            ptrs[i] = malloc(sizes[i]);
+        }
+        for (size_t i = 0; i < count; i++) {
+            free(ptrs[i]);
+        }
+        return ptrs[0];
+    };
+    BENCHMARK("size classes Alloc / Free") {
+        for (size_t i = 0; i < count; i++) {
+            ptrs[i] = allocator.Alloc(sizes[i]);
+        }
+        for (size_t i = 0; i < count; i++) {
+            allocator.Free(ptrs[i]);
+        }
+        return ptrs[0];
+    };
+    BENCHMARK("size classes with cache") {
+        for (size_t i = 0; i < count; i++) {
+            ptrs[i] = Allocator::CacheAlloc(&cache, sizes[i]);
+            if (!ptrs[i]) {
+                ptrs[i] = allocator.Alloc(sizes[i], &cache);
+            }
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (!Allocator::CacheFree(&cache, ptrs[i])) {
+                allocator.Free(ptrs[i], &cache);
+            }
+        }
+        return ptrs[0];
+    };
+
+    allocator.Flush(&cache);
+}
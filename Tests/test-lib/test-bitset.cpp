@@ -0,0 +1,156 @@
+/**
+ * @file test-bitset.cpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief Bitset unit tests and search benchmarks
+ * @version 0.1
+ * @date 2022-03-15
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ */
+#include <catch2/catch.hpp>
+// Bitset is header-only template
+#include <Library/Bitset.hpp>
+
+#define BITSET_BENCH_BITS (1024 * 1024)
+
+// Reference implementation of the old bit-by-bit search
+template<typename T>
+static size_t naiveFindFirstBit(T& bitset, bool isSet)
+{
+    for (size_t i = 0; i < bitset.Size(); i++) {
+        if (bitset.Test(i) == isSet) {
+            return i;
+        }
+    }
+
+    return T::npos;
+}
+
+template<typename T>
+static size_t naiveFindFirstRange(T& bitset, size_t count, bool isSet)
+{
+    size_t run = 0;
+    for (size_t i = 0; i < bitset.Size(); i++) {
+        run = (bitset.Test(i) == isSet ? run + 1 : 0);
+        if (run == count) {
+            return i + 1 - count;
+        }
+    }
+
+    return T::npos;
+}
+
+TEMPLATE_TEST_CASE("bitset operations", "[bitset]", (Bitset<1000, false>), (Bitset<1000, true>)) {
+    auto bitset = new TestType();
+    REQUIRE(bitset->Size() == 1000);
+    REQUIRE(bitset->None());
+    REQUIRE(bitset->FindFirstBit(true) == bitset->npos);
+    REQUIRE(bitset->FindFirstBit(false) == 0);
+
+    SECTION("single bits") {
+        bitset->Set(77);
+        bitset->Set(77);
+        REQUIRE(bitset->Count() == 1);
+        REQUIRE(bitset->Test(77));
+        REQUIRE(bitset->FindFirstBit(true) == 77);
+        REQUIRE(bitset->FindNextBit(78, true) == bitset->npos);
+        bitset->Flip(999);
+        REQUIRE(bitset->FindNextBit(78, true) == 999);
+        bitset->Clear(77);
+        bitset->Clear(77);
+        REQUIRE(bitset->Count() == 1);
+        REQUIRE(bitset->FindFirstBit(true) == 999);
+    }
+
+    SECTION("ranges") {
+        bitset->SetRange(3, 900);
+        REQUIRE(bitset->Count() == 900);
+        REQUIRE(bitset->FindFirstBit(true) == 3);
+        REQUIRE(bitset->FindNextBit(3, false) == 903);
+        bitset->ClearRange(500, 10);
+        REQUIRE(bitset->Count() == 890);
+        REQUIRE(bitset->FindNextBit(3, false) == 500);
+        // runs longer than a word
+        REQUIRE(bitset->FindFirstRange(497, true) == 3);
+        REQUIRE(bitset->FindFirstRange(498, true) == bitset->npos);
+        bitset->ClearRange(3, 100);
+        REQUIRE(bitset->FindFirstRange(397, true) == 103);
+        REQUIRE(bitset->FindFirstRange(398, true) == bitset->npos);
+        bitset->SetRange(3, 100);
+        REQUIRE(bitset->FindFirstRange(10, false) == 500);
+        REQUIRE(bitset->FindFirstRange(97, false) == 903);
+        REQUIRE(bitset->FindFirstRange(98, false) == bitset->npos);
+        // clamped to the end of the set
+        bitset->SetRange(990, 100);
+        REQUIRE(bitset->Count() == 900);
+        bitset->SetRange(0, 1000);
+        REQUIRE(bitset->All());
+        REQUIRE(bitset->FindFirstBit(false) == bitset->npos);
+    }
+
+    SECTION("matches bit-by-bit search") {
+        uint32_t seed = 12345;
+        for (size_t i = 0; i < 2000; i++) {
+            seed = seed * 1103515245 + 12345;
+            size_t pos = (seed >> 8) % 1000;
+            size_t len = (seed >> 20) % 80;
+            (seed & 1) ? bitset->SetRange(pos, len) : bitset->ClearRange(pos, len);
+
+            size_t count = (seed >> 4) % 70 + 1;
+            REQUIRE(bitset->FindFirstBit(true) == naiveFindFirstBit(*bitset, true));
+            REQUIRE(bitset->FindFirstBit(false) == naiveFindFirstBit(*bitset, false));
+            REQUIRE(bitset->FindFirstRange(count, true) == naiveFindFirstRange(*bitset, count, true));
+            REQUIRE(bitset->FindFirstRange(count, false) == naiveFindFirstRange(*bitset, count, false));
+        }
+    }
+
+    delete bitset;
+}
+
+TEST_CASE("runtime sized bitset", "[bitset]") {
+    auto storage = new size_t[Bitset<0>::StorageWords(1000)];
+    auto bitset = new Bitset<0>(1000, storage, true);
+    REQUIRE(bitset->Size() == 1000);
+    REQUIRE(bitset->All());
+    REQUIRE(bitset->FindFirstBit(false) == bitset->npos);
+    bitset->ClearRange(990, 100);
+    REQUIRE(bitset->Count() == 990);
+    REQUIRE(bitset->FindFirstRange(10, false) == 990);
+    REQUIRE(bitset->FindFirstRange(11, false) == bitset->npos);
+    delete bitset;
+    delete[] storage;
+}
+
+TEST_CASE("bitset search benchmarks", "[bitset][!benchmark]") {
+    // Mostly used set (like a memory map) with a single free run near the end
+    auto flat = new Bitset<BITSET_BENCH_BITS, false>(true);
+    auto summary = new Bitset<BITSET_BENCH_BITS, true>(true);
+    flat->ClearRange(BITSET_BENCH_BITS - 100, 64);
+    summary->ClearRange(BITSET_BENCH_BITS - 100, 64);
+    REQUIRE(naiveFindFirstBit(*flat, false) == BITSET_BENCH_BITS - 100);
+
+    BENCHMARK("FindFirstBit bit-by-bit") {
+        return naiveFindFirstBit(*flat, false);
+    };
+    BENCHMARK("FindFirstBit word-at-a-time") {
+        return flat->FindFirstBit(false);
+    };
+    BENCHMARK("FindFirstBit with summary") {
+        return summary->FindFirstBit(false);
+    };
+    BENCHMARK("FindFirstRange word-at-a-time") {
+        return flat->FindFirstRange(64, false);
+    };
+    BENCHMARK("FindFirstRange with summary") {
+        return summary->FindFirstRange(64, false);
+    };
+    BENCHMARK("SetRange / ClearRange with summary") {
+        summary->ClearRange(4096, 65536);
+        summary->SetRange(4096, 65536);
+        return summary->Count();
+    };
+
+    delete flat;
+    delete summary;
+}
@@ -0,0 +1,130 @@
+/**
+ * @file test-buddy.cpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief Buddy allocator unit tests
+ * @version 0.1
+ * @date 2022-03-14
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ */
+#include <catch2/catch.hpp>
+// Buddy allocator is header-only template
+#include <Library/Buddy.hpp>
+
+TEST_CASE("buddy allocator operations", "[buddy]") {
+    // 4 maximum order (16 block) runs
+    Buddy<64, 4> buddy;
+    REQUIRE(buddy.FreeCount() == 0);
+    REQUIRE(buddy.Alloc(1) == buddy.npos);
+    buddy.Free(0, 64);
+    REQUIRE(buddy.FreeCount() == 64);
+
+    SECTION("single blocks") {
+        for (size_t i = 0; i < 64; i++) {
+            REQUIRE(buddy.Alloc(1) == i);
+        }
+        REQUIRE(buddy.FreeCount() == 0);
+        REQUIRE(buddy.Alloc(1) == buddy.npos);
+        for (size_t i = 0; i < 64; i++) {
+            buddy.Free(i, 1);
+        }
+        REQUIRE(buddy.FreeCount() == 64);
+        // everything merged back into maximum order blocks
+        REQUIRE(buddy.Alloc(16) == 0);
+    }
+
+    SECTION("contiguous runs are aligned and trimmed") {
+        size_t a = buddy.Alloc(3);
+        REQUIRE(a == 0);
+        REQUIRE(buddy.FreeCount() == 61);
+        // the trimmed tail is handed out first
+        REQUIRE(buddy.Alloc(1) == 3);
+        size_t b = buddy.Alloc(16);
+        REQUIRE(b % 16 == 0);
+        REQUIRE(buddy.Alloc(17) == buddy.npos);
+        buddy.Free(a, 3);
+        buddy.Free(3, 1);
+        buddy.Free(b, 16);
+        REQUIRE(buddy.FreeCount() == 64);
+    }
+
+    SECTION("reserve") {
+        REQUIRE(buddy.Reserve(5));
+        REQUIRE_FALSE(buddy.Reserve(5));
+        REQUIRE_FALSE(buddy.IsFree(5));
+        REQUIRE(buddy.IsFree(4));
+        REQUIRE(buddy.IsFree(6));
+        REQUIRE(buddy.FreeCount() == 63);
+        // the block containing 5 can no longer be handed out whole
+        for (size_t i = 0; i < 63; i++) {
+            REQUIRE(buddy.Alloc(1) != 5);
+        }
+        REQUIRE(buddy.Alloc(1) == buddy.npos);
+    }
+
+    SECTION("reserve ranges") {
+        REQUIRE(buddy.Reserve(20));
+        // partly reserved already, spans several maximum order blocks
+        REQUIRE(buddy.ReserveRange(3, 40) == 39);
+        REQUIRE(buddy.FreeCount() == 24);
+        REQUIRE(buddy.IsFree(2));
+        REQUIRE_FALSE(buddy.IsFree(3));
+        REQUIRE_FALSE(buddy.IsFree(42));
+        REQUIRE(buddy.IsFree(43));
+        REQUIRE(buddy.ReserveRange(0, 64) == 24);
+        REQUIRE(buddy.FreeCount() == 0);
+        REQUIRE(buddy.Alloc(1) == buddy.npos);
+        buddy.Free(0, 64);
+        REQUIRE(buddy.Alloc(16) == 0);
+    }
+
+    SECTION("unaligned free") {
+        Buddy<64, 4> partial;
+        partial.Free(3, 29);
+        REQUIRE(partial.FreeCount() == 29);
+        REQUIRE_FALSE(partial.IsFree(2));
+        REQUIRE(partial.IsFree(3));
+        REQUIRE(partial.IsFree(31));
+        REQUIRE_FALSE(partial.IsFree(32));
+        REQUIRE(partial.Alloc(16) == 16);
+    }
+
+    SECTION("runtime block count") {
+        typedef Buddy<0, 4> RuntimeBuddy;
+        size_t storage[RuntimeBuddy::StorageWords(128)];
+        RuntimeBuddy runtime;
+        REQUIRE(runtime.Size() == 0);
+        runtime.Init(128, storage);
+        REQUIRE(runtime.Size() == 128);
+        REQUIRE(runtime.FreeCount() == 0);
+        runtime.Free(0, 128);
+        REQUIRE(runtime.FreeCount() == 128);
+        REQUIRE(runtime.Alloc(16) == 0);
+        REQUIRE(runtime.Alloc(1) == 16);
+        REQUIRE(runtime.FreeCount() == 111);
+    }
+}
+
+TEST_CASE("buddy reserve benchmarks", "[buddy][!benchmark]") {
+    // A 4 GiB machine in 4 KiB pages
+    typedef Buddy<0, 10> Frames;
+    const size_t blocks = 1024 * 1024;
+    auto storage = new size_t[Frames::StorageWords(blocks)];
+    Frames frames;
+    frames.Init(blocks, storage);
+
+    BENCHMARK("Reserve block-by-block") {
+        frames.Free(0, blocks);
+        for (size_t i = 0; i < blocks; i++) {
+            frames.Reserve(i);
+        }
+        return frames.FreeCount();
+    };
+    BENCHMARK("ReserveRange") {
+        frames.Free(0, blocks);
+        return frames.ReserveRange(0, blocks);
+    };
+
+    delete[] storage;
+}
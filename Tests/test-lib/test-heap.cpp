@@ -0,0 +1,73 @@
+/**
+ * @file test-heap.cpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief Min-heap unit tests
+ * @version 0.1
+ * @date 2022-03-16
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ */
+#include <catch2/catch.hpp>
+// Heap is header-only template
+#include <Library/Heap.hpp>
+
+struct Item {
+    int value;
+    HeapLink<Item> link;
+};
+
+struct LessThan {
+    bool operator()(const Item* a, const Item* b) { return a->value < b->value; }
+};
+
+typedef MinHeap<Item, &Item::link, LessThan> ItemHeap;
+
+TEST_CASE("min-heap operations", "[heap]") {
+    ItemHeap heap;
+    Item items[1000];
+    REQUIRE(heap.Empty());
+
+    SECTION("pops in order") {
+        uint32_t seed = 4321;
+        for (size_t i = 0; i < 1000; i++) {
+            seed = seed * 1103515245 + 12345;
+            items[i].value = (int)((seed >> 8) % 100);
+            heap.Push(&items[i]);
+        }
+        REQUIRE(heap.Size() == 1000);
+
+        size_t visited = 0;
+        heap.ForEach([&visited](Item*) { visited++; });
+        REQUIRE(visited == 1000);
+
+        int last = -1;
+        while (!heap.Empty()) {
+            int value = heap.Pop()->value;
+            REQUIRE(value >= last);
+            last = value;
+        }
+        REQUIRE(heap.Size() == 0);
+    }
+
+    SECTION("interleaved push and pop") {
+        const int values[] = { 5, 3, 8, 1 };
+        for (size_t i = 0; i < 4; i++) {
+            items[i].value = values[i];
+        }
+        heap.Push(&items[0]);
+        heap.Push(&items[1]);
+        heap.Push(&items[2]);
+        REQUIRE(heap.Top()->value == 3);
+        REQUIRE(heap.Pop()->value == 3);
+        heap.Push(&items[3]);
+        REQUIRE(heap.Size() == 3);
+        REQUIRE(heap.Pop()->value == 1);
+        REQUIRE(heap.Pop()->value == 5);
+        // Popped elements can go back in
+        heap.Push(&items[1]);
+        REQUIRE(heap.Pop()->value == 3);
+        REQUIRE(heap.Pop()->value == 8);
+        REQUIRE(heap.Empty());
+    }
+}
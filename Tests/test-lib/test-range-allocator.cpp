@@ -0,0 +1,112 @@
+/**
+ * @file test-range-allocator.cpp
+ * @author Keeton Feavel (keeton@xyr.is)
+ * @brief Range allocator unit tests
+ * @version 0.1
+ * @date 2022-03-25
+ *
+ * @copyright Copyright the Xyris Contributors (c) 2022
+ *
+ */
+#include <catch2/catch.hpp>
+// Range allocator is header-only template
+#include <Library/RangeAllocator.hpp>
+
+#define RANGE_TEST_NODES 256
+#define RANGE_TEST_SIZE 4096
+
+typedef RangeAllocator<RANGE_TEST_NODES> Allocator;
+
+TEST_CASE("range allocator operations", "[range_allocator]") {
+    Allocator allocator;
+    REQUIRE(allocator.Allocate(1) == Allocator::npos);
+    REQUIRE(allocator.Free(0, RANGE_TEST_SIZE));
+    REQUIRE(allocator.FreeCount() == RANGE_TEST_SIZE);
+    REQUIRE(allocator.Largest() == RANGE_TEST_SIZE);
+
+    SECTION("allocations are first fit") {
+        REQUIRE(allocator.Allocate(10) == 0);
+        REQUIRE(allocator.Allocate(5) == 10);
+        REQUIRE(allocator.Free(0, 10));
+        REQUIRE(allocator.Allocate(20) == 15);
+        REQUIRE(allocator.Allocate(10) == 0);
+        REQUIRE(allocator.Allocate(RANGE_TEST_SIZE) == Allocator::npos);
+    }
+
+    SECTION("fixed ranges split extents") {
+        REQUIRE(allocator.AllocateAt(100, 50));
+        REQUIRE(allocator.Extents() == 2);
+        REQUIRE_FALSE(allocator.AllocateAt(149, 2));
+        REQUIRE_FALSE(allocator.IsFree(100));
+        REQUIRE_FALSE(allocator.IsFree(149));
+        REQUIRE(allocator.IsFree(99));
+        REQUIRE(allocator.IsFree(150));
+        REQUIRE(allocator.Allocate(101) == 150);
+        REQUIRE(allocator.Free(100, 50));
+        REQUIRE(allocator.Extents() == 2);
+        REQUIRE(allocator.Free(150, 101));
+        REQUIRE(allocator.Extents() == 1);
+        REQUIRE(allocator.Largest() == RANGE_TEST_SIZE);
+    }
+
+    SECTION("double frees are refused") {
+        REQUIRE(allocator.AllocateAt(10, 10));
+        REQUIRE_FALSE(allocator.Free(5, 10));
+        REQUIRE_FALSE(allocator.Free(15, 10));
+        REQUIRE(allocator.Free(10, 10));
+        REQUIRE(allocator.FreeCount() == RANGE_TEST_SIZE);
+    }
+
+    SECTION("matches a reference bitmap") {
+        bool used[RANGE_TEST_SIZE] = {};
+        // Live allocations as (start, count) pairs
+        size_t live[RANGE_TEST_SIZE][2];
+        size_t liveCount = 0;
+        uint32_t seed = 4321;
+        for (size_t i = 0; i < 5000; i++) {
+            seed = seed * 1103515245 + 12345;
+            if (liveCount == 0 || (seed >> 8) % 3) {
+                size_t count = (seed >> 12) % 40 + 1;
+                // Reference first fit
+                size_t expected = Allocator::npos;
+                for (size_t start = 0, run = 0; start < RANGE_TEST_SIZE; start++) {
+                    run = used[start] ? 0 : run + 1;
+                    if (run == count) {
+                        expected = start + 1 - count;
+                        break;
+                    }
+                }
+                size_t start = allocator.Allocate(count);
+                REQUIRE(start == expected);
+                if (start == Allocator::npos) {
+                    continue;
+                }
+                for (size_t j = start; j < start + count; j++) {
+                    used[j] = true;
+                }
+                live[liveCount][0] = start;
+                live[liveCount][1] = count;
+                liveCount++;
+            } else {
+                size_t idx = (seed >> 12) % liveCount;
+                REQUIRE(allocator.Free(live[idx][0], live[idx][1]));
+                for (size_t j = live[idx][0]; j < live[idx][0] + live[idx][1]; j++) {
+                    used[j] = false;
+                }
+                liveCount--;
+                live[idx][0] = live[liveCount][0];
+                live[idx][1] = live[liveCount][1];
+            }
+        }
+        size_t freeCount = 0;
+        for (size_t j = 0; j < RANGE_TEST_SIZE; j++) {
+            REQUIRE(allocator.IsFree(j) == !used[j]);
+            freeCount += !used[j];
+        }
+        REQUIRE(allocator.FreeCount() == freeCount);
+        for (size_t j = 0; j < liveCount; j++) {
+            REQUIRE(allocator.Free(live[j][0], live[j][1]));
+        }
+        REQUIRE(allocator.Extents() == 1);
+    }
+}